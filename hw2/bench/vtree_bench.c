@@ -0,0 +1,388 @@
+/* vtree_bench.c
+
+ * A benchmark for vtree's walk.  It builds a synthetic tree of a given
+ * shape (depth, directories per directory, files per directory, and
+ * how many of the files get a hard link or a symbolic link as well),
+ * then runs vtree over it in each of the quick (-q), visual (-v),
+ * default and sorted (-o) modes, with the page and inode caches warm
+ * and, when it's allowed to drop them, cold.  For each it reports the
+ * time, the entries a second, and the system calls vtree made per
+ * entry.
+ *
+ * The calls are counted on a separate run under ptrace(2), stopping
+ * vtree at every system call as strace -c does, so the timed runs
+ * aren't slowed by it.  The calls vtree makes on an empty directory
+ * (starting up, reading its options) are taken off first, which
+ * leaves what the walk itself costs.
+ *
+ *   vtree_bench [ -b vtree ] [ -d depth ] [ -w width ] [ -f files ]
+ *               [ -L n ] [ -S n ] [ -r runs ] [ -k ] [ dir ]
+ *
+ * -L n and -S n give every n'th file a hard link or a symbolic link
+ * (to the file beside it), 0 for none.  The tree is made in a new
+ * directory under dir (/tmp by default), and removed again unless -k
+ * is given.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/ptrace.h>
+
+#define B_DEPTH		3	/* default shape: 1111 directories, */
+#define B_WIDTH		10	/* 22220 files, 10% of them hard */
+#define B_FILES		20	/* linked and 5% symbolic linked */
+#define B_LINKS		10
+#define B_SYMLINKS	20
+#define B_RUNS		5	/* timed runs per mode, the median is kept */
+#define B_FILESIZE	1500	/* bytes in each file, a bit over 1K */
+
+#define DROP_CACHES	"/proc/sys/vm/drop_caches"
+
+struct mode {
+    char           *name;	/* as printed */
+    char           *opt;	/* vtree option, NULL for none */
+};
+
+static struct mode modes[] = {
+    { "-q", "-q" },
+    { "-v", "-v" },
+    { "default", NULL },
+    { "-o", "-o" },
+    { NULL, NULL }
+};
+
+static char    *vtree = "bin/vtree";
+static int      depth = B_DEPTH, width = B_WIDTH, files = B_FILES;
+static int      links = B_LINKS, symlinks = B_SYMLINKS;
+static long     entries;	/* in the tree, top directory included */
+static long     nfiles;		/* files made, to pace the links */
+
+static double now(void);
+static int make_tree(char *path, int level);
+static int remove_one(const char *path, const struct stat *st, int flag,
+    struct FTW *ftw);
+static int drop_caches(void);
+static pid_t start(char *opt, char *dir, int traced);
+static double timed(char *opt, char *dir);
+static long syscalls(char *opt, char *dir);
+static int by_time(const void *a, const void *b);
+
+
+static double
+now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+ /*
+  * Fill directory path, level levels down, with its files and links
+  * and (above the bottom level) its subdirectories.  Returns -1 if
+  * something couldn't be made.
+  */
+static int
+make_tree(path, level)
+    char           *path;
+    int             level;
+{
+    static char     data[B_FILESIZE];
+    char            name[PATH_MAX], other[PATH_MAX];
+    int             i, fd;
+
+    for (i = 0; i < files; i++) {
+	snprintf(name, sizeof(name), "%s/f%d", path, i);
+	if ((fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0
+	    || write(fd, data, sizeof(data)) != sizeof(data)) {
+	    perror(name);
+	    return -1;
+	}
+	close(fd);
+	entries++;
+	nfiles++;
+	if (links && nfiles % links == 0) {
+	    snprintf(other, sizeof(other), "%s/h%d", path, i);
+	    if (link(name, other) < 0) {
+		perror(other);
+		return -1;
+	    }
+	    entries++;
+	}
+	if (symlinks && nfiles % symlinks == 0) {
+	    snprintf(other, sizeof(other), "%s/s%d", path, i);
+	    snprintf(name, sizeof(name), "f%d", i);
+	    if (symlink(name, other) < 0) {
+		perror(other);
+		return -1;
+	    }
+	    entries++;
+	}
+    }
+    if (level == depth)
+	return 0;
+    for (i = 0; i < width; i++) {
+	snprintf(name, sizeof(name), "%s/d%d", path, i);
+	if (mkdir(name, 0755) < 0) {
+	    perror(name);
+	    return -1;
+	}
+	entries++;
+	if (make_tree(name, level + 1) < 0)
+	    return -1;
+    }
+    return 0;
+}
+
+
+static int
+remove_one(path, st, flag, ftw)
+    const char     *path;
+    const struct stat *st;
+    int             flag;
+    struct FTW     *ftw;
+{
+    return remove(path) < 0 ? -1 : 0;
+}
+
+
+ /*
+  * Write back and drop the page, dentry and inode caches, so the next
+  * run reads from the disk.  Only root can; returns -1 otherwise.
+  */
+static int
+drop_caches()
+{
+    int             fd, rc;
+
+    sync();
+    if ((fd = open(DROP_CACHES, O_WRONLY)) < 0)
+	return -1;
+    rc = write(fd, "3\n", 2) == 2 ? 0 : -1;
+    close(fd);
+    return rc;
+}
+
+
+ /*
+  * Start vtree with option opt (if any) on dir, its output thrown
+  * away.  A traced vtree stops before it execs, for the tracer to
+  * take over.
+  */
+static pid_t
+start(opt, dir, traced)
+    char           *opt, *dir;
+    int             traced;
+{
+    char           *argv[4];
+    pid_t           pid;
+    int             fd, i = 0;
+
+    argv[i++] = vtree;
+    if (opt)
+	argv[i++] = opt;
+    argv[i++] = dir;
+    argv[i] = NULL;
+
+    if ((pid = fork()) < 0) {
+	perror("fork");
+	exit(1);
+    }
+    if (pid == 0) {
+	if ((fd = open("/dev/null", O_WRONLY)) >= 0) {
+	    dup2(fd, 1);
+	    dup2(fd, 2);
+	}
+	if (traced) {
+	    ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+	    raise(SIGSTOP);
+	}
+	execv(vtree, argv);
+	_exit(127);
+    }
+    return pid;
+}
+
+
+ /* Seconds one run of vtree takes, -1 if it fails. */
+static double
+timed(opt, dir)
+    char           *opt, *dir;
+{
+    double          t0 = now();
+    int             status;
+
+    waitpid(start(opt, dir, 0), &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	return -1;
+    return now() - t0;
+}
+
+
+ /*
+  * System calls one run of vtree makes, -1 if it fails.  Every call
+  * stops the tracee twice, going in and coming out; execve's return
+  * and the exit_group that never returns each stop once, and balance.
+  */
+static long
+syscalls(opt, dir)
+    char           *opt, *dir;
+{
+    pid_t           pid = start(opt, dir, 1);
+    long            stops = 0;
+    int             status, sig;
+
+    waitpid(pid, &status, 0);	/* the SIGSTOP */
+    ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *) PTRACE_O_TRACESYSGOOD);
+    ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+    for (;;) {
+	if (waitpid(pid, &status, 0) < 0 || WIFEXITED(status)
+	    || WIFSIGNALED(status))
+	    break;
+	sig = 0;
+	if (WIFSTOPPED(status)) {
+	    if (WSTOPSIG(status) == (SIGTRAP | 0x80))
+		stops++;
+	    else if (WSTOPSIG(status) != SIGTRAP)
+		sig = WSTOPSIG(status);
+	}
+	ptrace(PTRACE_SYSCALL, pid, NULL, (void *) (long) sig);
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	return -1;
+    return stops / 2;
+}
+
+
+static int
+by_time(a, b)
+    const void     *a, *b;
+{
+    double          x = *(const double *) a, y = *(const double *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+
+int
+main(argc, argv)
+    int             argc;
+    char           *argv[];
+{
+    char            top[PATH_MAX], empty[PATH_MAX + 8], *parent = "/tmp";
+    double          t[64], secs;
+    long            base, calls;
+    int             c, i, r, cold, runs = B_RUNS, keep = 0, can_drop;
+    struct mode    *m;
+
+    while ((c = getopt(argc, argv, "b:d:w:f:L:S:r:k")) != EOF)
+	switch (c) {
+	case 'b':
+	    vtree = optarg;
+	    break;
+	case 'd':
+	    depth = atoi(optarg);
+	    break;
+	case 'w':
+	    width = atoi(optarg);
+	    break;
+	case 'f':
+	    files = atoi(optarg);
+	    break;
+	case 'L':
+	    links = atoi(optarg);
+	    break;
+	case 'S':
+	    symlinks = atoi(optarg);
+	    break;
+	case 'r':
+	    runs = atoi(optarg);
+	    break;
+	case 'k':
+	    keep = 1;
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [ -b vtree ] [ -d depth ] [ -w width ] "
+		    "[ -f files ] [ -L n ] [ -S n ] [ -r runs ] [ -k ] [ dir ]\n",
+		    argv[0]);
+	    exit(1);
+	}
+    if (optind < argc)
+	parent = argv[optind];
+    if (depth < 0 || width < 0 || files < 0 || links < 0 || symlinks < 0
+	|| runs < 1 || runs > 64) {
+	fprintf(stderr, "%s: bad shape or number of runs\n", argv[0]);
+	exit(1);
+    }
+    if (access(vtree, X_OK) < 0) {
+	perror(vtree);
+	exit(1);
+    }
+
+    snprintf(top, sizeof(top), "%s/vtree_bench.XXXXXX", parent);
+    if (mkdtemp(top) == NULL) {
+	perror(top);
+	exit(1);
+    }
+    snprintf(empty, sizeof(empty), "%s/empty", top);
+    snprintf(top + strlen(top), sizeof(top) - strlen(top), "/tree");
+    secs = now();
+    if (mkdir(empty, 0755) < 0 || mkdir(top, 0755) < 0
+	|| make_tree(top, 0) < 0)
+	exit(1);
+    entries++;
+    printf("%s: %ld entries (depth %d, width %d, %d files a directory), "
+	   "made in %.2fs\n", top, entries, depth, width, files, now() - secs);
+    can_drop = drop_caches() == 0;
+    if (!can_drop)
+	printf("can't drop the caches (not root?), warm runs only\n");
+
+    printf("\n%-8s %-5s %10s %12s %14s\n",
+	   "mode", "cache", "seconds", "entries/sec", "syscalls/entry");
+    for (m = modes; m->name; m++) {
+	base = syscalls(m->opt, empty);
+	calls = syscalls(m->opt, top);
+	for (cold = 0; cold <= can_drop; cold++) {
+	    if (!cold)
+		timed(m->opt, top);	/* warm up */
+	    for (r = 0; r < runs; r++) {
+		if (cold)
+		    drop_caches();
+		if ((t[r] = timed(m->opt, top)) < 0)
+		    break;
+	    }
+	    printf("%-8s %-5s ", m->name, cold ? "cold" : "warm");
+	    if (r < runs) {
+		printf("%10s\n", "failed");
+		continue;
+	    }
+	    qsort(t, runs, sizeof(double), by_time);
+	    secs = t[runs / 2];
+	    printf("%10.4f %12.0f ", secs, entries / secs);
+	    if (base < 0 || calls < 0)
+		printf("%14s\n", "n/a");
+	    else
+		printf("%14.2f\n", (double) (calls - base) / entries);
+	}
+    }
+
+    if (!keep) {
+	*strrchr(top, '/') = '\0';
+	if (nftw(top, remove_one, 16, FTW_DEPTH | FTW_PHYS) < 0)
+	    perror(top);
+    }
+    return 0;
+}
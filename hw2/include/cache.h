@@ -0,0 +1,60 @@
+/* Defines for the vtree scan cache.
+
+   The cache file remembers, for every directory a run has read, what
+   reading it produced: the space and inodes of its singly-linked files,
+   its hard-linked files (so they can still be deduplicated), and the
+   names of its subdirectories.  A directory whose device, inode, mtime
+   and ctime are unchanged is taken from the cache on the next run
+   instead of being read and having each of its files stat'ed.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define CACHE_MAGIC	"VTREE-CACHE-1\n"	/* first bytes of the file */
+#define CR_SUMS		0x1	/* sizes/inodes/links were collected */
+
+struct crec {			/* one directory, as written to the file */
+    dev_t           dev;
+    ino_t           ino;
+    struct timespec mtime;
+    struct timespec ctime;
+    long            sizes;	/* K's of the singly-linked files */
+    int             inodes;	/* count of the singly-linked files */
+    int             flags;	/* CR_xxx */
+    int             nlinks;	/* struct clink's that follow */
+    int             nchild;	/* subdirectory names that follow */
+    size_t          namelen;	/* bytes of names, NULs included */
+};
+
+struct clink {			/* a file with more than one link */
+    dev_t           dev;
+    ino_t           ino;
+    long            k;		/* its K's */
+};
+
+struct cbuild {			/* a record being put together */
+    struct crec     rec;
+    struct clink   *links;
+    int             maxlinks;
+    char           *names;
+    size_t          maxnames;
+    int             failed;	/* out of memory: not to be written */
+};
+
+#define CR_LINKS(r)	((struct clink *) ((r) + 1))
+#define CR_NAMES(r)	((char *) (CR_LINKS(r) + (r)->nlinks))
+
+int cache_open(char *path);
+int cache_close(void);
+struct crec *cache_find(struct stat *st, int need_sums);
+void cache_start(struct cbuild *cb, struct stat *st, int sums);
+void cache_file(struct cbuild *cb, struct stat *st, long k);
+void cache_child(struct cbuild *cb, char *name);
+void cache_finish(struct cbuild *cb);
+
+#endif /* CACHE_H */
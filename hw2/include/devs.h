@@ -0,0 +1,31 @@
+/* Defines for vtree's per-device totals (-D).
+
+   Devices are few, so they're kept in a small array searched from the
+   one used last; a walk seldom changes device.
+ */
+
+#ifndef DEVS_H
+#define DEVS_H
+
+#include <sys/types.h>
+
+struct devtot {
+    dev_t           dev;
+    long            k;		/* K's on it */
+    long            inodes;	/* files and directories on it */
+};
+
+struct devtab {
+    struct devtot  *devs;
+    int             count;
+    int             max;
+    int             last;	/* where the last dv_add found its device */
+};
+
+void dv_add(struct devtab *dt, dev_t dev, long k);
+void dv_sort(struct devtab *dt);
+char *dv_mount(dev_t dev);
+char *dv_name(dev_t dev);
+void dv_free(struct devtab *dt);
+
+#endif /* DEVS_H */
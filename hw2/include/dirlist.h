@@ -0,0 +1,64 @@
+/* Defines for the vtree bulk directory reader.
+
+   A directory is read in one go into a flat arena.  On Linux the arena
+   holds the raw getdents64(2) records and the names are used in place;
+   elsewhere the names are copied in from readdir(3).  Entries refer to
+   their names by offset, so the arena can be grown with realloc.
+ */
+
+#ifndef DIRLIST_H
+#define DIRLIST_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define DL_CHUNK	(64 * 1024)	/* min free arena space per read */
+#define DL_ENTS		256		/* initial entry slots */
+
+#define SORT_NAME	0	/* sort keys for dl_sort */
+#define SORT_SIZE	1
+#define SORT_MTIME	2
+#define SORT_INODE	3
+
+struct dl_entry {
+    size_t          name;	/* offset of the name in the arena */
+    ino_t           ino;	/* inode number from the directory */
+    int             type;	/* DT_xxx type, DT_UNKNOWN if none */
+    int             statted;	/* 1 if stat'ed ok, -1 if stat failed */
+    mode_t          mode;	/* the parts of the stat that vtree */
+    nlink_t         nlink;	/* uses, once statted; ino is then */
+    dev_t           dev;	/* st_ino */
+    blkcnt_t        blocks;
+    off_t           size;
+    struct timespec atim;
+    struct timespec mtim;
+    struct timespec ctim;
+};
+
+struct dirlist {
+    char           *arena;	/* directory records / names */
+    size_t          used;	/* arena space filled */
+    size_t          size;	/* arena space allocated */
+    struct dl_entry *ents;	/* the entries, in directory order */
+    int             count;	/* entries used */
+    int             max;	/* entries allocated */
+};
+
+#define DL_NAME(dl, n)	((dl)->arena + (dl)->ents[n].name)
+
+int dl_read(struct dirlist *dl, char *path);
+int dl_append(struct dirlist *dl, char *name, ino_t ino, int type);
+int dl_stat(struct dirlist *dl, int n, int follow);
+int dl_isdir(struct dirlist *dl, int n, int follow);
+int dl_uring(unsigned depth);
+unsigned dl_uringdepth(void);
+void dl_statall(struct dirlist *dl, int follow, int dirs_only);
+void dl_setstat(struct dirlist *dl, int n, struct stat *st);
+void dl_getstat(struct dirlist *dl, int n, struct stat *st);
+void dl_sort(struct dirlist *dl, int key);
+int dl_sortkey(char *s);
+char *dl_keyname(int key);
+void dl_free(struct dirlist *dl);
+
+#endif /* DIRLIST_H */
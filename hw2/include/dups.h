@@ -0,0 +1,60 @@
+/* Defines for vtree's duplicate finder (-C).
+
+   Every file the walk counts is noted with its size.  Afterwards only
+   the sizes that more than one inode has are looked at: those files
+   are hashed over their first block, and the ones still alike over
+   their whole contents.  The hashing is what takes the time, and the
+   files are independent of each other, so a pool of threads shares it.
+   Files of the same size and contents are copies; all but the first
+   one the walk found could be reclaimed.
+ */
+
+#ifndef DUPS_H
+#define DUPS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "tree.h"
+
+#define DP_FILES	4096	/* initial file slots */
+#define DP_NAMES	(64 * 1024)	/* initial name arena */
+#define DP_BLOCK	4096	/* bytes hashed in the first pass */
+#define DP_BUFSIZ	(1 << 20)	/* bytes read at once, a multiple of 16 */
+#define DP_THREADS	8	/* most hashing threads */
+
+struct dupfile {
+    off_t           size;	/* st_size */
+    dev_t           dev;
+    ino_t           ino;
+    long            k;		/* space it takes */
+    int             node;	/* the directory it's in */
+    int             seq;	/* order the walk found it in */
+    size_t          name;	/* offset of its name in the arena */
+    uint64_t        hash[2];	/* of the first block, later of it all */
+    int             bad;	/* couldn't be read, or changed */
+};
+
+struct duptab {
+    struct dupfile *files;
+    int             count;
+    int             max;
+    char           *names;	/* name arena */
+    size_t          used;
+    size_t          size;
+    long            k;		/* reclaimable K's, once dp_find has run */
+    int             copies;	/* files that could go */
+    int             groups;	/* sets of files alike */
+};
+
+struct dupdir {
+    int             node;
+    long            k;		/* reclaimable K's directly in it */
+    int             copies;
+};
+
+void dp_add(struct duptab *dt, int node, char *name, struct stat *st);
+int dp_find(struct duptab *dt, struct tree *t, struct dupdir **dirs);
+void dp_free(struct duptab *dt);
+
+#endif /* DUPS_H */
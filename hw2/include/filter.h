@@ -0,0 +1,27 @@
+/* Defines for vtree's filters (-e, -E, -I, -R, -m, -N).
+
+   Exclude patterns are matched against names only, so they are tried
+   before an entry is stat'ed, and an excluded directory is never
+   opened.  Include patterns and the size and age tests are for files,
+   and need the stat the file gets anyway.
+ */
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define FL_GLOB		0	/* pattern kinds for fl_add */
+#define FL_REGEX	1
+
+int fl_add(char *pattern, int kind, int include);
+int fl_minsize(char *arg);
+int fl_newer(char *arg);
+int fl_active(void);
+int fl_excluding(void);
+int fl_skip(char *name);
+int fl_count(char *name, struct stat *st);
+void fl_print(void);
+
+#endif /* FILTER_H */
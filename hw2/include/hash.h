@@ -3,19 +3,42 @@
    SCCS ID	@(#)hash.h	1.6	7/9/87
  */
 
-#define BUCKETS		257	/* buckets per hash table */
-#define TABLES		50	/* hash tables */
-#define EXTEND		100	/* how much space to add to a bucket */
-
-struct hbucket {
-    int             length;	/* key space allocated */
-    int             filled;	/* key space used */
-    ino_t          *keys;
+#include <pthread.h>
+
+#define HS_SLOTS	256	/* initial slots in a stripe, a power of 2 */
+#define HS_LOAD(size)	((size) / 2)	/* most keys before a stripe grows */
+#define HS_EMPTY	((dev_t) -1)	/* device of an unused slot */
+#define HS_STRIPES	64	/* independently locked parts of a set */
+#define HS_STRIPE(h)	((h) >> 58)	/* top 6 bits of the hash pick one */
+
+struct hslot {
+    dev_t           dev;	/* device, HS_EMPTY if the slot is free */
+    ino_t           ino;	/* inode on that device */
 };
 
-struct htable {
-    dev_t           device;	/* device this table is for */
-    struct hbucket  buckets[BUCKETS];	/* the buckets of the table */
+struct hstats {
+    size_t          size;	/* slots allocated */
+    size_t          filled;	/* slots used */
+    long            searches;	/* number of hs_enter's */
+    long            duplicates;	/* keys found already there */
+    long            probes;	/* total slots looked at */
+    long            longprobe;	/* longest probe sequence */
+    int             resizes;	/* times a stripe has grown */
+};
+
+ /*
+  * A set is split into stripes, each an open-addressed table with its
+  * own lock, so threads entering different keys rarely wait on each
+  * other.  Stripes are cache-line aligned to keep the locks apart.
+  */
+struct hstripe {
+    pthread_mutex_t lock;
+    struct hslot   *slots;	/* linear probing, size a power of 2 */
+    struct hstats   st;
+} __attribute__((aligned(64)));
+
+struct hset {
+    struct hstripe  stripes[HS_STRIPES];
 };
 
 #define OLD	0		/* inode was in hash already */
@@ -23,9 +46,17 @@ struct htable {
 
 //Mehdad Zaman Added
 #ifdef LINUX
+    void hs_init(struct hset *hs);
+    int hs_enter(struct hset *hs, dev_t dev, ino_t ino);
+    void hs_stats(struct hset *hs, struct hstats *st);
+    void hs_free(struct hset *hs);
     int h_enter(dev_t  dev, ino_t ino);
     void h_stats();
 #else
+    void hs_init();
+    int hs_enter();
+    void hs_stats();
+    void hs_free();
     int h_enter();
     void h_stats();
 #endif
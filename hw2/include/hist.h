@@ -0,0 +1,35 @@
+/* Defines for the vtree size and age histograms.
+
+   For -A, every file is put in a size bucket (on its length) and in
+   two age buckets (on its modification and access times), and each
+   bucket counts the files and the K's they take up.
+ */
+
+#ifndef HIST_H
+#define HIST_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define H_SIZES		10	/* 0, then up to 1K, 8K, ... 2G, then more */
+#define H_AGES		8	/* up to 7, 30, ... 730 days, then older */
+
+#define H_MTIME		0	/* the two kinds of age */
+#define H_ATIME		1
+
+struct hbucket {
+    long            files;
+    long            k;
+};
+
+struct hist {
+    struct hbucket  sizes[H_SIZES];
+    struct hbucket  ages[2][H_AGES];	/* [H_xTIME][bucket] */
+};
+
+void hist_add(struct hist *h, struct stat *st, long k, time_t now);
+char *hist_sizename(int b);
+char *hist_agename(int b);
+
+#endif /* HIST_H */
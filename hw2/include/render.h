@@ -0,0 +1,32 @@
+/* The vtree renderers.  Each produces one kind of output from the tree
+   the walk has built. */
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "tree.h"
+#include "topn.h"
+#include "hist.h"
+#include "devs.h"
+#include "dups.h"
+
+#define OUT_TEXT	0	/* output formats, for -F */
+#define OUT_JSON	1
+#define OUT_CSV		2
+
+#define OUT_BUFSIZ	(1 << 20)	/* stdout buffer for the streamed formats */
+
+void render_text(struct tree *t);
+int render_format(char *name);
+char *render_formatname(int fmt);
+void render_start(int fmt);
+void render_dir(struct tree *t, int n, int level);
+void render_end(struct tree *t);
+void render_tree(struct tree *t);
+void render_node(struct tree *t, int n);
+void render_top(struct tree *t, struct topn *dirs, struct topn *files);
+void render_hist(struct tree *t, int n, struct hist *h);
+void render_devs(struct devtab *dt);
+void render_dups(struct tree *t, struct duptab *dt, struct dupdir *dirs, int n);
+
+#endif /* RENDER_H */
@@ -0,0 +1,26 @@
+/* Defines for vtree's self-throttling.
+
+   With -r, every stat, directory open and directory read the walk makes
+   takes a token from a bucket that fills at the given rate, and the
+   walk sleeps when the bucket is empty.  The rate also backs off on its
+   own when those calls start taking much longer than they did, and
+   comes back up slowly once they're quick again.
+ */
+
+#ifndef THROTTLE_H
+#define THROTTLE_H
+
+#define TH_BURST(rate)	((rate) / 10 + 1)	/* bucket size: 100ms worth */
+#define TH_MINRATE	10.0	/* backoff never goes below this, ops/sec */
+#define TH_SLOW		4	/* latency this many times the best is slow */
+#define TH_MINLAT	1e-3	/* but anything under this (seconds) isn't */
+#define TH_ADJUST	0.1	/* seconds between rate adjustments */
+
+void th_init(double rate);
+void th_background(void);
+double th_begin(void);
+void th_end(double t0);
+void th_endn(double t0, int n);
+double th_rate(void);
+
+#endif /* THROTTLE_H */
@@ -0,0 +1,28 @@
+/* Defines for the vtree top-N lists.
+
+   A top-N list keeps the N largest entries offered to it in a min-heap,
+   so the smallest of them is always at hand to be pushed out.  An entry
+   is a directory of the tree, or a file named within one.
+ */
+
+#ifndef TOPN_H
+#define TOPN_H
+
+struct topent {
+    long            k;		/* what it's ranked on */
+    int             node;	/* the directory, or the file's directory */
+    char           *name;	/* the file's name, NULL for a directory */
+};
+
+struct topn {
+    struct topent  *ents;	/* the heap, smallest at ents[0] */
+    int             count;	/* entries used */
+    int             max;	/* N */
+};
+
+void top_init(struct topn *tp, int max);
+int top_add(struct topn *tp, long k, int node, char *name);
+void top_sort(struct topn *tp);
+void top_free(struct topn *tp);
+
+#endif /* TOPN_H */
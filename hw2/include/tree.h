@@ -0,0 +1,69 @@
+/* Defines for the vtree directory tree.
+
+   The walk records every directory it comes to as a node; the output
+   is produced afterwards from the tree.  Nodes live in one array and
+   refer to each other by index, and their names live in one arena, so
+   a node costs a few words and no malloc of its own.
+ */
+
+#ifndef TREE_H
+#define TREE_H
+
+#include <sys/types.h>
+
+#define NONE		(-1)	/* no such node */
+
+#define N_UNREAD	0x1	/* directory couldn't be opened */
+#define N_SEEN		0x2	/* -W: counted under another node already */
+#define N_GONE		0x4	/* -W: no longer in the tree */
+#define N_DIRTY		0x8	/* -W: changed, to be read again */
+#define N_MARK		0x10	/* -W: found again while rereading */
+
+struct node {
+    int             parent;	/* NONE for a command line argument */
+    int             child;	/* first subdirectory, NONE if none */
+    int             last;	/* last subdirectory, to append to */
+    int             next;	/* next subdirectory of the parent */
+    int             nchild;	/* number of subdirectories */
+    int             flags;	/* N_xxx */
+    size_t          name;	/* offset of the name in the arena */
+    long            own;	/* K's of the directory itself */
+    long            files;	/* K's of the files directly in it */
+    int             inodes;	/* number of those files */
+    long            total;	/* K's of it all, subdirectories too, */
+    long            tinodes;	/* and inodes, once t_done has run */
+    long            aown;	/* the same three by st_size, */
+    long            afiles;	/* for -S */
+    long            atotal;
+    dev_t           dev;	/* the directory's own device and inode, */
+    ino_t           ino;	/* to know it again by */
+};
+
+struct tree {
+    struct node    *nodes;
+    int             count;	/* nodes used */
+    int             max;	/* nodes allocated */
+    int             root;	/* first top level node */
+    int             lastroot;	/* and the last one */
+    char           *names;	/* name arena */
+    size_t          used;
+    size_t          size;
+};
+
+#define T_NODE(t, n)	(&(t)->nodes[n])
+#define T_NAME(t, n)	((t)->names + (t)->nodes[n].name)
+
+void t_init(struct tree *t);
+int t_add(struct tree *t, int parent, char *name);
+void t_done(struct tree *t, int n);
+int t_child(struct tree *t, int n, char *name);
+void t_unlink(struct tree *t, int n);
+int t_gone(struct tree *t, int n);
+int t_level(struct tree *t, int n);
+int t_loop(struct tree *t, int n, dev_t dev, ino_t ino);
+int t_path(struct tree *t, int n, char *buf, size_t size);
+int t_find(struct tree *t, char *path);
+void t_sort(struct tree *t, int n);
+void t_free(struct tree *t);
+
+#endif /* TREE_H */
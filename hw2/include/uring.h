@@ -0,0 +1,27 @@
+/* Defines for vtree's io_uring stat batching.
+
+   On Linux, when built with -DURING, the entries of a directory can be
+   stat'ed through an io_uring: a whole batch of IORING_OP_STATX
+   requests is handed to the kernel with one system call and reaped
+   together, so a file system with slow metadata has many requests in
+   flight instead of one.  Without a ring the walk just calls stat(2).
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define UR_DEPTH	64	/* default queue depth */
+#define UR_MAXDEPTH	4096	/* largest the kernel will take */
+
+struct uring;			/* private to uring.c */
+
+struct uring *ur_open(unsigned depth);
+int ur_statv(struct uring *u, char **names, int n, int nofollow,
+	     struct stat *sts, int *rcs);
+unsigned ur_depth(struct uring *u);
+void ur_close(struct uring *u);
+
+#endif /* URING_H */
@@ -0,0 +1,19 @@
+/* Globals shared by the vtree walk and the renderers. */
+
+#ifndef VTREE_H
+#define VTREE_H
+
+#define	TRUE	1
+#define	FALSE	0
+
+extern int      depth,		/* max depth */
+                sum,		/* sum the subdirectories */
+                floating,	/* floating column widths */
+                cnt_inodes,	/* count inodes */
+                quick,		/* quick display */
+                visual,		/* visual display */
+                apparent,	/* -S apparent sizes too */
+                by_total;	/* -k size: subdirectories by total */
+extern short    sw_summary;	/* print Grand Total line */
+
+#endif /* VTREE_H */
@@ -0,0 +1,36 @@
+/* Defines for vtree's watch mode (-W).
+
+   After the first scan every directory in the tree is watched through
+   inotify(7).  An event only says which directory changed, and that
+   directory alone is read again, its subdirectories being left as they
+   are unless they come or go.  Events are let pile up until they stop
+   for a moment, so a burst of writes costs one rereading.
+
+   Hard links are counted once by remembering which node each one is
+   counted under, so that rereading that node counts it there again.
+   The same table says whether a directory reached through a symbolic
+   link is in the tree already, so it stays one node, watched once.
+ */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <sys/types.h>
+#include "tree.h"
+
+#define WT_SETTLE	100	/* ms without events before they're applied */
+#define WT_MAXWAIT	1000	/* but no longer than this under a stream */
+#define WT_CLAIMS	1024	/* initial slots in the claim table */
+#define WT_EVBUF	(64 * 1024)	/* bytes of events read at once */
+
+int wt_open(void);
+int wt_fd(void);
+int wt_add(char *path, int node);
+int wt_read(struct tree *t);
+int wt_next(struct tree *t);
+void wt_rescan(void);
+int wt_claim(struct tree *t, int node, dev_t dev, ino_t ino);
+int wt_owner(struct tree *t, dev_t dev, ino_t ino);
+void wt_close(void);
+
+#endif /* WATCH_H */
@@ -0,0 +1,346 @@
+/* cache.c
+
+ * Persistent scan cache for vtree.  The previous run's cache file is
+ * read into memory in one piece and indexed by (device, inode); the
+ * records of this run go to a new file which replaces the old one
+ * when the run is over.  Only the directories a run reads (or takes
+ * from the cache) are written, so the file never holds directories
+ * that have since disappeared.
+ *
+ * A directory's mtime and ctime change whenever an entry is added,
+ * removed or renamed, but not when a file in it merely grows, so a
+ * cached directory's totals are only as fresh as its entry list.
+ * The records are in the machine's own byte order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cache.h"
+
+#define ALIGN(n)	(((n) + 7) & ~(size_t) 7)
+
+struct cidx {			/* where a directory's record is */
+    dev_t           dev;
+    ino_t           ino;
+    struct crec    *rec;
+};
+
+static char    *old;		/* the previous run's file */
+static size_t   oldlen;
+static struct cidx *cindex;	/* its records, sorted by device/inode */
+static int      nindex;
+
+static FILE    *out;		/* where this run's records go */
+static char    *outpath, *tmppath;
+
+static int by_key(const void *a, const void *b);
+static int load(char *path);
+static int names_ok(char *names, size_t namelen, int nchild);
+static void put(struct crec *rec, struct clink *links, char *names);
+
+
+static int
+by_key(a, b)
+    const void     *a, *b;
+{
+    const struct cidx *x = a, *y = b;
+
+    if (x->dev != y->dev)
+	return x->dev < y->dev ? -1 : 1;
+    if (x->ino != y->ino)
+	return x->ino < y->ino ? -1 : 1;
+    return 0;
+}
+
+
+ /*
+  * Read the old cache file and index it.  A missing file is just an
+  * empty cache; a damaged one is reported and ignored.
+  */
+static int
+load(path)
+    char           *path;
+{
+    FILE           *fp;
+    struct stat     st;
+    struct crec    *rec;
+    size_t          off, len;
+
+    if ((fp = fopen(path, "r")) == NULL)
+	return 0;
+    if (fstat(fileno(fp), &st) < 0 || st.st_size < (off_t) strlen(CACHE_MAGIC)
+	|| (old = malloc(st.st_size)) == NULL
+	|| fread(old, 1, st.st_size, fp) != (size_t) st.st_size) {
+	fclose(fp);
+	free(old);
+	old = NULL;
+	fprintf(stderr, "can't read cache %s, ignoring it\n", path);
+	return 0;
+    }
+    fclose(fp);
+    oldlen = st.st_size;
+
+    if (memcmp(old, CACHE_MAGIC, strlen(CACHE_MAGIC)) != 0)
+	goto bad;
+
+    /* Count the records, checking that they fit, then index them. */
+    for (off = ALIGN(strlen(CACHE_MAGIC)); off < oldlen; off += len) {
+	if (oldlen - off < sizeof(struct crec))
+	    goto bad;
+	rec = (struct crec *) (old + off);
+	if (rec->nlinks < 0 || rec->nchild < 0
+	    || (size_t) rec->nlinks > oldlen / sizeof(struct clink)
+	    || rec->namelen > oldlen)
+	    goto bad;		/* (so the sum below can't overflow) */
+	len = ALIGN(sizeof(struct crec) + rec->nlinks * sizeof(struct clink)
+		    + rec->namelen);
+	if (len > oldlen - off || !names_ok(CR_NAMES(rec), rec->namelen, rec->nchild))
+	    goto bad;
+	nindex++;
+    }
+    if ((cindex = malloc((nindex ? nindex : 1) * sizeof(*cindex))) == NULL)
+	goto bad;
+    nindex = 0;
+    for (off = ALIGN(strlen(CACHE_MAGIC)); off < oldlen; off += len) {
+	rec = (struct crec *) (old + off);
+	len = ALIGN(sizeof(struct crec) + rec->nlinks * sizeof(struct clink)
+		    + rec->namelen);
+	cindex[nindex].dev = rec->dev;
+	cindex[nindex].ino = rec->ino;
+	cindex[nindex].rec = rec;
+	nindex++;
+    }
+    qsort(cindex, nindex, sizeof(*cindex), by_key);
+    return 0;
+
+bad:
+    fprintf(stderr, "cache %s is damaged, ignoring it\n", path);
+    free(old);
+    free(cindex);
+    old = NULL;
+    cindex = NULL;
+    nindex = 0;
+    return 0;
+}
+
+
+ /*
+  * Do the namelen bytes at names hold just nchild names, each ended by
+  * a NUL?  They're gone down into, so none may be empty, ".", ".." or
+  * hold a '/'.
+  */
+static int
+names_ok(names, namelen, nchild)
+    char           *names;
+    size_t          namelen;
+    int             nchild;
+{
+    char           *end = names + namelen, *p;
+
+    for (; nchild > 0; nchild--, names = p + 1) {
+	if ((p = memchr(names, '\0', end - names)) == NULL || p == names
+	    || memchr(names, '/', p - names) != NULL
+	    || strcmp(names, ".") == 0 || strcmp(names, "..") == 0)
+	    return 0;
+    }
+    return names == end;
+}
+
+
+ /*
+  * Load the cache in 'path' and start the new one beside it.  Returns
+  * -1 if the new one can't be created.
+  */
+int
+cache_open(path)
+    char           *path;
+{
+    load(path);
+
+    outpath = path;
+    if ((tmppath = malloc(strlen(path) + 5)) == NULL)
+	return -1;
+    sprintf(tmppath, "%s.tmp", path);
+    if ((out = fopen(tmppath, "w")) == NULL) {
+	perror(tmppath);
+	return -1;
+    }
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+    fwrite(CACHE_MAGIC, 1, strlen(CACHE_MAGIC), out);
+    fwrite("\0\0\0\0\0\0\0", 1, ALIGN(strlen(CACHE_MAGIC)) - strlen(CACHE_MAGIC),
+	   out);
+    return 0;
+}
+
+
+ /* Put the new cache in place of the old one. */
+int
+cache_close()
+{
+    int             rc = 0;
+
+    if (out && (fclose(out) != 0 || rename(tmppath, outpath) < 0)) {
+	perror(outpath);
+	unlink(tmppath);
+	rc = -1;
+    }
+    out = NULL;
+    free(tmppath);
+    free(cindex);
+    free(old);
+    old = NULL;
+    cindex = NULL;
+    nindex = 0;
+    return rc;
+}
+
+
+ /*
+  * Find the record for the directory whose stat is 'st'.  It's only
+  * good if the directory hasn't changed since, and, when 'need_sums'
+  * is set, if the sizes were collected when it was made.
+  */
+struct crec    *
+cache_find(st, need_sums)
+    struct stat    *st;
+    int             need_sums;
+{
+    struct cidx     key, *found;
+    struct crec    *rec;
+
+    if (!nindex)
+	return NULL;
+    key.dev = st->st_dev;
+    key.ino = st->st_ino;
+    if ((found = bsearch(&key, cindex, nindex, sizeof(*cindex), by_key)) == NULL)
+	return NULL;
+    rec = found->rec;
+    if (rec->mtime.tv_sec != st->st_mtim.tv_sec
+	|| rec->mtime.tv_nsec != st->st_mtim.tv_nsec
+	|| rec->ctime.tv_sec != st->st_ctim.tv_sec
+	|| rec->ctime.tv_nsec != st->st_ctim.tv_nsec)
+	return NULL;
+    if (need_sums && !(rec->flags & CR_SUMS))
+	return NULL;
+
+    /* Still good: it goes into the new cache as it is. */
+    put(rec, CR_LINKS(rec), CR_NAMES(rec));
+    return rec;
+}
+
+
+ /* Begin the record of the directory whose stat is 'st'. */
+void
+cache_start(cb, st, sums)
+    struct cbuild  *cb;
+    struct stat    *st;
+    int             sums;
+{
+    memset((char *) cb, '\0', sizeof(*cb));
+    cb->rec.dev = st->st_dev;
+    cb->rec.ino = st->st_ino;
+    cb->rec.mtime = st->st_mtim;
+    cb->rec.ctime = st->st_ctim;
+    cb->rec.flags = sums ? CR_SUMS : 0;
+}
+
+
+ /*
+  * Note a file in the directory.  Files with other links are kept
+  * one by one, so that a later run can still count them only once.
+  */
+void
+cache_file(cb, st, k)
+    struct cbuild  *cb;
+    struct stat    *st;
+    long            k;
+{
+    struct clink   *links;
+
+    if (st->st_nlink < 2) {
+	cb->rec.sizes += k;
+	cb->rec.inodes++;
+	return;
+    }
+    if (cb->rec.nlinks == cb->maxlinks) {
+	links = realloc(cb->links, (cb->maxlinks ? cb->maxlinks * 2 : 16)
+			* sizeof(struct clink));
+	if (links == NULL) {
+	    cb->rec.flags &= ~CR_SUMS;	/* record is useless now */
+	    return;
+	}
+	cb->links = links;
+	cb->maxlinks = cb->maxlinks ? cb->maxlinks * 2 : 16;
+    }
+    cb->links[cb->rec.nlinks].dev = st->st_dev;
+    cb->links[cb->rec.nlinks].ino = st->st_ino;
+    cb->links[cb->rec.nlinks].k = k;
+    cb->rec.nlinks++;
+}
+
+
+ /* Note a subdirectory of the directory. */
+void
+cache_child(cb, name)
+    struct cbuild  *cb;
+    char           *name;
+{
+    size_t          len = strlen(name) + 1, max;
+    char           *names;
+
+    if (cb->rec.namelen + len > cb->maxnames) {
+	for (max = cb->maxnames ? cb->maxnames : 256;
+	     cb->rec.namelen + len > max;)
+	    max *= 2;
+	if ((names = realloc(cb->names, max)) == NULL) {
+	    cb->failed = 1;	/* a record without it would be wrong */
+	    return;
+	}
+	cb->names = names;
+	cb->maxnames = max;
+    }
+    memcpy(cb->names + cb->rec.namelen, name, len);
+    cb->rec.namelen += len;
+    cb->rec.nchild++;
+}
+
+
+ /*
+  * The directory is done: write its record out, unless part of it
+  * couldn't be kept, when it's read again next time instead.
+  */
+void
+cache_finish(cb)
+    struct cbuild  *cb;
+{
+    if (!cb->failed)
+	put(&cb->rec, cb->links, cb->names);
+    free(cb->links);
+    free(cb->names);
+    cb->links = NULL;
+    cb->names = NULL;
+}
+
+
+static void
+put(rec, links, names)
+    struct crec    *rec;
+    struct clink   *links;
+    char           *names;
+{
+    static char     pad[8];
+    size_t          len;
+
+    if (!out)
+	return;
+    len = sizeof(struct crec) + rec->nlinks * sizeof(struct clink)
+	+ rec->namelen;
+    fwrite(rec, sizeof(struct crec), 1, out);
+    fwrite(links, sizeof(struct clink), rec->nlinks, out);
+    fwrite(names, 1, rec->namelen, out);
+    fwrite(pad, 1, ALIGN(len) - len, out);
+}
@@ -0,0 +1,131 @@
+/* devs.c
+
+ * Per-device totals for vtree's -D breakdown, and the mount points
+ * to name the devices by.  On Linux the mount points come from
+ * /proc/self/mountinfo, whose third field is the device as major:minor;
+ * elsewhere the device numbers have to do.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include "devs.h"
+
+#ifdef LINUX
+#include <sys/sysmacros.h>
+#endif
+
+static int by_size(const void *a, const void *b);
+
+
+ /* Add an entry of k K's on device dev. */
+void
+dv_add(dt, dev, k)
+    struct devtab  *dt;
+    dev_t           dev;
+    long            k;
+{
+    struct devtot  *devs;
+    int             i;
+
+    if (dt->count && dt->devs[dt->last].dev == dev)
+	i = dt->last;
+    else {
+	for (i = 0; i < dt->count && dt->devs[i].dev != dev; i++);
+	if (i == dt->count) {
+	    if (dt->count == dt->max) {
+		devs = realloc(dt->devs, (dt->max ? dt->max * 2 : 8)
+			       * sizeof(struct devtot));
+		if (devs == NULL)
+		    return;
+		dt->devs = devs;
+		dt->max = dt->max ? dt->max * 2 : 8;
+	    }
+	    dt->devs[i].dev = dev;
+	    dt->devs[i].k = dt->devs[i].inodes = 0;
+	    dt->count++;
+	}
+	dt->last = i;
+    }
+    dt->devs[i].k += k;
+    dt->devs[i].inodes++;
+}
+
+
+static int
+by_size(a, b)
+    const void     *a, *b;
+{
+    const struct devtot *x = a, *y = b;
+
+    if (x->k != y->k)
+	return x->k < y->k ? 1 : -1;
+    return x->dev < y->dev ? -1 : x->dev > y->dev;
+}
+
+
+ /* Largest first, for printing. */
+void
+dv_sort(dt)
+    struct devtab  *dt;
+{
+    qsort(dt->devs, dt->count, sizeof(struct devtot), by_size);
+    dt->last = 0;
+}
+
+
+ /*
+  * Where device dev is mounted, or NULL if that can't be found out.
+  * The answer is good until the next call.
+  */
+char           *
+dv_mount(dev)
+    dev_t           dev;
+{
+#ifdef LINUX
+    static char     line[4096], mount[4096];
+    FILE           *fp;
+    unsigned        maj, min;
+    char           *found = NULL;
+
+    if ((fp = fopen("/proc/self/mountinfo", "r")) == NULL)
+	return NULL;
+    while (fgets(line, sizeof(line), fp) != NULL)
+	if (sscanf(line, "%*d %*d %u:%u %*s %4095s", &maj, &min, mount) == 3
+	    && makedev(maj, min) == dev) {
+	    found = mount;
+	    break;
+	}
+    fclose(fp);
+    return found;
+#else
+    return NULL;
+#endif
+}
+
+
+ /* The device as major:minor, good until the next call. */
+char           *
+dv_name(dev)
+    dev_t           dev;
+{
+    static char     name[32];
+
+#ifdef LINUX
+    sprintf(name, "%u:%u", major(dev), minor(dev));
+#else
+    sprintf(name, "%lu", (unsigned long) dev);
+#endif
+    return name;
+}
+
+
+ /* Give back the table's memory. */
+void
+dv_free(dt)
+    struct devtab  *dt;
+{
+    free(dt->devs);
+    memset((char *) dt, '\0', sizeof(*dt));
+}
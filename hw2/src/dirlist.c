@@ -0,0 +1,514 @@
+/* dirlist.c
+
+ * Bulk directory reader for vtree.  A whole directory is read into
+ * one arena instead of one malloc'ed list node per entry.  On Linux
+ * the arena is filled straight from getdents64(2), a large buffer at
+ * a time, and the records are parsed where they land: each entry just
+ * remembers where its name starts.  Other systems fall back to
+ * readdir(3) and copy the names into the arena.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "dirlist.h"
+#include "uring.h"
+#include "throttle.h"
+
+#ifdef LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+
+struct linux_dirent64 {			/* what getdents64 hands back */
+    ino_t           d_ino;
+    off_t           d_off;
+    unsigned short  d_reclen;
+    unsigned char   d_type;
+    char            d_name[];
+};
+#else
+#include "customize.h"
+#ifndef DT_UNKNOWN
+#define DT_UNKNOWN	0
+#endif
+#endif
+
+static int dl_room(struct dirlist *dl, size_t need);
+static int dl_add(struct dirlist *dl, size_t name, ino_t ino, int type);
+static int not_dir(struct dl_entry *ent, int follow);
+static int by_name(const void *a, const void *b);
+static int by_size(const void *a, const void *b);
+static int by_mtime(const void *a, const void *b);
+static int by_inode(const void *a, const void *b);
+
+static struct uring *ring;		/* for dl_statall, if there is one */
+static struct dirlist *sort_dl;		/* list being sorted, for the
+					 * comparison routines */
+static char    *sort_keys[] = {"name", "size", "mtime", "inode", NULL};
+
+
+ /*
+  * Make sure there are at least 'need' free bytes at the end of the
+  * arena.  The arena at least doubles each time, so a directory of n
+  * bytes of records costs O(log n) reallocs.
+  */
+static int
+dl_room(dl, need)
+    struct dirlist *dl;
+    size_t          need;
+{
+    size_t          size;
+    char           *arena;
+
+    if (dl->size - dl->used >= need)
+	return 0;
+    size = dl->size ? dl->size * 2 : need;
+    while (size - dl->used < need)
+	size *= 2;
+    if ((arena = realloc(dl->arena, size)) == NULL) {
+	perror("can't grow directory arena");
+	return -1;
+    }
+    dl->arena = arena;
+    dl->size = size;
+    return 0;
+}
+
+
+ /* Append an entry whose name lives at offset 'name' in the arena. */
+static int
+dl_add(dl, name, ino, type)
+    struct dirlist *dl;
+    size_t          name;
+    ino_t           ino;
+    int             type;
+{
+    struct dl_entry *ents;
+
+    if (dl->count == dl->max) {
+	ents = realloc(dl->ents,
+		       (dl->max ? dl->max * 2 : DL_ENTS) * sizeof(*ents));
+	if (ents == NULL) {
+	    perror("can't grow directory list");
+	    return -1;
+	}
+	dl->ents = ents;
+	dl->max = dl->max ? dl->max * 2 : DL_ENTS;
+    }
+    dl->ents[dl->count].name = name;
+    dl->ents[dl->count].ino = ino;
+    dl->ents[dl->count].type = type;
+    dl->ents[dl->count].statted = 0;
+    dl->count++;
+    return 0;
+}
+
+
+ /*
+  * Read the directory 'path' into dl, which should be zeroed (or
+  * dl_free'd) beforehand.  Entries come back in directory order, the
+  * same order readdir(3) would give.  Returns -1 if the directory
+  * can't be opened.
+  */
+int
+dl_read(dl, path)
+    struct dirlist *dl;
+    char           *path;
+{
+#ifdef LINUX
+    struct linux_dirent64 *d;
+    size_t          pos;
+    long            n;
+    int             fd;
+    double          t0;
+
+    t0 = th_begin();
+    fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    th_end(t0);
+    if (fd < 0)
+	return -1;
+
+    for (;;) {
+	if (dl_room(dl, DL_CHUNK) < 0)
+	    break;
+	t0 = th_begin();
+	n = syscall(SYS_getdents64, fd, dl->arena + dl->used,
+		    dl->size - dl->used);
+	th_end(t0);
+	if (n <= 0)
+	    break;
+
+	/* Parse the new records in place. */
+	for (pos = dl->used; pos < dl->used + n; pos += d->d_reclen) {
+	    d = (struct linux_dirent64 *) (dl->arena + pos);
+	    if (dl_add(dl, pos + offsetof(struct linux_dirent64, d_name),
+		       d->d_ino, d->d_type) < 0)
+		break;
+	}
+	dl->used += n;
+    }
+
+    close(fd);
+    return 0;
+#else
+    OPEN           *dp;
+    READ           *file;
+
+    if ((dp = opendir(path)) == NULL)
+	return -1;
+
+    while ((file = readdir(dp)) != NULL)
+	if (dl_append(dl, NAME(*file), (ino_t) 0, DT_UNKNOWN) < 0)
+	    break;
+
+    closedir(dp);
+    return 0;
+#endif
+}
+
+
+ /* Add an entry by hand, copying its name into the arena. */
+int
+dl_append(dl, name, ino, type)
+    struct dirlist *dl;
+    char           *name;
+    ino_t           ino;
+    int             type;
+{
+    size_t          len = strlen(name) + 1;
+
+    if (dl_room(dl, len) < 0)
+	return -1;
+    memcpy(dl->arena + dl->used, name, len);
+    if (dl_add(dl, dl->used, ino, type) < 0)
+	return -1;
+    dl->used += len;
+    return 0;
+}
+
+
+ /*
+  * Fill in the stat information of entry n, relative to the current
+  * directory.  'follow' says whether symbolic links are followed.
+  * Each entry is stat'ed at most once; later calls just say how it
+  * went.  Returns -1 if the entry can't be stat'ed.
+  */
+int
+dl_stat(dl, n, follow)
+    struct dirlist *dl;
+    int             n;
+    int             follow;
+{
+    struct stat     st;
+    int             rc;
+    double          t0;
+
+    if (dl->ents[n].statted)
+	return dl->ents[n].statted > 0 ? 0 : -1;
+
+    t0 = th_begin();
+#ifdef LSTAT
+    if (follow)
+	rc = stat(DL_NAME(dl, n), &st);
+    else
+	rc = lstat(DL_NAME(dl, n), &st);
+#else
+    rc = stat(DL_NAME(dl, n), &st);
+#endif
+    th_end(t0);
+    if (rc < 0) {
+	memset((char *) &st, '\0', sizeof(st));
+	dl_setstat(dl, n, &st);
+	dl->ents[n].statted = -1;
+	return -1;
+    }
+    dl_setstat(dl, n, &st);
+    return 0;
+}
+
+
+ /*
+  * Stat the entries through an io_uring from now on, 'depth' at a time.
+  * Returns -1 if there's no io_uring to be had; dl_statall then does
+  * nothing and the entries are stat'ed one by one as before.
+  */
+int
+dl_uring(depth)
+    unsigned        depth;
+{
+    if ((ring = ur_open(depth)) == NULL)
+	return -1;
+    return 0;
+}
+
+
+ /* The ring's queue depth, 0 if there's no ring. */
+unsigned
+dl_uringdepth()
+{
+    return ring ? ur_depth(ring) : 0;
+}
+
+
+ /*
+  * Stat, in batches through the ring, every entry that dl_stat or
+  * (with 'dirs_only') dl_isdir would have to stat later.  Those calls
+  * then find the work done.  Without a ring this leaves everything to
+  * them, and a ring that fails is closed, so from then on it's left to
+  * them for the rest of the run.
+  */
+void
+dl_statall(dl, follow, dirs_only)
+    struct dirlist *dl;
+    int             follow;
+    int             dirs_only;
+{
+    struct dl_entry *ent;
+    struct stat    *sts;
+    char          **names;
+    int            *which, *rcs;
+    int             n, i, count, batch, nofollow = 0;
+    double          t0;
+
+    if (ring == NULL || dl->count == 0)
+	return;
+#ifdef LSTAT
+    nofollow = !follow;
+#endif
+
+    names = malloc(dl->count * sizeof(*names));
+    which = malloc(dl->count * sizeof(*which));
+    rcs = malloc(dl->count * sizeof(*rcs));
+    sts = malloc(dl->count * sizeof(*sts));
+    if (names && which && rcs && sts) {
+	for (n = count = 0; n < dl->count; n++) {
+	    ent = &dl->ents[n];
+	    if (ent->statted)
+		continue;
+	    if (dirs_only && not_dir(ent, follow))
+		continue;
+	    names[count] = DL_NAME(dl, n);
+	    which[count++] = n;
+	}
+	/*
+	 * A batch takes as many throttle tokens as it has requests, and
+	 * its time counts as that many requests' worth.  The last token
+	 * is taken just before the batch goes in.
+	 */
+	for (n = 0; n < count; n += batch) {
+	    batch = count - n < (int) ur_depth(ring) ? count - n : ur_depth(ring);
+	    for (i = 1; i < batch; i++)
+		(void) th_begin();
+	    t0 = th_begin();
+	    if (ur_statv(ring, names + n, batch, nofollow, sts + n, rcs + n) < 0) {
+		ur_close(ring);
+		ring = NULL;
+		break;
+	    }
+	    th_endn(t0, batch);
+	}
+	/* Keep the batches that got done, even if the ring failed later. */
+	for (count = n, n = 0; n < count; n++) {
+	    if (rcs[n] < 0) {
+		memset((char *) &sts[n], '\0', sizeof(sts[n]));
+		dl_setstat(dl, which[n], &sts[n]);
+		dl->ents[which[n]].statted = -1;
+	    } else
+		dl_setstat(dl, which[n], &sts[n]);
+	}
+    }
+    free(names);
+    free(which);
+    free(rcs);
+    free(sts);
+}
+
+
+ /*
+  * Does the type getdents64 gave us say this can't be a directory?
+  * It does for most entries; symbolic links (when followed) and file
+  * systems that don't fill in the type need a stat to tell.
+  */
+static int
+not_dir(ent, follow)
+    struct dl_entry *ent;
+    int             follow;
+{
+#ifdef LINUX
+    return ent->type != DT_UNKNOWN && ent->type != DT_DIR
+	&& (ent->type != DT_LNK || !follow);
+#else
+    return 0;
+#endif
+}
+
+
+ /* Is entry n a directory? */
+int
+dl_isdir(dl, n, follow)
+    struct dirlist *dl;
+    int             n;
+    int             follow;
+{
+    struct dl_entry *ent = &dl->ents[n];
+
+    if (!ent->statted && not_dir(ent, follow))
+	return 0;
+    if (dl_stat(dl, n, follow) < 0)
+	return 0;
+    return S_ISDIR(ent->mode);
+}
+
+
+ /* Record stat information already in hand for entry n. */
+void
+dl_setstat(dl, n, st)
+    struct dirlist *dl;
+    int             n;
+    struct stat    *st;
+{
+    struct dl_entry *ent = &dl->ents[n];
+
+    ent->statted = 1;
+    ent->mode = st->st_mode;
+    ent->nlink = st->st_nlink;
+    ent->dev = st->st_dev;
+    ent->ino = st->st_ino;
+    ent->blocks = st->st_blocks;
+    ent->size = st->st_size;
+    ent->atim = st->st_atim;
+    ent->mtim = st->st_mtim;
+    ent->ctim = st->st_ctim;
+}
+
+
+ /*
+  * And hand it back as a struct stat, for code that wants one.  Only
+  * the fields kept above are filled in.
+  */
+void
+dl_getstat(dl, n, st)
+    struct dirlist *dl;
+    int             n;
+    struct stat    *st;
+{
+    struct dl_entry *ent = &dl->ents[n];
+
+    memset((char *) st, '\0', sizeof(*st));
+    st->st_mode = ent->mode;
+    st->st_nlink = ent->nlink;
+    st->st_dev = ent->dev;
+    st->st_ino = ent->ino;
+    st->st_blocks = ent->blocks;
+    st->st_size = ent->size;
+    st->st_atim = ent->atim;
+    st->st_mtim = ent->mtim;
+    st->st_ctim = ent->ctim;
+}
+
+
+ /*
+  * Comparison routines for dl_sort.  Names sort ascending and break
+  * all ties; sizes and times sort largest/newest first so the heavy
+  * and busy entries come up front.
+  */
+static int
+by_name(a, b)
+    const void     *a, *b;
+{
+    return strcmp(sort_dl->arena + ((struct dl_entry *) a)->name,
+		  sort_dl->arena + ((struct dl_entry *) b)->name);
+}
+
+static int
+by_size(a, b)
+    const void     *a, *b;
+{
+    blkcnt_t        x = ((struct dl_entry *) a)->blocks,
+                    y = ((struct dl_entry *) b)->blocks;
+
+    return x != y ? (x < y ? 1 : -1) : by_name(a, b);
+}
+
+static int
+by_mtime(a, b)
+    const void     *a, *b;
+{
+    struct timespec x = ((struct dl_entry *) a)->mtim,
+                    y = ((struct dl_entry *) b)->mtim;
+
+    if (x.tv_sec != y.tv_sec)
+	return x.tv_sec < y.tv_sec ? 1 : -1;
+    if (x.tv_nsec != y.tv_nsec)
+	return x.tv_nsec < y.tv_nsec ? 1 : -1;
+    return by_name(a, b);
+}
+
+static int
+by_inode(a, b)
+    const void     *a, *b;
+{
+    ino_t           x = ((struct dl_entry *) a)->ino,
+                    y = ((struct dl_entry *) b)->ino;
+
+    return x != y ? (x < y ? -1 : 1) : by_name(a, b);
+}
+
+
+ /*
+  * Sort the entries on 'key'.  The entries are small records, so
+  * qsort only moves offsets and a little metadata around, never the
+  * names.  The size and mtime keys need the entries stat'ed first.
+  */
+void
+dl_sort(dl, key)
+    struct dirlist *dl;
+    int             key;
+{
+    static int      (*cmp[]) (const void *, const void *) = {by_name, by_size, by_mtime, by_inode};
+
+    if (dl->count < 2)
+	return;
+    sort_dl = dl;
+    qsort(dl->ents, dl->count, sizeof(struct dl_entry), cmp[key]);
+    sort_dl = NULL;
+}
+
+
+ /* Map a sort key name to its SORT_xxx value, -1 if unknown. */
+int
+dl_sortkey(s)
+    char           *s;
+{
+    int             i;
+
+    for (i = 0; sort_keys[i]; i++)
+	if (strcmp(s, sort_keys[i]) == 0)
+	    return i;
+    return -1;
+}
+
+
+ /* And back again, for the options printout. */
+char           *
+dl_keyname(key)
+    int             key;
+{
+    return sort_keys[key];
+}
+
+
+ /* Release the arena and entries, leaving dl ready for dl_read. */
+void
+dl_free(dl)
+    struct dirlist *dl;
+{
+    free(dl->arena);
+    free(dl->ents);
+    memset((char *) dl, '\0', sizeof(*dl));
+}
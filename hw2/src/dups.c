@@ -0,0 +1,440 @@
+/* dups.c
+
+ * The duplicate finder behind vtree's -C.  The walk hands every file
+ * it counts to dp_add, which only notes it: size, inode, the directory
+ * and the name.  dp_find then narrows the files down in passes, each
+ * dearer than the last and each on fewer files.  Sorted by size, a
+ * size only one inode has can have no copy, and neither can a second
+ * name for an inode already there.  What's left is hashed over its
+ * first DP_BLOCK bytes, which tells most files of a size apart; the
+ * files whose first blocks agree are hashed over the whole of their
+ * contents.  Files of the same size and hash are copies of each other.
+ *
+ * The hash is MurmurHash3's 128 bit one, fed in large reads, so that
+ * no file needs reading into memory whole, or mapping, which a file
+ * shrinking meanwhile would turn into a SIGBUS.  The files of a pass
+ * are shared out among a few threads, each taking the next one from a
+ * common counter, so one large file holds up only its own thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "dups.h"
+
+#define ROTL(x, r)	(((x) << (r)) | ((x) >> (64 - (r))))
+#define C1		0x87c37b91114253d5ULL
+#define C2		0x4cf5ad432745937fULL
+
+struct mm {
+    uint64_t        h1, h2;
+    uint64_t        len;	/* bytes hashed so far */
+};
+
+struct pass {
+    struct duptab  *dt;
+    struct tree    *t;
+    int             first;	/* hashing the first blocks only */
+    int             next;	/* the next file to take */
+};
+
+static uint64_t fmix(uint64_t k);
+static void mm_body(struct mm *m, const unsigned char *p, size_t len);
+static void mm_end(struct mm *m, const unsigned char *p, size_t len,
+    uint64_t out[2]);
+static int hash_file(char *path, off_t upto, uint64_t out[2], char *buf);
+static void *worker(void *arg);
+static void hash_all(struct duptab *dt, struct tree *t, int first);
+static int by_inode(const void *a, const void *b);
+static int by_hash(const void *a, const void *b);
+static int by_k(const void *a, const void *b);
+static int keep_alike(struct duptab *dt);
+
+
+ /* Note a file the walk counted, in directory node. */
+void
+dp_add(dt, node, name, st)
+    struct duptab  *dt;
+    int             node;
+    char           *name;
+    struct stat    *st;
+{
+    struct dupfile *f;
+    size_t          len = strlen(name) + 1, size;
+    char           *names;
+
+    if (st->st_size == 0)
+	return;			/* nothing to reclaim */
+    if (dt->count == dt->max) {
+	f = realloc(dt->files, (dt->max ? dt->max * 2 : DP_FILES)
+		    * sizeof(struct dupfile));
+	if (f == NULL)
+	    return;
+	dt->files = f;
+	dt->max = dt->max ? dt->max * 2 : DP_FILES;
+    }
+    if (dt->used + len > dt->size) {
+	for (size = dt->size ? dt->size * 2 : DP_NAMES; dt->used + len > size;)
+	    size *= 2;
+	if ((names = realloc(dt->names, size)) == NULL)
+	    return;
+	dt->names = names;
+	dt->size = size;
+    }
+
+    f = &dt->files[dt->count];
+    memset((char *) f, '\0', sizeof(*f));
+    f->size = st->st_size;
+    f->dev = st->st_dev;
+    f->ino = st->st_ino;
+    f->k = (st->st_blocks * 512 + 1023) / 1024;
+    f->node = node;
+    f->seq = dt->count++;
+    f->name = dt->used;
+    memcpy(dt->names + dt->used, name, len);
+    dt->used += len;
+}
+
+
+static uint64_t
+fmix(k)
+    uint64_t        k;
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+
+ /* Hash len bytes at p, len a multiple of 16. */
+static void
+mm_body(m, p, len)
+    struct mm      *m;
+    const unsigned char *p;
+    size_t          len;
+{
+    uint64_t        k1, k2, h1 = m->h1, h2 = m->h2;
+
+    m->len += len;
+    for (; len >= 16; p += 16, len -= 16) {
+	memcpy(&k1, p, 8);
+	memcpy(&k2, p + 8, 8);
+	k1 *= C1;
+	k1 = ROTL(k1, 31);
+	k1 *= C2;
+	h1 ^= k1;
+	h1 = ROTL(h1, 27);
+	h1 += h2;
+	h1 = h1 * 5 + 0x52dce729;
+	k2 *= C2;
+	k2 = ROTL(k2, 33);
+	k2 *= C1;
+	h2 ^= k2;
+	h2 = ROTL(h2, 31);
+	h2 += h1;
+	h2 = h2 * 5 + 0x38495ab5;
+    }
+    m->h1 = h1;
+    m->h2 = h2;
+}
+
+
+ /* Hash the last len (< 16) bytes at p, and give the result. */
+static void
+mm_end(m, p, len, out)
+    struct mm      *m;
+    const unsigned char *p;
+    size_t          len;
+    uint64_t        out[2];
+{
+    uint64_t        k1 = 0, k2 = 0, h1 = m->h1, h2 = m->h2;
+    size_t          i;
+
+    for (i = len; i-- > 8;)
+	k2 ^= (uint64_t) p[i] << ((i - 8) * 8);
+    for (i = len < 8 ? len : 8; i-- > 0;)
+	k1 ^= (uint64_t) p[i] << (i * 8);
+    if (len > 8) {
+	k2 *= C2;
+	k2 = ROTL(k2, 33);
+	k2 *= C1;
+	h2 ^= k2;
+    }
+    if (len > 0) {
+	k1 *= C1;
+	k1 = ROTL(k1, 31);
+	k1 *= C2;
+	h1 ^= k1;
+    }
+    h1 ^= m->len + len;
+    h2 ^= m->len + len;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix(h1);
+    h2 = fmix(h2);
+    h1 += h2;
+    h2 += h1;
+    out[0] = h1;
+    out[1] = h2;
+}
+
+
+ /*
+  * Hash the first upto bytes of file path, reading them into buf.
+  * Returns -1 if it can't be read, or is now shorter than that.
+  */
+static int
+hash_file(path, upto, out, buf)
+    char           *path;
+    off_t           upto;
+    uint64_t        out[2];
+    char           *buf;
+{
+    struct mm       m;
+    size_t          want, got, body;
+    ssize_t         n;
+    int             fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+	return -1;
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, upto, POSIX_FADV_SEQUENTIAL);
+#endif
+    memset((char *) &m, '\0', sizeof(m));
+    while (upto > 0) {
+	want = upto < DP_BUFSIZ ? upto : DP_BUFSIZ;
+	for (got = 0; got < want; got += n)
+	    if ((n = read(fd, buf + got, want - got)) <= 0)
+		break;
+	if (got < want) {
+	    close(fd);
+	    return -1;
+	}
+	body = got & ~(size_t) 15;
+	mm_body(&m, (unsigned char *) buf, body);
+	if ((upto -= got) == 0)
+	    mm_end(&m, (unsigned char *) buf + body, got - body, out);
+    }
+    close(fd);
+    return 0;
+}
+
+
+ /* One of the hashing threads: hash files until there are none left. */
+static void *
+worker(arg)
+    void           *arg;
+{
+    struct pass    *p = arg;
+    struct dupfile *f;
+    char            path[PATH_MAX], *buf;
+    size_t          len;
+    int             i;
+
+    if ((buf = malloc(p->first ? DP_BLOCK : DP_BUFSIZ)) == NULL)
+	return NULL;
+    while ((i = __sync_fetch_and_add(&p->next, 1)) < p->dt->count) {
+	f = &p->dt->files[i];
+	if (!p->first && f->size <= DP_BLOCK)
+	    continue;		/* the first pass hashed all of it */
+	if (t_path(p->t, f->node, path, sizeof(path)) < 0
+	    || (len = strlen(path)) + strlen(p->dt->names + f->name) + 2
+	    > sizeof(path)) {
+	    f->bad = 1;
+	    continue;
+	}
+	if (len == 0 || path[len - 1] != '/')
+	    path[len++] = '/';
+	strcpy(path + len, p->dt->names + f->name);
+	if (hash_file(path, p->first && f->size > DP_BLOCK ? DP_BLOCK : f->size,
+		      f->hash, buf) < 0)
+	    f->bad = 1;
+    }
+    free(buf);
+    return NULL;
+}
+
+
+ /*
+  * Hash every file in the table, over its first block or all of it.
+  * As many threads as there are processors share the work, up to
+  * DP_THREADS; if none can be started it's done here.
+  */
+static void
+hash_all(dt, t, first)
+    struct duptab  *dt;
+    struct tree    *t;
+    int             first;
+{
+    pthread_t       threads[DP_THREADS];
+    struct pass     p;
+    long            cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int             i, n;
+
+    p.dt = dt;
+    p.t = t;
+    p.first = first;
+    p.next = 0;
+    if (cpus < 1)
+	cpus = 1;
+    for (n = 0; n < DP_THREADS && n < cpus && n < dt->count; n++)
+	if (pthread_create(&threads[n], NULL, worker, &p) != 0)
+	    break;
+    if (n == 0)
+	worker(&p);
+    for (i = 0; i < n; i++)
+	pthread_join(threads[i], NULL);
+}
+
+
+static int
+by_inode(a, b)
+    const void     *a, *b;
+{
+    const struct dupfile *x = a, *y = b;
+
+    if (x->size != y->size)
+	return x->size < y->size ? -1 : 1;
+    if (x->dev != y->dev)
+	return x->dev < y->dev ? -1 : 1;
+    if (x->ino != y->ino)
+	return x->ino < y->ino ? -1 : 1;
+    return x->seq - y->seq;
+}
+
+
+static int
+by_hash(a, b)
+    const void     *a, *b;
+{
+    const struct dupfile *x = a, *y = b;
+
+    if (x->bad != y->bad)
+	return x->bad - y->bad;
+    if (x->size != y->size)
+	return x->size < y->size ? -1 : 1;
+    if (x->hash[0] != y->hash[0])
+	return x->hash[0] < y->hash[0] ? -1 : 1;
+    if (x->hash[1] != y->hash[1])
+	return x->hash[1] < y->hash[1] ? -1 : 1;
+    return x->seq - y->seq;
+}
+
+
+static int
+by_k(a, b)
+    const void     *a, *b;
+{
+    const struct dupdir *x = a, *y = b;
+
+    if (x->k != y->k)
+	return x->k < y->k ? 1 : -1;
+    return x->node - y->node;
+}
+
+
+ /*
+  * Sorted by hash, keep only the runs of files alike, the files that
+  * couldn't be read having sunk to the end.  Returns the files kept.
+  */
+static int
+keep_alike(dt)
+    struct duptab  *dt;
+{
+    struct dupfile *f = dt->files;
+    int             i, j, kept = 0;
+
+    qsort(f, dt->count, sizeof(struct dupfile), by_hash);
+    for (i = 0; i < dt->count && !f[i].bad; i = j) {
+	for (j = i + 1; j < dt->count && !f[j].bad && f[j].size == f[i].size
+	     && f[j].hash[0] == f[i].hash[0] && f[j].hash[1] == f[i].hash[1];
+	     j++);
+	if (j - i < 2)
+	    continue;
+	memmove(&f[kept], &f[i], (j - i) * sizeof(struct dupfile));
+	kept += j - i;
+    }
+    return kept;
+}
+
+
+ /*
+  * Find the copies among the files noted, in tree t, whose paths are
+  * taken from where we are.  *dirs is set to the directories holding
+  * copies, most reclaimable space first (the caller frees it), and
+  * the number of them returned; -1 if there's no memory.  The table
+  * is used up.
+  */
+int
+dp_find(dt, t, dirs)
+    struct duptab  *dt;
+    struct tree    *t;
+    struct dupdir **dirs;
+{
+    struct dupfile *f = dt->files;
+    struct dupdir  *d;
+    int             i, j, k, kept, ndirs = 0;
+
+    *dirs = NULL;
+    dt->k = dt->copies = dt->groups = 0;
+
+    /* Sizes more than one inode has, each inode once. */
+    qsort(f, dt->count, sizeof(struct dupfile), by_inode);
+    for (i = kept = 0; i < dt->count; i = j) {
+	for (j = i + 1, k = 1; j < dt->count && f[j].size == f[i].size; j++)
+	    if (f[j].dev != f[j - 1].dev || f[j].ino != f[j - 1].ino)
+		k++;
+	if (k < 2)
+	    continue;
+	for (k = i; k < j; k++)
+	    if (k == i || f[k].dev != f[k - 1].dev || f[k].ino != f[k - 1].ino)
+		f[kept++] = f[k];
+    }
+    dt->count = kept;
+
+    /* Their first blocks, then all of the ones still alike. */
+    hash_all(dt, t, 1);
+    dt->count = keep_alike(dt);
+    hash_all(dt, t, 0);
+    dt->count = keep_alike(dt);
+
+    /* Within each run the file found first stays, the others could go. */
+    if ((d = calloc(t->count ? t->count : 1, sizeof(struct dupdir))) == NULL)
+	return -1;
+    for (i = 0; i < dt->count; i = j) {
+	for (j = i + 1; j < dt->count && f[j].size == f[i].size
+	     && f[j].hash[0] == f[i].hash[0] && f[j].hash[1] == f[i].hash[1];
+	     j++) {
+	    d[f[j].node].k += f[j].k;
+	    d[f[j].node].copies++;
+	    dt->k += f[j].k;
+	    dt->copies++;
+	}
+	dt->groups++;
+    }
+    for (i = 0; i < t->count; i++)
+	if (d[i].copies) {
+	    d[ndirs] = d[i];
+	    d[ndirs++].node = i;
+	}
+    qsort(d, ndirs, sizeof(struct dupdir), by_k);
+    *dirs = d;
+    return ndirs;
+}
+
+
+void
+dp_free(dt)
+    struct duptab  *dt;
+{
+    free(dt->files);
+    free(dt->names);
+    memset((char *) dt, '\0', sizeof(*dt));
+}
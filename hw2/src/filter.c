@@ -0,0 +1,218 @@
+/* filter.c
+
+ * Which entries vtree leaves out.  An entry whose name matches an
+ * exclude pattern (a glob, as for fnmatch(3), or an extended regular
+ * expression) is skipped outright, before it's stat'ed; for a
+ * directory that means everything below it too.  If there are include
+ * patterns, a file is only counted if its name matches one of them.
+ * A file is also left out if it's shorter than the -m size or older
+ * than the -N time.  Directories are only ever excluded, so that the
+ * files below them still get looked at.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <fnmatch.h>
+#include <regex.h>
+#include "filter.h"
+
+struct pattern {
+    char           *text;	/* as given */
+    int             kind;	/* FL_GLOB or FL_REGEX */
+    regex_t         re;
+};
+
+struct patterns {
+    struct pattern *pats;
+    int             count;
+    int             max;
+};
+
+static struct patterns excludes, includes;
+static off_t    minsize = -1;	/* -m, in bytes, -1 if none */
+static time_t   newer = -1;	/* -N, -1 if none */
+
+static int match(struct patterns *ps, char *name);
+static void show(struct patterns *ps, char *what);
+
+
+ /*
+  * Add an include or exclude pattern of the given FL_xxx kind.  Says
+  * what's wrong and returns -1 if a regular expression doesn't
+  * compile.
+  */
+int
+fl_add(pattern, kind, include)
+    char           *pattern;
+    int             kind, include;
+{
+    struct patterns *ps = include ? &includes : &excludes;
+    struct pattern *p;
+    char            msg[256];
+    int             rc;
+
+    if (ps->count == ps->max) {
+	p = realloc(ps->pats, (ps->max ? ps->max * 2 : 8) * sizeof(*p));
+	if (p == NULL) {
+	    perror("can't add pattern");
+	    return -1;
+	}
+	ps->pats = p;
+	ps->max = ps->max ? ps->max * 2 : 8;
+    }
+    p = &ps->pats[ps->count];
+    p->text = pattern;
+    p->kind = kind;
+    if (kind == FL_REGEX
+	&& (rc = regcomp(&p->re, pattern, REG_EXTENDED | REG_NOSUB)) != 0) {
+	regerror(rc, &p->re, msg, sizeof(msg));
+	fprintf(stderr, "%s: %s\n", pattern, msg);
+	return -1;
+    }
+    ps->count++;
+    return 0;
+}
+
+
+ /*
+  * -m: a size in K, or with a k, M, G or T after it.  Returns -1 if
+  * it isn't one.
+  */
+int
+fl_minsize(arg)
+    char           *arg;
+{
+    char           *end;
+    double          size = strtod(arg, &end);
+
+    if (end == arg || size < 0)
+	return -1;
+    switch (toupper((unsigned char) *end)) {
+    case 'T':
+	size *= 1024;
+	/* FALLTHROUGH */
+    case 'G':
+	size *= 1024;
+	/* FALLTHROUGH */
+    case 'M':
+	size *= 1024;
+	/* FALLTHROUGH */
+    case 'K':
+    case '\0':
+	break;
+    default:
+	return -1;
+    }
+    if (*end && end[1])
+	return -1;
+    minsize = (off_t) (size * 1024);
+    return 0;
+}
+
+
+ /*
+  * -N: a number of days, or a file whose modification time to go by,
+  * as find -newer does.  Returns -1 if it's neither.
+  */
+int
+fl_newer(arg)
+    char           *arg;
+{
+    struct stat     st;
+    char           *end;
+    double          days = strtod(arg, &end);
+
+    if (end != arg && *end == '\0' && days >= 0)
+	newer = time(NULL) - (time_t) (days * 24 * 60 * 60);
+    else if (stat(arg, &st) == 0)
+	newer = st.st_mtime;
+    else
+	return -1;
+    return 0;
+}
+
+
+ /* Is any filter on?  If so every file has to be looked at. */
+int
+fl_active()
+{
+    return excludes.count || includes.count || minsize >= 0 || newer >= 0;
+}
+
+
+ /* Are there exclude patterns, for a directory to be sifted? */
+int
+fl_excluding()
+{
+    return excludes.count;
+}
+
+
+static int
+match(ps, name)
+    struct patterns *ps;
+    char           *name;
+{
+    struct pattern *p;
+    int             i;
+
+    for (i = 0; i < ps->count; i++) {
+	p = &ps->pats[i];
+	if (p->kind == FL_GLOB ? fnmatch(p->text, name, 0) == 0
+	    : regexec(&p->re, name, 0, NULL, 0) == 0)
+	    return 1;
+    }
+    return 0;
+}
+
+
+ /* Is the entry called name excluded, whatever it is? */
+int
+fl_skip(name)
+    char           *name;
+{
+    return excludes.count && match(&excludes, name);
+}
+
+
+ /* Does the file called name, stat'ed into st, count? */
+int
+fl_count(name, st)
+    char           *name;
+    struct stat    *st;
+{
+    if (minsize >= 0 && st->st_size < minsize)
+	return 0;
+    if (newer >= 0 && st->st_mtime < newer)
+	return 0;
+    return includes.count == 0 || match(&includes, name);
+}
+
+
+static void
+show(ps, what)
+    struct patterns *ps;
+    char           *what;
+{
+    int             i;
+
+    for (i = 0; i < ps->count; i++)
+	printf("%s %s:	%s\n", what,
+	       ps->pats[i].kind == FL_GLOB ? "glob" : "regex", ps->pats[i].text);
+}
+
+
+ /* For -VV: what's being left out. */
+void
+fl_print()
+{
+    show(&excludes, "Exclude");
+    show(&includes, "Include");
+    if (minsize >= 0)
+	printf("Files of at least:	%ldK\n", (long) (minsize / 1024));
+    if (newer >= 0)
+	printf("Files changed since:	%s", ctime(&newer));
+}
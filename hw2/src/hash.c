@@ -18,7 +18,8 @@
 #include <sys/types.h>
 #include "hash.h"
 
-static struct htable *tables[TABLES];
+static struct hset inodes;		/* the inodes seen so far */
+static pthread_once_t inodes_once = PTHREAD_ONCE_INIT;
 
 //Mehdad Zaman added
 #ifdef LINUX
@@ -31,21 +32,191 @@ static struct htable *tables[TABLES];
 #endif
 //
 
-/* These are for statistical use later on. */
-static int      hs_tables = 0,	/* number of tables allocated */
-                hs_duplicates = 0,	/* number of OLD's returned */
-                hs_buckets = 0,	/* number of buckets allocated */
-                hs_extensions = 0,	/* number of bucket extensions */
-                hs_searches = 0,/* number of searches */
-                hs_compares = 0,/* total key comparisons */
-                hs_longsearch = 0;	/* longest search */
+static unsigned long long hs_hash(dev_t dev, ino_t ino);
+static int hs_grow(struct hstripe *sp);
+static void inodes_init(void);
+
+
+ /*
+  * Mix device and inode into a hash.  Inode numbers tend to be dense
+  * runs, so they're scrambled (a splitmix64 finalizer); the top bits
+  * then pick the stripe and the low bits the slot within it.
+  */
+static unsigned long long
+hs_hash(dev, ino)
+    dev_t           dev;
+    ino_t           ino;
+{
+    unsigned long long h;
+
+    h = (unsigned long long) ino ^ ((unsigned long long) dev << 32 |
+				    (unsigned long long) dev >> 32);
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+
+ /*
+  * Double the number of slots in a stripe (or make the first ones)
+  * and re-enter its keys.  Called with the stripe locked.  Returns -1,
+  * leaving the stripe as it was, if there's no memory for it.
+  */
+static int
+hs_grow(sp)
+    struct hstripe *sp;
+{
+    struct hslot   *slots, *old = sp->slots;
+    size_t          size = sp->st.size ? sp->st.size * 2 : HS_SLOTS,
+                    i, j;
+
+    slots = (struct hslot *) malloc(size * sizeof(struct hslot));
+    if (slots == NULL)
+	return -1;
+    memset((char *) slots, 0xff, size * sizeof(struct hslot));
+
+    for (i = 0; i < sp->st.size; i++) {
+	if (old[i].dev == HS_EMPTY)
+	    continue;
+	j = hs_hash(old[i].dev, old[i].ino) & (size - 1);
+	while (slots[j].dev != HS_EMPTY)
+	    j = (j + 1) & (size - 1);
+	slots[j] = old[i];
+    }
+
+    free(old);
+    if (sp->st.size)
+	sp->st.resizes++;
+    sp->slots = slots;
+    sp->st.size = size;
+    return 0;
+}
+
+
+ /* Set up an empty set.  The slots are allocated as keys arrive. */
+void
+hs_init(hs)
+    struct hset    *hs;
+{
+    int             i;
+
+    memset((char *) hs, '\0', sizeof(*hs));
+    for (i = 0; i < HS_STRIPES; i++)
+	pthread_mutex_init(&hs->stripes[i].lock, NULL);
+}
 
 
  /*
   * This routine takes in a device/inode, and tells whether it's been
-  * entered in the table before.  If it hasn't, then the inode is added
-  * to the table.  A separate table is maintained for each major device
-  * number, so separate file systems each have their own table.
+  * entered in the set before.  If it hasn't, then it is added.  The
+  * test and the insert happen under the stripe's lock, so when several
+  * threads enter the same key exactly one of them gets NEW.  Within a
+  * stripe a lookup is a short run of adjacent slots; the stripe
+  * doubles before it gets half full.
+  */
+int
+hs_enter(hs, dev, ino)
+    struct hset    *hs;
+    dev_t           dev;
+    ino_t           ino;
+{
+    unsigned long long h = hs_hash(dev, ino);
+    struct hstripe *sp = &hs->stripes[HS_STRIPE(h)];
+    register struct hslot *slotp;
+    size_t          i, n;
+    int             rc = NEW;
+
+    pthread_mutex_lock(&sp->lock);
+    sp->st.searches++;		/* stat, total number of calls */
+
+    if (sp->st.filled >= HS_LOAD(sp->st.size) && hs_grow(sp) < 0) {
+	if (!sp->st.size) {
+	    perror("can't malloc hash table");
+	    goto out;
+	}
+	if (sp->st.filled == sp->st.size - 1) {
+	    perror("can't extend hash table");
+	    goto out;
+	}
+    }
+
+    for (i = h & (sp->st.size - 1), n = 1;;
+	 i = (i + 1) & (sp->st.size - 1), n++) {
+	slotp = &sp->slots[i];
+	if (slotp->dev == HS_EMPTY)
+	    break;
+	if (slotp->ino == ino && slotp->dev == dev) {
+	    sp->st.probes += n;
+	    sp->st.duplicates++;	/* stat, duplicate inodes */
+	    rc = OLD;
+	    goto out;
+	}
+    }
+
+    sp->st.probes += n;
+    if (n > sp->st.longprobe)
+	sp->st.longprobe = n;
+
+    slotp->dev = dev;
+    slotp->ino = ino;
+    sp->st.filled++;
+out:
+    pthread_mutex_unlock(&sp->lock);
+    return rc;
+}
+
+
+ /* Add up the statistics of all the stripes. */
+void
+hs_stats(hs, st)
+    struct hset    *hs;
+    struct hstats  *st;
+{
+    struct hstripe *sp;
+    int             i;
+
+    memset((char *) st, '\0', sizeof(*st));
+    for (i = 0; i < HS_STRIPES; i++) {
+	sp = &hs->stripes[i];
+	pthread_mutex_lock(&sp->lock);
+	st->size += sp->st.size;
+	st->filled += sp->st.filled;
+	st->searches += sp->st.searches;
+	st->duplicates += sp->st.duplicates;
+	st->probes += sp->st.probes;
+	if (sp->st.longprobe > st->longprobe)
+	    st->longprobe = sp->st.longprobe;
+	st->resizes += sp->st.resizes;
+	pthread_mutex_unlock(&sp->lock);
+    }
+}
+
+
+ /* Give back a set's memory.  It must be hs_init'ed again for reuse. */
+void
+hs_free(hs)
+    struct hset    *hs;
+{
+    int             i;
+
+    for (i = 0; i < HS_STRIPES; i++) {
+	free(hs->stripes[i].slots);
+	pthread_mutex_destroy(&hs->stripes[i].lock);
+    }
+    memset((char *) hs, '\0', sizeof(*hs));
+}
+
+
+static void
+inodes_init()
+{
+    hs_init(&inodes);
+}
+
+
+ /*
+  * The inode set vtree uses to keep from counting the same inode
+  * twice.  Safe to call from several threads at once.
   */
 //Mehdad Zaman Added
 int
@@ -54,86 +225,8 @@ h_enter(dev, ino)
     dev_t           dev;
     ino_t           ino;
 {
-    static struct htable *tablep = (struct htable *) 0;
-    register struct hbucket *bucketp;
-    register ino_t *keyp;
-    int             i;
-
-    hs_searches++;		/* stat, total number of calls */
-
-    /*
-     * Find the hash table for this device. We keep the table pointer
-     * around between calls to h_enter, so that we don't have to locate
-     * the correct hash table every time we're called.  I don't expect
-     * to jump from device to device very often.
-     */
-    if (!tablep || tablep->device != dev) {
-	for (i = 0; tables[i] && tables[i]->device != dev;)
-	    i++;
-	if (!tables[i]) {
-	    tables[i] = (struct htable *)  malloc(sizeof(struct htable));
-	    if (tables[i] == NULL) {
-		perror("can't malloc hash table");
-		return NEW;
-	    };
-#ifdef BSD
-	    bzero(tables[i], sizeof(struct htable));
-#else
-	    memset((char *) tables[i], '\0', sizeof (struct htable));
-#endif
-	    tables[i]->device = dev;
-	    hs_tables++;	/* stat, new table allocated */
-	};
-	tablep = tables[i];
-    };
-
-    /* Which bucket is this inode assigned to? */
-    bucketp = &tablep->buckets[ino % BUCKETS];
-
-    /*
-     * Now check the key list for that bucket.  Just a simple linear
-     * search.
-     */
-    keyp = bucketp->keys;
-    for (i = 0; i < bucketp->filled && *keyp != ino;)
-	i++, keyp++;
-
-    hs_compares += i + 1;	/* stat, total key comparisons */
-
-    if (i && *keyp == ino) {
-	hs_duplicates++;	/* stat, duplicate inodes */
-	return OLD;
-    };
-
-    /* Longest search.  Only new entries could be the longest. */
-    if (bucketp->filled >= hs_longsearch)
-	hs_longsearch = bucketp->filled + 1;
-
-    /* Make room at the end of the bucket's key list. */
-    if (bucketp->filled == bucketp->length) {
-	/* No room, extend the key list. */
-	if (!bucketp->length) {
-	    bucketp->keys = (ino_t *) calloc(EXTEND, sizeof(ino_t));
-	    if (bucketp->keys == NULL) {
-		perror("can't malloc hash bucket");
-		return NEW;
-	    };
-	    hs_buckets++;
-	} else {
-	    bucketp->keys = (ino_t *)
-		realloc(bucketp->keys,
-			(EXTEND + bucketp->length) * sizeof(ino_t));
-	    if (bucketp->keys == NULL) {
-		perror("can't extend hash bucket");
-		return NEW;
-	    };
-	    hs_extensions++;
-	};
-	bucketp->length += EXTEND;
-    };
-
-    bucketp->keys[++(bucketp->filled)] = ino;
-    return NEW;
+    pthread_once(&inodes_once, inodes_init);
+    return hs_enter(&inodes, dev, ino);
 }
 
 
@@ -143,16 +236,23 @@ h_enter(dev, ino)
 void
 h_stats()
 {
+    struct hstats   st;
+
+    pthread_once(&inodes_once, inodes_init);
+    hs_stats(&inodes, &st);
     fprintf(stderr, "\nHash table management statistics:\n");
-    fprintf(stderr, "  Tables allocated: %d\n", hs_tables);
-    fprintf(stderr, "  Buckets used: %d\n", hs_buckets);
-    fprintf(stderr, "  Bucket extensions: %d\n\n", hs_extensions);
-    fprintf(stderr, "  Total searches: %d\n", hs_searches);
-    fprintf(stderr, "  Duplicate keys found: %d\n", hs_duplicates);
-    if (hs_searches)
-	fprintf(stderr, "  Average key search: %d\n",
-		hs_compares / hs_searches);
-    fprintf(stderr, "  Longest key search: %d\n", hs_longsearch);
+    fprintf(stderr, "  Stripes: %d\n", HS_STRIPES);
+    fprintf(stderr, "  Slots allocated: %lu\n", (unsigned long) st.size);
+    fprintf(stderr, "  Keys entered: %lu\n", (unsigned long) st.filled);
+    if (st.size)
+	fprintf(stderr, "  Load factor: %.2f\n", (double) st.filled / st.size);
+    fprintf(stderr, "  Stripe resizes: %d\n\n", st.resizes);
+    fprintf(stderr, "  Total searches: %ld\n", st.searches);
+    fprintf(stderr, "  Duplicate keys found: %ld\n", st.duplicates);
+    if (st.searches)
+	fprintf(stderr, "  Average probe length: %.2f\n",
+		(double) st.probes / st.searches);
+    fprintf(stderr, "  Longest probe length: %ld\n", st.longprobe);
     fflush(stderr);
 }
 
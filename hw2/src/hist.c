@@ -0,0 +1,93 @@
+/* hist.c
+
+ * Size and age histograms for vtree's -A mode, after the age report of
+ * agef that vtree grew out of.  The buckets are fixed, so a file costs
+ * a few comparisons and no memory, and the stat is the one the walk
+ * made anyway.
+ */
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "hist.h"
+
+#define DAY		(24L * 60 * 60)
+
+static long     size_limits[H_SIZES - 1] = {	/* bytes, inclusive */
+    0, 1L << 10, 1L << 13, 1L << 16, 1L << 19, 1L << 22, 1L << 25,
+    1L << 28, 1L << 31
+};
+static char    *size_names[H_SIZES] = {
+    "0", "1-1K", "1K-8K", "8K-64K", "64K-512K", "512K-4M", "4M-32M",
+    "32M-256M", "256M-2G", ">2G"
+};
+
+static long     age_limits[H_AGES - 1] = {	/* days, inclusive */
+    7, 30, 90, 180, 365, 730, 1825
+};
+static char    *age_names[H_AGES] = {
+    "0-7", "8-30", "31-90", "91-180", "181-365", "366-730",
+    "731-1825", ">1825"
+};
+
+static int bucket(long *limits, int n, long x);
+
+
+ /* The first bucket whose limit x doesn't pass, the last if none. */
+static int
+bucket(limits, n, x)
+    long           *limits;
+    int             n;
+    long            x;
+{
+    int             b;
+
+    for (b = 0; b < n - 1 && x > limits[b]; b++);
+    return b;
+}
+
+
+ /*
+  * Count a file whose stat is st and which takes up k K's, as of
+  * 'now'.  A time in the future counts as brand new.
+  */
+void
+hist_add(h, st, k, now)
+    struct hist    *h;
+    struct stat    *st;
+    long            k;
+    time_t          now;
+{
+    struct hbucket *b;
+
+    b = &h->sizes[bucket(size_limits, H_SIZES, (long) st->st_size)];
+    b->files++;
+    b->k += k;
+
+    b = &h->ages[H_MTIME][bucket(age_limits, H_AGES,
+				 (long) (now - st->st_mtime) / DAY)];
+    b->files++;
+    b->k += k;
+
+    b = &h->ages[H_ATIME][bucket(age_limits, H_AGES,
+				 (long) (now - st->st_atime) / DAY)];
+    b->files++;
+    b->k += k;
+}
+
+
+ /* Bucket names, for the tables. */
+char           *
+hist_sizename(b)
+    int             b;
+{
+    return size_names[b];
+}
+
+char           *
+hist_agename(b)
+    int             b;
+{
+    return age_names[b];
+}
@@ -0,0 +1,805 @@
+/* render.c
+
+   The text displays of vtree: the default one-directory-per-line
+   listing, the quick display (-q) and the visual tree (-v, -f), with
+   the grand totals (-t) at the end.  They work from the tree the walk
+   has built, replaying it in the order it was read, so the output is
+   the same as when it used to be printed during the walk.
+
+   The machine-readable formats (-F json, -F csv) are streamed
+   instead: one record per directory, written as soon as the walk is
+   done with it, so subdirectories come before their parents.  The
+   --top lists and -D device totals are written at the end, and the
+   -A histograms after each top level directory, in the same formats.
+   Watch mode (-W) writes the output again from the tree when asked.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef	BSD
+#include <strings.h>
+#else
+#include <string.h>
+#endif
+
+#include "customize.h"
+#include "tree.h"
+#include "render.h"
+#include "vtree.h"
+
+#define	V_CHAR	"|"	/*	Vertical character	*/
+#define	H_CHAR	"-"	/*	Horizontal character	*/
+#define	A_CHAR	">"	/*	Arrow char		*/
+#define	T_CHAR	"+"	/*	Tee char		*/
+#define	L_CHAR	"\\"	/*	L char, bottom of a branch	*/
+
+#define	MAX_COL_WIDTH	15
+#define	MAX_V_DEPTH	256		/* max depth for visual display */
+
+static int	indent = 0,		/* current indent */
+		cur_depth = 0,
+		sub_dirs[MAX_V_DEPTH],
+		sub_dirs_indents[MAX_V_DEPTH];
+
+static int	total_inodes, inodes;	/* inode count */
+static long	total_sizes, sizes;	/* block count */
+static long	total_asizes, asizes;	/* -S, by st_size */
+
+static int	format = OUT_TEXT;	/* OUT_xxx */
+static char	*formats[] = { "text", "json", "csv", NULL };
+static int	headed = FALSE;		/* CSV heading written */
+
+#define	DIR_HEAD	"path,depth,k,inodes,total_k,total_inodes,unreadable"
+#define	APP_HEAD	DIR_HEAD ",apparent_k,total_apparent_k,allocated_pct"
+
+static int	indented = FALSE;	/* These determine what gets */
+static int	last_indent = 0;	/* displayed during the */
+static int	last_subdir = FALSE;	/* visual display */
+
+#ifdef LINUX
+static char *lastfield(char *p, int c);
+static int allocated(long k, long ak);
+static void put_sizes(long k, long ak);
+static void show(struct tree *t, int n);
+static void put_name(char *p);
+static int utf8_len(unsigned char *p);
+static void put_path(struct tree *t, int n);
+static void put_head(char *heading);
+static void put_dir(struct tree *t, int n, int level);
+static void put_dirs(struct tree *t, int n, int level);
+static void put_top(struct tree *t, struct topn *tp, char *type);
+static void put_bucket(struct tree *t, int n, char *kind, char *name,
+    struct hbucket *b, struct hbucket *b2);
+#endif
+
+/*
+** Find the last field of a string.
+*/
+static char *lastfield(p,c)
+char *p;	/* Null-terminated string to scan */
+int   c;	/* Separator char, usually '/' */
+{
+char *r;
+
+	r = p;
+	while (*p)			/* Find the last field of the name */
+		if (*p++ == c)
+			r = p;
+	return r;
+} /* lastfield */
+
+
+
+ /*
+  * How much of the apparent size ak is allocated, in per cent.  Well
+  * under 100 is a sparse file (or a directory of them); small files
+  * and directories come out over 100, as they take whole blocks.
+  */
+static int
+allocated(k, ak)
+long	k, ak;
+{
+	return ak ? (int) ((k * 100 + ak / 2) / ak) : 100;
+} /* allocated */
+
+
+ /* The end of a directory's line: its K's, and with -S the rest. */
+static void
+put_sizes(k, ak)
+long	k, ak;
+{
+	printf(" : %ld", k);
+	if (apparent)
+		printf(" / %ld (%d%%)", ak, allocated(k, ak));
+	putchar('\n');
+} /* put_sizes */
+
+
+
+ /*
+  * Display directory n, then its subdirectories.  The caller has
+  * already added the directory's own space to the running totals.
+  */
+static void
+show(t, n)
+struct tree	*t;
+int	n;
+{
+char	tmp[NAMELEN];
+char	*subdir = T_NAME(t, n);
+int	i, x, c;
+
+	if ( (cur_depth == depth) && (!sum) )
+		return;
+
+/* display the tree */
+
+	if (cur_depth < depth) {
+		if (visual) {
+			if (!indented) {
+				for (i = 1; i <cur_depth; i++) {
+					if (floating) x = sub_dirs_indents[i] + 1;
+						else x = MAX_COL_WIDTH - 3;
+					if (sub_dirs[i]) {
+						printf("%*s%s   ",x - 1," ",V_CHAR);
+					} else printf("%*s   ",x," ");
+				}
+				if (cur_depth>0) {
+					if (floating) x = sub_dirs_indents[cur_depth] + 1;
+						else x = MAX_COL_WIDTH - 3;
+					if (sub_dirs[cur_depth] == 0) {
+						printf("%*s%s%s%s ",x - 1," ",L_CHAR,H_CHAR,A_CHAR);
+						last_subdir = cur_depth;
+					}
+					else printf("%*s%s%s%s ",x - 1," ",T_CHAR,H_CHAR,A_CHAR);
+				}
+			} else {
+				if (!floating)
+					for (i = 1; i<MAX_COL_WIDTH-last_indent-3; i++)
+						printf("%s",H_CHAR);
+				printf("%s%s%s ",T_CHAR,H_CHAR,A_CHAR);
+			}
+
+	/* This is in case a subdir name is too big.  It is then displayed on
+	** two lines, the first line is the full name, the second line is
+	** truncated.  Any subdirs displayed for the current subdir will be
+	** appended to the second line.  This keeps the columns in order
+	*/
+
+#ifndef	ONEPERLINE
+			if (  ( strlen(subdir) > MAX_COL_WIDTH - 3 && !floating )	) {
+#else
+			if (  ( strlen(subdir) > MAX_COL_WIDTH - 3 && !floating ) ||
+			    lastfield(subdir,'/') != subdir) {
+#endif
+
+				printf("%s\n",subdir);
+				for (i = 1; i <=cur_depth; i++) {
+					if (sub_dirs[i]) {
+						printf("%*s%s   ",MAX_COL_WIDTH-4," ",V_CHAR);
+					}
+					else printf("%*s   ",MAX_COL_WIDTH-3," ");
+				}
+				strcpy(tmp,lastfield(subdir,'/'));
+				tmp[MAX_COL_WIDTH - 4] = 0;
+				printf("%s",tmp);
+#ifdef	ONEPERLINE
+				if (floating || strlen(tmp) < MAX_COL_WIDTH - 4) printf(" ");
+#endif
+				sub_dirs_indents[cur_depth + 1] = last_indent = strlen(tmp) + 1;
+			}
+			else {
+				printf("%s",subdir);
+				sub_dirs_indents[cur_depth + 1] = last_indent = strlen(subdir)+1;
+				if (floating || strlen(subdir) < MAX_COL_WIDTH - 4)
+					printf(" ");
+			}
+			indented = TRUE;
+		}
+		else printf("%*s%s",indent," ",subdir);
+	}
+
+	if (T_NODE(t, n)->flags & N_UNREAD) {
+		printf(" - can't read %s\n", subdir);
+		indented = FALSE;
+		return;
+	}
+
+	cur_depth++;
+	indent+=3;
+
+	if ( (!quick) && (!visual) ) {
+
+		/* accumulate total sizes and inodes in current directory */
+
+		sizes += T_NODE(t, n)->files;
+		inodes += T_NODE(t, n)->inodes;
+		asizes += T_NODE(t, n)->afiles;
+
+		if (cur_depth<depth) {
+			if (cnt_inodes) printf("   %d",inodes);
+			put_sizes(sizes, asizes);
+			total_sizes += sizes;
+			total_inodes += inodes;
+			total_asizes += asizes;
+			sizes = asizes = 0;
+			inodes = 0;
+		}
+	} else if (!visual) printf("\n");
+
+/* count subdirectories */
+
+	if (visual)
+		sub_dirs[cur_depth] += T_NODE(t, n)->nchild;
+
+/* go down into the subdirectories */
+
+	for (c = T_NODE(t, n)->child; c != NONE; c = T_NODE(t, c)->next) {
+		sub_dirs[cur_depth]--;
+		sizes += T_NODE(t, c)->own;
+		asizes += T_NODE(t, c)->aown;
+		inodes++;
+		show(t, c);
+	}
+
+	if ( (!quick) && (!visual) ) {
+
+/* print totals */
+		if (cur_depth == depth) {
+			if (cnt_inodes) printf("   %d",inodes);
+			put_sizes(sizes, asizes);
+			total_sizes += sizes;
+			total_inodes += inodes;
+			total_asizes += asizes;
+			sizes = asizes = 0;
+			inodes = 0;
+		}
+	}
+
+	if (visual && indented) {
+		printf("\n");
+		indented = FALSE;
+		if (last_subdir>=cur_depth-1) {
+			for (i = 1; i <cur_depth; i++) {
+				if (sub_dirs[i]) {
+					if (floating)
+						printf("%*s%s   ",sub_dirs_indents[i]," ",V_CHAR);
+					else printf("%*s%s   ",MAX_COL_WIDTH-4," ",V_CHAR);
+				} else {
+					if (floating)
+/*ZZZ*/						printf("%*s   ",sub_dirs_indents[i] + 1," ");
+ 					else printf("%*s   ",MAX_COL_WIDTH-3," ");
+ 				}
+			}
+			printf("\n");
+			last_subdir = FALSE;
+		}
+	}
+	indent-=3;
+	sub_dirs[cur_depth] = 0;
+	cur_depth--;
+} /* show */
+
+
+
+ /*
+  * The default, quick and visual displays, one top level directory
+  * after another, and the totals if they were asked for.  With -k size
+  * the subdirectories are shown largest total first.
+  */
+void
+render_text(t)
+struct tree	*t;
+{
+int	n;
+
+	total_inodes = total_sizes = total_asizes = 0;
+
+	for (n = t->root; n != NONE; n = T_NODE(t, n)->next) {
+		if (by_total)
+			t_sort(t, n);
+		cur_depth = inodes = sizes = asizes = 0;
+
+		sizes += T_NODE(t, n)->own;
+		asizes += T_NODE(t, n)->aown;
+		inodes++;
+		show(t, n);
+
+		total_inodes += inodes;
+		total_sizes += sizes;
+		total_asizes += asizes;
+	}
+
+	if (sw_summary) {
+		printf("\n\nTotal space used: %ld\n",total_sizes);
+		if (apparent)
+			printf("Total apparent size: %ld (%d%% allocated)\n",
+			    total_asizes, allocated(total_sizes, total_asizes));
+		if (cnt_inodes) printf("Total inodes: %d\n", total_inodes);
+	}
+} /* render_text */
+
+
+
+ /* Map a -F format name to its OUT_xxx value, -1 if unknown. */
+int
+render_format(name)
+char	*name;
+{
+int	i;
+
+	for (i = 0; formats[i]; i++)
+		if (strcmp(name, formats[i]) == 0)
+			return i;
+	return -1;
+} /* render_format */
+
+
+char *
+render_formatname(fmt)
+int	fmt;
+{
+	return formats[fmt];
+} /* render_formatname */
+
+
+
+ /*
+  * Get ready for output in format fmt.  The streamed formats go out
+  * through a large buffer, so this has to come before anything else
+  * is written to stdout.
+  */
+void
+render_start(fmt)
+int	fmt;
+{
+	format = fmt;
+	if (format == OUT_TEXT)
+		return;
+	setvbuf(stdout, NULL, _IOFBF, OUT_BUFSIZ);
+} /* render_start */
+
+
+ /* CSV starts with its heading, after whatever -V had to say. */
+static void
+put_head(heading)
+char	*heading;
+{
+	if (format == OUT_CSV && !headed)
+		printf("%s\n", heading);
+	headed = TRUE;
+} /* put_head */
+
+
+
+ /*
+  * Write a name as a JSON string body or a CSV field body: both
+  * double up or escape the quote, JSON escapes the rest too.  JSON has
+  * to be UTF-8, so a byte of the name that isn't part of a valid UTF-8
+  * sequence goes out as U+FFFD instead.  The bytes of the name are
+  * otherwise written as they are.
+  */
+static void
+put_name(p)
+char	*p;
+{
+int	len;
+
+	for (; *p; p++) {
+		if (format == OUT_CSV) {
+			if (*p == '"')
+				putchar('"');
+			putchar(*p);
+		}
+		else if (*p == '"' || *p == '\\')
+			printf("\\%c", *p);
+		else if ((unsigned char) *p < ' ')
+			printf("\\u%04x", (unsigned char) *p);
+		else if (format == OUT_JSON && (unsigned char) *p >= 0x80) {
+			if ((len = utf8_len((unsigned char *) p)) == 0)
+				printf("\\ufffd");
+			else {
+				fwrite(p, 1, len, stdout);
+				p += len - 1;
+			}
+		}
+		else putchar(*p);
+	}
+} /* put_name */
+
+
+ /*
+  * The length of the valid UTF-8 sequence p starts with, 0 if it
+  * doesn't start one: no overlong forms, surrogates or code points
+  * past U+10FFFF.
+  */
+static int
+utf8_len(p)
+unsigned char	*p;
+{
+unsigned char	lo = 0x80, hi = 0xbf;	/* the range of the second byte */
+int	len, i;
+
+	if (*p >= 0xc2 && *p <= 0xdf)
+		len = 2;
+	else if (*p >= 0xe0 && *p <= 0xef) {
+		len = 3;
+		if (*p == 0xe0)
+			lo = 0xa0;
+		else if (*p == 0xed)
+			hi = 0x9f;
+	}
+	else if (*p >= 0xf0 && *p <= 0xf4) {
+		len = 4;
+		if (*p == 0xf0)
+			lo = 0x90;
+		else if (*p == 0xf4)
+			hi = 0x8f;
+	}
+	else return 0;
+
+	if (p[1] < lo || p[1] > hi)
+		return 0;
+	for (i = 2; i < len; i++)
+		if (p[i] < 0x80 || p[i] > 0xbf)
+			return 0;
+	return len;
+} /* utf8_len */
+
+
+ /* The path of node n: its parents' names, then its own. */
+static void
+put_path(t, n)
+struct tree	*t;
+int	n;
+{
+int	p = T_NODE(t, n)->parent;
+char	*name;
+
+	if (p != NONE) {
+		put_path(t, p);
+		name = T_NAME(t, p);
+		if (*name == '\0' || name[strlen(name) - 1] != '/')
+			putchar('/');
+	}
+	put_name(T_NAME(t, n));
+} /* put_path */
+
+
+
+ /* The record of directory n, level levels down. */
+static void
+put_dir(t, n, level)
+struct tree	*t;
+int	n, level;
+{
+struct node	*np = T_NODE(t, n);
+
+	if (format == OUT_JSON) {
+		printf("{\"path\":\"");
+		put_path(t, n);
+		printf("\",\"depth\":%d,\"k\":%ld,\"inodes\":%d,"
+		    "\"total_k\":%ld,\"total_inodes\":%ld",
+		    level, np->own + np->files, 1 + np->inodes,
+		    np->total, np->tinodes);
+		printf(",\"unreadable\":%s",
+		    np->flags & N_UNREAD ? "true" : "false");
+		if (apparent)
+			printf(",\"apparent_k\":%ld,\"total_apparent_k\":%ld,"
+			    "\"allocated_pct\":%d", np->aown + np->afiles,
+			    np->atotal, allocated(np->own + np->files,
+			    np->aown + np->afiles));
+		printf("}\n");
+	}
+	else {
+		putchar('"');
+		put_path(t, n);
+		printf("\",%d,%ld,%d,%ld,%ld,%d", level, np->own + np->files,
+		    1 + np->inodes, np->total, np->tinodes,
+		    np->flags & N_UNREAD ? 1 : 0);
+		if (apparent)
+			printf(",%ld,%ld,%d", np->aown + np->afiles, np->atotal,
+			    allocated(np->own + np->files, np->aown + np->afiles));
+		putchar('\n');
+	}
+} /* put_dir */
+
+
+ /*
+  * The walk is done with directory n, level levels down: write its
+  * record.  k and inodes are the directory and the files directly in
+  * it, as on its line of the text display; the totals take in
+  * everything below it as well, and unreadable says the directory
+  * couldn't be opened.  -S adds the apparent sizes of the same two,
+  * and how much of the first is allocated.  Directories below the -h
+  * height are only part of the totals.
+  */
+void
+render_dir(t, n, level)
+struct tree	*t;
+int	n, level;
+{
+	if (format == OUT_TEXT || level >= depth)
+		return;
+	put_head(apparent ? APP_HEAD : DIR_HEAD);
+	put_dir(t, n, level);
+} /* render_dir */
+
+
+
+ /*
+  * The walk is over.  The text displays are made now; the streamed
+  * formats have been written already and just need flushing.
+  */
+void
+render_end(t)
+struct tree	*t;
+{
+	if (format == OUT_TEXT)
+		render_text(t);
+	else {
+		put_head(apparent ? APP_HEAD : DIR_HEAD);
+		fflush(stdout);
+	}
+} /* render_end */
+
+
+
+ /* Directory n's records, subdirectories first, as the walk gave them. */
+static void
+put_dirs(t, n, level)
+struct tree	*t;
+int	n, level;
+{
+int	c;
+
+	for (c = T_NODE(t, n)->child; c != NONE; c = T_NODE(t, c)->next)
+		put_dirs(t, c, level + 1);
+	render_dir(t, n, level);
+} /* put_dirs */
+
+
+ /*
+  * The whole output over again, from the tree as it is now, for -W.
+  * The streamed formats come out in the order the walk would have
+  * written them.
+  */
+void
+render_tree(t)
+struct tree	*t;
+{
+int	n;
+
+	if (format != OUT_TEXT)
+		for (n = t->root; n != NONE; n = T_NODE(t, n)->next)
+			put_dirs(t, n, 0);
+	render_end(t);
+	fflush(stdout);
+} /* render_tree */
+
+
+ /*
+  * Just directory n, for a -W query: its path and totals, everything
+  * below it included, or its record.
+  */
+void
+render_node(t, n)
+struct tree	*t;
+int	n;
+{
+struct node	*np = T_NODE(t, n);
+
+	if (format == OUT_TEXT) {
+		put_path(t, n);
+		if (cnt_inodes)
+			printf("   %ld", np->tinodes);
+		put_sizes(np->total, np->atotal);
+	}
+	else {
+		put_head(apparent ? APP_HEAD : DIR_HEAD);
+		put_dir(t, n, t_level(t, n));
+	}
+	fflush(stdout);
+} /* render_node */
+
+
+
+ /* One top list, largest first. */
+static void
+put_top(t, tp, type)
+struct tree	*t;
+struct topn	*tp;
+char	*type;
+{
+struct topent	*e;
+char	*name;
+int	i;
+
+	top_sort(tp);
+	for (i = 0; i < tp->count; i++) {
+		e = &tp->ents[i];
+		if (format == OUT_JSON)
+			printf("{\"type\":\"%s\",\"k\":%ld,\"path\":\"", type, e->k);
+		else if (format == OUT_CSV)
+			printf("%s,%ld,\"", type, e->k);
+		else printf("%10ld  ", e->k);
+		put_path(t, e->node);
+		if (e->name) {
+			name = T_NAME(t, e->node);
+			if (*name == '\0' || name[strlen(name) - 1] != '/')
+				putchar('/');
+			put_name(e->name);
+		}
+		if (format == OUT_JSON)
+			printf("\"}\n");
+		else if (format == OUT_CSV)
+			printf("\"\n");
+		else putchar('\n');
+	}
+} /* put_top */
+
+
+
+ /*
+  * --top: the largest directories (counting everything below them)
+  * and, if files is not NULL, the largest files, instead of the usual
+  * output.  In text the two lists are separated by a blank line.
+  */
+void
+render_top(t, dirs, files)
+struct tree	*t;
+struct topn	*dirs, *files;
+{
+	put_head("type,k,path");
+	put_top(t, dirs, "dir");
+	if (files) {
+		if (format == OUT_TEXT)
+			putchar('\n');
+		put_top(t, files, "file");
+	}
+	fflush(stdout);
+} /* render_top */
+
+
+
+ /*
+  * One row of a histogram.  Text puts the modification and access
+  * ages (b and b2) side by side; the other formats give each its own
+  * record.
+  */
+static void
+put_bucket(t, n, kind, name, b, b2)
+struct tree	*t;
+int	n;
+char	*kind, *name;
+struct hbucket	*b, *b2;
+{
+	if (format == OUT_TEXT) {
+		printf("   %-10s %10ld %10ld", name, b->files, b->k);
+		if (b2)
+			printf(" %10ld %10ld", b2->files, b2->k);
+		putchar('\n');
+		return;
+	}
+	if (format == OUT_JSON) {
+		printf("{\"path\":\"");
+		put_path(t, n);
+		printf("\",\"kind\":\"%s\",\"bucket\":\"%s\","
+		    "\"files\":%ld,\"k\":%ld}\n", kind, name, b->files, b->k);
+	}
+	else {
+		putchar('"');
+		put_path(t, n);
+		printf("\",%s,%s,%ld,%ld\n", kind, name, b->files, b->k);
+	}
+	if (b2)
+		put_bucket(t, n, "atime", name, b2, NULL);
+} /* put_bucket */
+
+
+
+ /*
+  * -A: the size and age histograms of top level directory n, the
+  * files in it and everything below it.
+  */
+void
+render_hist(t, n, h)
+struct tree	*t;
+int	n;
+struct hist	*h;
+{
+int	i;
+
+	put_head("path,kind,bucket,files,k");
+	if (format == OUT_TEXT) {
+		put_path(t, n);
+		printf("\n   %-10s %10s %10s\n", "size", "files", "K");
+	}
+	for (i = 0; i < H_SIZES; i++)
+		put_bucket(t, n, "size", hist_sizename(i), &h->sizes[i], NULL);
+	if (format == OUT_TEXT)
+		printf("   %-10s %10s %10s %10s %10s\n",
+		    "age (days)", "modified", "K", "accessed", "K");
+	for (i = 0; i < H_AGES; i++)
+		put_bucket(t, n, "mtime", hist_agename(i), &h->ages[H_MTIME][i],
+		    &h->ages[H_ATIME][i]);
+	if (format == OUT_TEXT)
+		putchar('\n');
+} /* render_hist */
+
+
+
+ /*
+  * -D: the space and inodes on each device, largest first, with where
+  * it's mounted if that can be found.
+  */
+void
+render_devs(dt)
+struct devtab	*dt;
+{
+struct devtot	*d;
+char	*mount;
+int	i;
+
+	dv_sort(dt);
+	put_head("device,mount,k,inodes");
+	if (format == OUT_TEXT)
+		printf("%-10s %-30s %10s %10s\n", "device", "mount", "K", "inodes");
+	for (i = 0; i < dt->count; i++) {
+		d = &dt->devs[i];
+		if ((mount = dv_mount(d->dev)) == NULL)
+			mount = "";
+		if (format == OUT_JSON) {
+			printf("{\"device\":\"%s\",\"mount\":\"", dv_name(d->dev));
+			put_name(mount);
+			printf("\",\"k\":%ld,\"inodes\":%ld}\n", d->k, d->inodes);
+		}
+		else if (format == OUT_CSV) {
+			printf("%s,\"", dv_name(d->dev));
+			put_name(mount);
+			printf("\",%ld,%ld\n", d->k, d->inodes);
+		}
+		else printf("%-10s %-30s %10ld %10ld\n", dv_name(d->dev), mount,
+		    d->k, d->inodes);
+	}
+	fflush(stdout);
+} /* render_devs */
+
+
+
+ /*
+  * -C: the directories holding copies of files found elsewhere, the
+  * most space to be reclaimed first, then what it comes to in all.
+  */
+void
+render_dups(t, dt, dirs, n)
+struct tree	*t;
+struct duptab	*dt;
+struct dupdir	*dirs;
+int	n;
+{
+struct dupdir	*d;
+int	i;
+
+	put_head("path,k,copies");
+	if (format == OUT_TEXT)
+		printf("%10s %8s  %s\n", "K", "copies", "directory");
+	for (i = 0; i < n; i++) {
+		d = &dirs[i];
+		if (format == OUT_JSON)
+			printf("{\"path\":\"");
+		else if (format == OUT_CSV)
+			putchar('"');
+		else printf("%10ld %8d  ", d->k, d->copies);
+		put_path(t, d->node);
+		if (format == OUT_JSON)
+			printf("\",\"k\":%ld,\"copies\":%d}\n", d->k, d->copies);
+		else if (format == OUT_CSV)
+			printf("\",%ld,%d\n", d->k, d->copies);
+		else putchar('\n');
+	}
+	if (format == OUT_TEXT)
+		printf("\nReclaimable: %ld K in %d copies of %d files\n",
+		    dt->k, dt->copies, dt->groups);
+	fflush(stdout);
+} /* render_dups */
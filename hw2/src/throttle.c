@@ -0,0 +1,172 @@
+/* throttle.c
+
+ * Self-throttling for vtree, so a scan of a shared file server leaves
+ * some metadata operations for everybody else.  th_begin takes a token
+ * from the bucket (sleeping for one if need be) and th_end notes how
+ * long the operation took.  The rate is adjusted additive-increase,
+ * multiplicative-decrease on a running average of those times: halved
+ * when the average gets slow, raised by a tenth of the limit when it
+ * isn't, never above the -r limit.
+ *
+ * th_background is the nice/ionice part: lowest CPU priority and, on
+ * Linux, the idle I/O class.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "throttle.h"
+
+#ifdef LINUX
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define IOPRIO_WHO_PROCESS	1	/* from linux/ioprio.h */
+#define IOPRIO_CLASS_IDLE	3
+#define IOPRIO_CLASS_SHIFT	13
+#endif
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static double   limit;		/* -r, 0 if not throttling */
+static double   rate;		/* what the rate is backed off to */
+static double   tokens;		/* in the bucket */
+static double   filled;		/* when the bucket was last topped up */
+static double   avg;		/* running average latency, seconds */
+static double   best;		/* shortest seen */
+static double   adjusted;	/* when the rate was last changed */
+
+static double now(void);
+static void adjust(double t);
+
+
+static double
+now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+ /* Throttle to 'ops' operations a second, 0 for no throttling. */
+void
+th_init(ops)
+    double          ops;
+{
+    limit = rate = ops;
+    tokens = TH_BURST(ops);
+    filled = adjusted = now();
+    avg = best = 0;
+}
+
+
+ /* Be as nice to the rest of the system as we can. */
+void
+th_background()
+{
+    if (setpriority(PRIO_PROCESS, 0, 19) < 0)
+	perror("setpriority");
+#ifdef LINUX
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+		IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) < 0)
+	perror("ioprio_set");
+#endif
+}
+
+
+ /*
+  * Wait for a token, if throttling.  Returns the time to hand to
+  * th_end once the operation is done.
+  */
+double
+th_begin()
+{
+    struct timespec ts;
+    double          t, wait;
+
+    if (limit <= 0)
+	return 0;
+    pthread_mutex_lock(&lock);
+    for (;;) {
+	t = now();
+	tokens += (t - filled) * rate;
+	if (tokens > TH_BURST(rate))
+	    tokens = TH_BURST(rate);
+	filled = t;
+	if (tokens >= 1)
+	    break;
+	wait = (1 - tokens) / rate;
+	ts.tv_sec = (time_t) wait;
+	ts.tv_nsec = (long) ((wait - ts.tv_sec) * 1e9);
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+    }
+    tokens--;
+    pthread_mutex_unlock(&lock);
+    return t;
+}
+
+
+ /* Move the rate up or down, now and then. */
+static void
+adjust(t)
+    double          t;
+{
+    if (t - adjusted < TH_ADJUST)
+	return;
+    adjusted = t;
+    if (avg > TH_SLOW * best && avg > TH_MINLAT) {
+	rate /= 2;
+	if (rate < TH_MINRATE)
+	    rate = TH_MINRATE < limit ? TH_MINRATE : limit;
+    } else if (rate < limit) {
+	rate += limit / 10;
+	if (rate > limit)
+	    rate = limit;
+    }
+}
+
+
+ /* An operation begun at t0 is done: note how long it took. */
+void
+th_end(t0)
+    double          t0;
+{
+    th_endn(t0, 1);
+}
+
+
+ /*
+  * n operations begun together at t0 are done, as for a batch through
+  * the ring: note the time each one took, on average.
+  */
+void
+th_endn(t0, n)
+    double          t0;
+    int             n;
+{
+    double          t, lat;
+
+    if (limit <= 0)
+	return;
+    t = now();
+    lat = (t - t0) / n;
+    pthread_mutex_lock(&lock);
+    if (best == 0 || lat < best)
+	best = lat;
+    avg = avg == 0 ? lat : avg + (lat - avg) / 8;
+    adjust(t);
+    pthread_mutex_unlock(&lock);
+}
+
+
+ /* The rate as it stands now, for -VV. */
+double
+th_rate()
+{
+    return rate;
+}
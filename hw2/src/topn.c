@@ -0,0 +1,152 @@
+/* topn.c
+
+ * Top-N lists for vtree's --top mode.  Each list is a binary min-heap
+ * of at most N entries: an entry smaller than the heap's root can't
+ * make the list and costs one comparison, a larger one replaces the
+ * root and sinks into place.  A walk over n entries is O(n log N)
+ * time and O(N) space, however big the tree is.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "topn.h"
+
+static void top_down(struct topn *tp, int i);
+static void top_up(struct topn *tp, int i);
+static int by_size(const void *a, const void *b);
+
+
+ /* Start an empty list that keeps the 'max' largest entries. */
+void
+top_init(tp, max)
+    struct topn    *tp;
+    int             max;
+{
+    memset((char *) tp, '\0', sizeof(*tp));
+    tp->max = max;
+    if (max > 0 && (tp->ents = malloc(max * sizeof(struct topent))) == NULL) {
+	perror("can't make top list");
+	tp->max = 0;
+    }
+}
+
+
+ /* Sift entry i down to where its children aren't smaller. */
+static void
+top_down(tp, i)
+    struct topn    *tp;
+    int             i;
+{
+    struct topent   e = tp->ents[i];
+    int             c;
+
+    while ((c = 2 * i + 1) < tp->count) {
+	if (c + 1 < tp->count && tp->ents[c + 1].k < tp->ents[c].k)
+	    c++;
+	if (tp->ents[c].k >= e.k)
+	    break;
+	tp->ents[i] = tp->ents[c];
+	i = c;
+    }
+    tp->ents[i] = e;
+}
+
+
+ /* Sift entry i up to where its parent isn't larger. */
+static void
+top_up(tp, i)
+    struct topn    *tp;
+    int             i;
+{
+    struct topent   e = tp->ents[i];
+    int             p;
+
+    while (i > 0 && tp->ents[p = (i - 1) / 2].k > e.k) {
+	tp->ents[i] = tp->ents[p];
+	i = p;
+    }
+    tp->ents[i] = e;
+}
+
+
+ /*
+  * Offer an entry of size k.  A file's name is copied only if it
+  * makes the list.  Returns 1 if it did, 0 if not.
+  */
+int
+top_add(tp, k, node, name)
+    struct topn    *tp;
+    long            k;
+    int             node;
+    char           *name;
+{
+    char           *copy = NULL;
+    int             i;
+
+    if (tp->count == tp->max && (tp->max == 0 || k <= tp->ents[0].k))
+	return 0;
+    if (name && (copy = strdup(name)) == NULL)
+	return 0;
+
+    if (tp->count < tp->max) {
+	i = tp->count++;
+	tp->ents[i].k = k;
+	tp->ents[i].node = node;
+	tp->ents[i].name = copy;
+	top_up(tp, i);
+    } else {
+	free(tp->ents[0].name);
+	tp->ents[0].k = k;
+	tp->ents[0].node = node;
+	tp->ents[0].name = copy;
+	top_down(tp, 0);
+    }
+    return 1;
+}
+
+
+ /*
+  * Largest first; ties go in the order the walk met the directories,
+  * then by file name.
+  */
+static int
+by_size(a, b)
+    const void     *a, *b;
+{
+    const struct topent *x = a, *y = b;
+
+    if (x->k != y->k)
+	return x->k < y->k ? 1 : -1;
+    if (x->node != y->node)
+	return x->node < y->node ? -1 : 1;
+    if (x->name && y->name)
+	return strcmp(x->name, y->name);
+    return 0;
+}
+
+
+ /*
+  * Put the list in order, largest first, for printing.  It's no
+  * longer a heap after this.
+  */
+void
+top_sort(tp)
+    struct topn    *tp;
+{
+    qsort(tp->ents, tp->count, sizeof(struct topent), by_size);
+}
+
+
+ /* Give back the list's memory. */
+void
+top_free(tp)
+    struct topn    *tp;
+{
+    int             i;
+
+    for (i = 0; i < tp->count; i++)
+	free(tp->ents[i].name);
+    free(tp->ents);
+    memset((char *) tp, '\0', sizeof(*tp));
+}
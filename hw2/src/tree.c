@@ -0,0 +1,336 @@
+/* tree.c
+
+ * The in-memory directory tree built by the vtree walk.  Nodes are
+ * appended to a growing array in the order the walk reaches them, so
+ * a parent always comes before its subdirectories, and each node's
+ * subdirectories are chained in the order they were read (until
+ * t_sort puts them in order of size).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tree.h"
+
+#define T_NODES		1024	/* initial node slots */
+#define T_NAMES		(16 * 1024)	/* initial name arena */
+
+
+ /* Start an empty tree. */
+void
+t_init(t)
+    struct tree    *t;
+{
+    memset((char *) t, '\0', sizeof(*t));
+    t->root = t->lastroot = NONE;
+}
+
+
+ /*
+  * Add a node named 'name' as the last subdirectory of 'parent', or
+  * as the last top level node if parent is NONE.  Returns its index,
+  * or NONE if there's no memory.  Node pointers don't survive this
+  * call; indices do.
+  */
+int
+t_add(t, parent, name)
+    struct tree    *t;
+    int             parent;
+    char           *name;
+{
+    struct node    *np;
+    size_t          len = strlen(name) + 1, size;
+    char           *names;
+    int             n;
+
+    if (t->count == t->max) {
+	np = realloc(t->nodes, (t->max ? t->max * 2 : T_NODES)
+		     * sizeof(struct node));
+	if (np == NULL) {
+	    perror("can't grow directory tree");
+	    return NONE;
+	}
+	t->nodes = np;
+	t->max = t->max ? t->max * 2 : T_NODES;
+    }
+    if (t->used + len > t->size) {
+	for (size = t->size ? t->size * 2 : T_NAMES; t->used + len > size;)
+	    size *= 2;
+	if ((names = realloc(t->names, size)) == NULL) {
+	    perror("can't grow directory tree");
+	    return NONE;
+	}
+	t->names = names;
+	t->size = size;
+    }
+
+    n = t->count++;
+    np = &t->nodes[n];
+    memset((char *) np, '\0', sizeof(*np));
+    np->parent = parent;
+    np->child = np->last = np->next = NONE;
+    np->name = t->used;
+    memcpy(t->names + t->used, name, len);
+    t->used += len;
+
+    if (parent == NONE) {
+	if (t->root == NONE)
+	    t->root = n;
+	else
+	    t->nodes[t->lastroot].next = n;
+	t->lastroot = n;
+    } else {
+	if (t->nodes[parent].child == NONE)
+	    t->nodes[parent].child = n;
+	else
+	    t->nodes[t->nodes[parent].last].next = n;
+	t->nodes[parent].last = n;
+	t->nodes[parent].nchild++;
+    }
+    return n;
+}
+
+
+ /*
+  * The walk is done with node n and everything below it: add up its
+  * totals.  Its subdirectories are done already, so theirs are there.
+  */
+void
+t_done(t, n)
+    struct tree    *t;
+    int             n;
+{
+    struct node    *np = &t->nodes[n];
+    int             c;
+
+    np->total = np->own + np->files;
+    np->tinodes = 1 + np->inodes;
+    np->atotal = np->aown + np->afiles;
+    for (c = np->child; c != NONE; c = t->nodes[c].next) {
+	np->total += t->nodes[c].total;
+	np->tinodes += t->nodes[c].tinodes;
+	np->atotal += t->nodes[c].atotal;
+    }
+}
+
+
+ /* The subdirectory of n called name, or NONE. */
+int
+t_child(t, n, name)
+    struct tree    *t;
+    int             n;
+    char           *name;
+{
+    int             c;
+
+    for (c = t->nodes[n].child; c != NONE; c = t->nodes[c].next)
+	if (strcmp(T_NAME(t, c), name) == 0)
+	    return c;
+    return NONE;
+}
+
+
+ /*
+  * Take node n (and so everything below it) out of its parent's list
+  * of subdirectories.  The nodes keep their slots, marked N_GONE, as
+  * indices into the array have to stay good.
+  */
+void
+t_unlink(t, n)
+    struct tree    *t;
+    int             n;
+{
+    struct node    *pp;
+    int             c, prev = NONE;
+
+    t->nodes[n].flags |= N_GONE;
+    if (t->nodes[n].parent == NONE)
+	return;
+    pp = &t->nodes[t->nodes[n].parent];
+    for (c = pp->child; c != NONE && c != n; c = t->nodes[c].next)
+	prev = c;
+    if (c == NONE)
+	return;
+    if (prev == NONE)
+	pp->child = t->nodes[n].next;
+    else
+	t->nodes[prev].next = t->nodes[n].next;
+    if (pp->last == n)
+	pp->last = prev;
+    pp->nchild--;
+}
+
+
+ /* Is n, or a directory above it, out of the tree? */
+int
+t_gone(t, n)
+    struct tree    *t;
+    int             n;
+{
+    for (; n != NONE; n = t->nodes[n].parent)
+	if (t->nodes[n].flags & N_GONE)
+	    return 1;
+    return 0;
+}
+
+
+ /* How far down n is, 0 for a top level node. */
+int
+t_level(t, n)
+    struct tree    *t;
+    int             n;
+{
+    int             level = 0;
+
+    while ((n = t->nodes[n].parent) != NONE)
+	level++;
+    return level;
+}
+
+
+ /*
+  * n or whichever of the nodes above it is directory (dev, ino), or
+  * NONE.  Going down into that directory from n would go round in a
+  * loop.
+  */
+int
+t_loop(t, n, dev, ino)
+    struct tree    *t;
+    int             n;
+    dev_t           dev;
+    ino_t           ino;
+{
+    for (; n != NONE; n = t->nodes[n].parent)
+	if (t->nodes[n].ino == ino && t->nodes[n].dev == dev)
+	    return n;
+    return NONE;
+}
+
+
+ /*
+  * Put the path of node n, its parents' names then its own, into buf.
+  * Returns -1 if it won't fit.
+  */
+int
+t_path(t, n, buf, size)
+    struct tree    *t;
+    int             n;
+    char           *buf;
+    size_t          size;
+{
+    char           *name = T_NAME(t, n);
+    size_t          len;
+
+    if (t->nodes[n].parent == NONE)
+	len = 0;
+    else {
+	if (t_path(t, t->nodes[n].parent, buf, size) < 0)
+	    return -1;
+	len = strlen(buf);
+	if (len == 0 || buf[len - 1] != '/') {
+	    if (len + 1 >= size)
+		return -1;
+	    buf[len++] = '/';
+	}
+    }
+    if (len + strlen(name) >= size)
+	return -1;
+    strcpy(buf + len, name);
+    return 0;
+}
+
+
+ /*
+  * The node whose path (as t_path would give it) is path, or NONE.
+  * Extra slashes between the names are allowed.
+  */
+int
+t_find(t, path)
+    struct tree    *t;
+    char           *path;
+{
+    char           *name, *p;
+    size_t          len;
+    int             n, c;
+
+    for (n = t->root; n != NONE; n = t->nodes[n].next) {
+	name = T_NAME(t, n);
+	len = strlen(name);
+	if (strncmp(path, name, len) != 0)
+	    continue;
+	p = path + len;
+	if (*p != '\0' && *p != '/' && (len == 0 || name[len - 1] != '/'))
+	    continue;
+	for (c = n; c != NONE;) {
+	    while (*p == '/')
+		p++;
+	    if (*p == '\0')
+		return c;
+	    len = strcspn(p, "/");
+	    for (c = t->nodes[c].child; c != NONE; c = t->nodes[c].next)
+		if (strlen(T_NAME(t, c)) == len
+		    && strncmp(T_NAME(t, c), p, len) == 0)
+		    break;
+	    p += len;
+	}
+    }
+    return NONE;
+}
+
+
+ /* t_sort's qsort comparison: the larger total first, then by name. */
+static struct tree *sorting;
+
+static int
+by_total(a, b)
+    const void     *a, *b;
+{
+    struct node    *x = &sorting->nodes[*(const int *) a];
+    struct node    *y = &sorting->nodes[*(const int *) b];
+
+    if (x->total != y->total)
+	return x->total > y->total ? -1 : 1;
+    return strcmp(sorting->names + x->name, sorting->names + y->name);
+}
+
+
+ /*
+  * Put the subdirectories of n, and theirs in turn, in order of their
+  * totals, largest first.  t_done must have run.  If there's no memory
+  * for a list of them, a level keeps the order it had.
+  */
+void
+t_sort(t, n)
+    struct tree    *t;
+    int             n;
+{
+    struct node    *np = &t->nodes[n];
+    int            *kids, c, i;
+
+    if (np->nchild > 1 && (kids = malloc(np->nchild * sizeof(int))) != NULL) {
+	for (i = 0, c = np->child; c != NONE && i < np->nchild;
+	     c = t->nodes[c].next)
+	    kids[i++] = c;
+	sorting = t;
+	qsort(kids, i, sizeof(int), by_total);
+	np->child = kids[0];
+	for (c = 1; c < i; c++)
+	    t->nodes[kids[c - 1]].next = kids[c];
+	t->nodes[kids[i - 1]].next = NONE;
+	np->last = kids[i - 1];
+	free(kids);
+    }
+    for (c = np->child; c != NONE; c = t->nodes[c].next)
+	t_sort(t, c);
+}
+
+
+ /* Give back the tree's memory, leaving it empty. */
+void
+t_free(t)
+    struct tree    *t;
+{
+    free(t->nodes);
+    free(t->names);
+    t_init(t);
+}
@@ -0,0 +1,316 @@
+/* uring.c
+
+ * A minimal io_uring for batched statx(2), spoken to with the raw
+ * io_uring_setup/io_uring_enter system calls so that no liburing is
+ * needed.  The submission and completion rings are mapped once when
+ * the ring is opened; a batch is at most one ring's worth of requests,
+ * submitted and waited for with a single io_uring_enter.
+ *
+ * If the kernel has no io_uring (or it's been turned off), ur_open
+ * returns NULL and the caller stays with plain stat(2).  The same goes
+ * for builds without -DURING.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "uring.h"
+
+#if defined(LINUX) && defined(URING)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+
+#ifndef AT_STATX_SYNC_AS_STAT
+#define AT_STATX_SYNC_AS_STAT	0
+#endif
+
+struct uring {
+    int             fd;
+    unsigned        entries;	/* submission queue size */
+    unsigned       *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned       *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void           *sq_map, *cq_map;
+    size_t          sq_len, cq_len, sqes_len;
+    struct statx   *bufs;	/* one per request in a batch */
+    int             lost;	/* requests may still be in flight */
+};
+
+static void ur_tostat(struct statx *sx, struct stat *st);
+static void ur_drain(struct uring *u, unsigned inflight);
+
+
+ /*
+  * Set up a ring with room for 'depth' requests at a time.  Returns
+  * NULL if io_uring isn't there to be had.
+  */
+struct uring   *
+ur_open(depth)
+    unsigned        depth;
+{
+    struct io_uring_params p;
+    struct uring   *u;
+
+    if ((u = calloc(1, sizeof(*u))) == NULL)
+	return NULL;
+    memset((char *) &p, '\0', sizeof(p));
+    if ((u->fd = syscall(__NR_io_uring_setup, depth, &p)) < 0) {
+	free(u);
+	return NULL;
+    }
+    u->entries = p.sq_entries;
+
+    u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	if (u->cq_len > u->sq_len)
+	    u->sq_len = u->cq_len;
+	u->cq_len = u->sq_len;
+    }
+    u->sq_map = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_map == MAP_FAILED)
+	goto bad;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+	u->cq_map = u->sq_map;
+    else {
+	u->cq_map = mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+	if (u->cq_map == MAP_FAILED) {
+	    u->cq_map = NULL;
+	    goto bad;
+	}
+    }
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+	u->sqes = NULL;
+	goto bad;
+    }
+
+    u->sq_head = (unsigned *) ((char *) u->sq_map + p.sq_off.head);
+    u->sq_tail = (unsigned *) ((char *) u->sq_map + p.sq_off.tail);
+    u->sq_mask = (unsigned *) ((char *) u->sq_map + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *) ((char *) u->sq_map + p.sq_off.array);
+    u->cq_head = (unsigned *) ((char *) u->cq_map + p.cq_off.head);
+    u->cq_tail = (unsigned *) ((char *) u->cq_map + p.cq_off.tail);
+    u->cq_mask = (unsigned *) ((char *) u->cq_map + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *) ((char *) u->cq_map + p.cq_off.cqes);
+
+    if ((u->bufs = malloc(u->entries * sizeof(struct statx))) == NULL)
+	goto bad;
+    return u;
+
+bad:
+    if (u->sq_map == MAP_FAILED)
+	u->sq_map = NULL;
+    ur_close(u);
+    return NULL;
+}
+
+
+ /* What stat(2) would have said, as far as vtree cares. */
+static void
+ur_tostat(sx, st)
+    struct statx   *sx;
+    struct stat    *st;
+{
+    memset((char *) st, '\0', sizeof(*st));
+    st->st_dev = makedev(sx->stx_dev_major, sx->stx_dev_minor);
+    st->st_ino = sx->stx_ino;
+    st->st_mode = sx->stx_mode;
+    st->st_nlink = sx->stx_nlink;
+    st->st_uid = sx->stx_uid;
+    st->st_gid = sx->stx_gid;
+    st->st_rdev = makedev(sx->stx_rdev_major, sx->stx_rdev_minor);
+    st->st_size = sx->stx_size;
+    st->st_blksize = sx->stx_blksize;
+    st->st_blocks = sx->stx_blocks;
+    st->st_atim.tv_sec = sx->stx_atime.tv_sec;
+    st->st_atim.tv_nsec = sx->stx_atime.tv_nsec;
+    st->st_mtim.tv_sec = sx->stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = sx->stx_mtime.tv_nsec;
+    st->st_ctim.tv_sec = sx->stx_ctime.tv_sec;
+    st->st_ctim.tv_nsec = sx->stx_ctime.tv_nsec;
+}
+
+
+ /*
+  * stat (or, with nofollow, lstat) the n names, relative to the current
+  * directory, into sts.  rcs[i] gets 0, or -errno if names[i] couldn't
+  * be stat'ed.  Returns -1 if the ring itself fails, with nothing of
+  * the batch left in flight; the caller should then stat them the
+  * ordinary way.
+  */
+int
+ur_statv(u, names, n, nofollow, sts, rcs)
+    struct uring   *u;
+    char          **names;
+    int             n;
+    int             nofollow;
+    struct stat    *sts;
+    int            *rcs;
+{
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    unsigned        tail, head, idx, batch, j, submitted, reaped;
+    int             i, ret;
+
+    for (i = 0; i < n; i += batch) {
+	batch = n - i < (int) u->entries ? n - i : u->entries;
+
+	/* Fill in the batch's requests, then let the kernel see them. */
+	tail = *u->sq_tail;
+	for (j = 0; j < batch; j++) {
+	    idx = (tail + j) & *u->sq_mask;
+	    sqe = &u->sqes[idx];
+	    memset((char *) sqe, '\0', sizeof(*sqe));
+	    sqe->opcode = IORING_OP_STATX;
+	    sqe->fd = AT_FDCWD;
+	    sqe->addr = (unsigned long) names[i + j];
+	    sqe->len = STATX_BASIC_STATS;
+	    sqe->off = (unsigned long) &u->bufs[j];
+	    sqe->statx_flags = AT_STATX_SYNC_AS_STAT
+		| (nofollow ? AT_SYMLINK_NOFOLLOW : 0);
+	    sqe->user_data = j;
+	    u->sq_array[idx] = idx;
+	}
+	__atomic_store_n(u->sq_tail, tail + batch, __ATOMIC_RELEASE);
+
+	/* Submit them all and wait for them all, usually in one go. */
+	for (submitted = reaped = 0; reaped < batch;) {
+	    ret = syscall(__NR_io_uring_enter, u->fd, batch - submitted,
+			  batch - reaped, IORING_ENTER_GETEVENTS, NULL, 0);
+	    if (ret < 0) {
+		if (errno == EINTR)
+		    continue;
+		ur_drain(u, submitted - reaped);
+		return -1;
+	    }
+	    submitted += ret;
+
+	    head = *u->cq_head;
+	    while (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = &u->cqes[head & *u->cq_mask];
+		j = cqe->user_data;
+		rcs[i + j] = cqe->res < 0 ? cqe->res : 0;
+		if (cqe->res >= 0)
+		    ur_tostat(&u->bufs[j], &sts[i + j]);
+		head++;
+		reaped++;
+	    }
+	    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+	}
+    }
+    return 0;
+}
+
+
+ /*
+  * The ring failed partway through a batch.  Take back the requests
+  * the kernel hasn't taken (without SQPOLL nothing else moves the
+  * head), and wait for the ones it has, so that none of them writes
+  * into bufs or reads a name after ur_statv has returned.  If even
+  * waiting fails, the ring is marked lost and ur_close leaves bufs be.
+  */
+static void
+ur_drain(u, inflight)
+    struct uring   *u;
+    unsigned        inflight;
+{
+    unsigned        head;
+
+    __atomic_store_n(u->sq_tail, __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE),
+		     __ATOMIC_RELEASE);
+    for (;;) {
+	head = *u->cq_head;
+	while (inflight > 0 && head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+	    head++;
+	    inflight--;
+	}
+	__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+	if (inflight == 0)
+	    return;
+	if (syscall(__NR_io_uring_enter, u->fd, 0, inflight,
+		    IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+	    u->lost = 1;
+	    return;
+	}
+    }
+}
+
+
+ /* How many requests go out at a time. */
+unsigned
+ur_depth(u)
+    struct uring   *u;
+{
+    return u->entries;
+}
+
+
+ /* Take the ring down. */
+void
+ur_close(u)
+    struct uring   *u;
+{
+    if (u == NULL)
+	return;
+    if (u->sqes)
+	munmap(u->sqes, u->sqes_len);
+    if (u->cq_map && u->cq_map != u->sq_map)
+	munmap(u->cq_map, u->cq_len);
+    if (u->sq_map)
+	munmap(u->sq_map, u->sq_len);
+    close(u->fd);
+    if (!u->lost)
+	free(u->bufs);
+    free(u);
+}
+
+#else				/* no io_uring: always the fallback */
+
+struct uring   *
+ur_open(depth)
+    unsigned        depth;
+{
+    return NULL;
+}
+
+int
+ur_statv(u, names, n, nofollow, sts, rcs)
+    struct uring   *u;
+    char          **names;
+    int             n;
+    int             nofollow;
+    struct stat    *sts;
+    int            *rcs;
+{
+    return -1;
+}
+
+unsigned
+ur_depth(u)
+    struct uring   *u;
+{
+    return 0;
+}
+
+void
+ur_close(u)
+    struct uring   *u;
+{
+}
+
+#endif
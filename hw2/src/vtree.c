@@ -67,10 +67,29 @@
 #endif
 
 #include <unistd.h>
+#include <fcntl.h>
 //
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
 
 #include "hash.h"
 #include "customize.h"
+#include "vtree.h"
+#include "tree.h"
+#include "render.h"
+#include "topn.h"
+#include "hist.h"
+#include "throttle.h"
+#include "devs.h"
+#include "watch.h"
+#include "filter.h"
+#include "dups.h"
+#include "dirlist.h"
+#ifdef	MEMORY_BASED
+#include "cache.h"
+#include "uring.h"
+#endif
 
 #ifdef	SYS_III
 	#define	rewinddir(fp)	rewind(fp)
@@ -83,38 +102,30 @@
 					 * k's.  On my machine, a block
 					 * is 512 bytes. */
 
-#define	TRUE	1
-#define	FALSE	0
-#define	V_CHAR	"|"	/*	Vertical character	*/
-#define	H_CHAR	"-"	/*	Horizontal character	*/
-#define	A_CHAR	">"	/*	Arrow char		*/
-#define	T_CHAR	"+"	/*	Tee char		*/
-#define	L_CHAR	"\\"	/*	L char, bottom of a branch	*/
-
-#define	MAX_COL_WIDTH	15
-#define	MAX_V_DEPTH	256		/* max depth for visual display */
-
-#ifdef	MEMORY_BASED
-struct RD_list {
-	READ		entry;
-	struct RD_list	*fptr;
-	struct RD_list	*bptr;
-};
-#endif
-
-int		indent = 0,		/* current indent */
-		depth = 9999,		/* max depth */
+int		depth = 9999,		/* max depth */
 		cur_depth = 0,
 		sum = FALSE,		/* sum the subdirectories */
 		dup_inodes = FALSE,		/* use duplicate inodes */
 		floating = FALSE,	/* floating column widths */
 		sort = FALSE,
+		sort_key = 0,		/* SORT_xxx key for -o */
 		cnt_inodes = FALSE,	/* count inodes */
 		quick = FALSE,		/* quick display */
 		visual = FALSE,		/* visual display */
 		version = 0,		/* = 1 display version, = 2 show options */
-		sub_dirs[MAX_V_DEPTH],
-		sub_dirs_indents[MAX_V_DEPTH];
+		out_format = OUT_TEXT,	/* -F output format */
+		top_n = 0,		/* --top N: list the N largest only */
+		top_files = FALSE,	/* and the N largest files too */
+		histo = FALSE,		/* -A size and age histograms */
+		per_file = FALSE,	/* something wants each file seen */
+		background = FALSE,	/* -b nice and idle I/O */
+		one_fs = FALSE,		/* -x stay on the argument's device */
+		dev_totals = FALSE,	/* -D totals per device */
+		apparent = FALSE,	/* -S apparent sizes too */
+		by_total = FALSE,	/* -k size: subdirectories by total */
+		watching = FALSE,	/* -W keep the tree up to date */
+		copies = FALSE;		/* -C files with the same contents */
+double		op_rate = 0;		/* -r stats etc. a second, 0 = no limit */
 
 struct	stat	stb;			/* Normally not a good idea, but */
 					/* this structure is used through- */
@@ -129,156 +140,127 @@ char           *Program;		/* our name */
 short           sw_follow_links = 1;	/* follow symbolic links */
 short           sw_summary;		/* print Grand Total line */
 
-int             total_inodes, inodes;	/* inode count */
-long            total_sizes, sizes;	/* block count */
+struct tree     tree;			/* what the walk has seen */
+struct topn     top_dirs, top_fl;	/* the --top lists */
+struct hist     hist;			/* -A, for the argument at hand */
+time_t          now;			/* -A ages are as of this */
+struct devtab   devtab;			/* -D totals */
+struct duptab   duptab;			/* -C files that may have copies */
+dev_t           root_dev;		/* device of the argument at hand */
 
 char            topdir[NAMELEN];	/* our starting directory */
 
+#ifdef	MEMORY_BASED
+char           *cache_path;		/* -c scan cache file */
+int             uring_depth;		/* -u io_uring queue depth, 0 if none */
+struct hset     cache_dirs;		/* directories read so far */
+#endif
+struct hset     dirs_seen;		/* directories gone down into */
+char            root_real[MAXPATHLEN];	/* where the argument at hand really is */
+
 //Mehdad Zaman added
 #ifdef LINUX
-static char *lastfield(char *p, int c);
-static void down(char *subdir);
-static int chk_4_dir(char *path);
+static void sift(struct dirlist *dl);
+static void down(char *subdir, int np, struct stat *dirst);
+static int	get_stat(char *path, struct stat *st);
 static int	is_directory(char *path);
-static void get_data(char *path, int cont);
+static void add_file(int np, char *name, struct stat *st);
+static void add_dir(char *path, int np, struct stat *st, int linked);
+static int	link_inside(struct dirlist *dl, int n);
+static int	watched_already(struct stat *st);
+static void get_data(char *path, int cont, int np);
+static void rescan(int n);
+static int watch_new(int from);
+static long msecs(void);
+static void watch_tree(void);
 #endif
 //
 
-/*
-** Find the last field of a string.
-*/
-static char *lastfield(p,c)
-char *p;	/* Null-terminated string to scan */
-int   c;	/* Separator char, usually '/' */
-{
-char *r;
 
-	r = p;
-	while (*p)			/* Find the last field of the name */
-		if (*p++ == c)
-			r = p;
-	return r;
-} /* lastfield */
 
+ /*
+  * Drop the entries the exclude patterns rule out, before anything
+  * is stat'ed or opened.
+  */
+
+static void
+sift(dl)
+struct dirlist	*dl;
+{
+int	n, kept;
+
+	if (!fl_excluding())
+		return;
+	for (n = kept = 0; n < dl->count; n++)
+		if (!fl_skip(DL_NAME(dl, n)))
+			dl->ents[kept++] = dl->ents[n];
+	dl->count = kept;
+} /* sift */
 
 
 
  /*
   * We ran into a subdirectory.  Go down into it, and read everything
-  * in there.
+  * in there.  What we find goes into node np of the tree; dirst is the
+  * subdirectory's own stat.  Every entry is stat'ed once: files are
+  * counted from that stat and subdirectories go down with it.
   */
-int	indented = FALSE;	/* These had to be global since they */
-int	last_indent = 0;	/* determine what gets displayed during */
-int	last_subdir = FALSE;	/* the visual display */
 
 //Mehdad Zaman added
 static void
 //
-down(subdir)
+down(subdir, np, dirst)
 char	*subdir;
+int	np;
+struct	stat	*dirst;
 {
+#ifndef	MEMORY_BASED
 OPEN	*dp;			/* stream from a directory */
 OPEN	*opendir ();
-char	cwd[NAMELEN], tmp[NAMELEN];
-char	*sptr;
 READ	*file;			/* directory entry */
 READ	*readdir ();
-int	i, x;
-struct	stat	stb;
-
-//Mehdad Zaman added
-#ifndef LINUX
-	int	chk_4_dir();
-	void get_data();
+double	t0;
 #endif
-//
+char	cwd[NAMELEN];
+char	*name;
+int	n;
+struct	stat	st;		/* stat of the entry at hand */
+struct dirlist	dl;		/* the whole directory, read in one go */
+				/* (disk based: just its subdirectories) */
 
 #ifdef	MEMORY_BASED
-struct RD_list	*head, *tail, *tmp_RD, *tmp1_RD;		/* head and tail of directory list */
-struct RD_list	sz;
-READ		tmp_entry;
+struct crec	*cr = NULL;	/* or what the cache remembers of it */
+struct cbuild	cb;		/* the cache's new record of it */
+int	x, kept;
 #endif
 
 	if ( (cur_depth == depth) && (!sum) )
 		return;
 
-/* display the tree */
-
-	if (cur_depth < depth) {
-		if (visual) {
-			if (!indented) {
-				for (i = 1; i <cur_depth; i++) {
-					if (floating) x = sub_dirs_indents[i] + 1;
-						else x = MAX_COL_WIDTH - 3;
-					if (sub_dirs[i]) {
-						printf("%*s%s   ",x - 1," ",V_CHAR);
-					} else printf("%*s   ",x," ");
-				}
-				if (cur_depth>0) {
-					if (floating) x = sub_dirs_indents[cur_depth] + 1;
-						else x = MAX_COL_WIDTH - 3;
-					if (sub_dirs[cur_depth] == 0) {
-						printf("%*s%s%s%s ",x - 1," ",L_CHAR,H_CHAR,A_CHAR);
-						last_subdir = cur_depth;
-					}
-					else printf("%*s%s%s%s ",x - 1," ",T_CHAR,H_CHAR,A_CHAR);
-				}
-			} else {
-				if (!floating)
-					for (i = 1; i<MAX_COL_WIDTH-last_indent-3; i++)
-						printf("%s",H_CHAR);
-				printf("%s%s%s ",T_CHAR,H_CHAR,A_CHAR);
-			}
-
-	/* This is in case a subdir name is too big.  It is then displayed on
-	** two lines, the first line is the full name, the second line is
-	** truncated.  Any subdirs displayed for the current subdir will be
-	** appended to the second line.  This keeps the columns in order
-	*/
+/* open subdirectory */
 
-#ifndef	ONEPERLINE
-			if (  ( strlen(subdir) > MAX_COL_WIDTH - 3 && !floating )	) {
+	memset((char *) &dl, '\0', sizeof(dl));
+#ifdef	MEMORY_BASED
+	if (cache_path && !per_file &&
+	    (cr = cache_find(dirst, !quick && !visual)) != NULL) {
+		/* unchanged since last time, only the subdirs are needed */
+		/* (the record has no single files, so not for -a or -A) */
+		for (n = 0, name = CR_NAMES(cr); n < cr->nchild;
+		     n++, name += strlen(name) + 1)
+			dl_append(&dl, name, (ino_t) 0, 0);
+	}
+	if (!cr && dl_read(&dl, subdir) < 0) {
 #else
-			if (  ( strlen(subdir) > MAX_COL_WIDTH - 3 && !floating ) ||
-			    lastfield(subdir,'/') != subdir) {
+	t0 = th_begin();
+	dp = opendir(subdir);
+	th_end(t0);
+	if (dp == NULL) {
 #endif
-
-				printf("%s\n",subdir);
-				for (i = 1; i <=cur_depth; i++) {
-					if (sub_dirs[i]) {
-						printf("%*s%s   ",MAX_COL_WIDTH-4," ",V_CHAR);
-					}
-					else printf("%*s   ",MAX_COL_WIDTH-3," ");
-				}
-				strcpy(tmp,lastfield(subdir,'/'));
-				tmp[MAX_COL_WIDTH - 4] = 0;
-				printf("%s",tmp);
-#ifdef	ONEPERLINE
-				if (floating || strlen(tmp) < MAX_COL_WIDTH - 4) printf(" ");
-#endif
-				sub_dirs_indents[cur_depth + 1] = last_indent = strlen(tmp) + 1;
-			}
-			else {
-				printf("%s",subdir);
-				sub_dirs_indents[cur_depth + 1] = last_indent = strlen(subdir)+1;
-				if (floating || strlen(subdir) < MAX_COL_WIDTH - 4)
-					printf(" ");
-			}
-			indented = TRUE;
-		}
-		else printf("%*s%s",indent," ",subdir);
-	}
-
-/* open subdirectory */
-
-	if ((dp = opendir(subdir)) == NULL) {
-		printf(" - can't read %s\n", subdir);
-		indented = FALSE;
+		T_NODE(&tree, np)->flags |= N_UNREAD;
 		return;
 	}
 
 	cur_depth++;
-	indent+=3;
 
 #ifdef BSD
 	getwd(cwd);				/* remember where we are */
@@ -290,196 +272,162 @@ READ		tmp_entry;
 
 #ifdef	MEMORY_BASED
 
-	//Mehdad Zaman added
-	head = NULL;
-	//
-	for (file = readdir(dp); file != NULL; file = readdir(dp)) {
-		if ((!quick && !visual ) ||
- 		    ( strcmp(NAME(*file), "..") != SAME &&
-		     strcmp(NAME(*file), ".") != SAME &&
-		     chk_4_dir(NAME(*file)) ) ) {
-			//Mehdad Zaman changed
-			tmp_RD = (struct RD_list *) malloc(sizeof(struct RD_list));
-			//
-			memcpy(&tmp_RD->entry, file, sizeof(tmp_entry));
-			tmp_RD->bptr = head;
-			tmp_RD->fptr = NULL;
-			if (head == NULL) head = tmp_RD;
-				else tail->fptr = tmp_RD;
-			tail = tmp_RD;
+	if (cache_path && !cr)
+		cache_start(&cb, dirst, !quick && !visual);
+
+	/* A file with one link can only be seen twice if its directory is */
+	/* (only looked at for a cached record, so only with the cache) */
+	x = NEW;
+	if (cache_path)
+		x = hs_enter(&cache_dirs, dirst->st_dev, dirst->st_ino);
+
+	sift(&dl);
+	dl_statall(&dl, sw_follow_links, quick || visual);
+
+	/*
+	 * Drop . and .., and stat what's left (if dl_statall hasn't).  The quick and visual
+	 * displays only care about subdirectories, which the directory
+	 * entry's type mostly tells apart without a stat.
+	 */
+
+	for (n = kept = 0; n < dl.count; n++) {
+		name = DL_NAME(&dl, n);
+		if ( strcmp(name, "..") == SAME || strcmp(name, ".") == SAME )
+			continue;
+		if (quick || visual) {
+			if (!dl_isdir(&dl, n, sw_follow_links))
+				continue;
 		}
+		else if (dl_stat(&dl, n, sw_follow_links) < 0)
+			continue;
+		dl.ents[kept++] = dl.ents[n];
 	}
+	dl.count = kept;
 
-				/* screwy, inefficient, bubble sort	*/
-				/* but it works				*/
-	//Mehdad Zaman added
-	tmp_RD = head;
-	//
-	if (sort) {
-		while (tmp_RD) {
-			tmp1_RD = tmp_RD->fptr;
-			while (tmp1_RD) {
-				//if (NAME(tmp_RD->entry) > NAME(tmp1_RD->entry)) {
-				//Mehdad Zaman changed
-				if ((strcmp(NAME(tmp_RD->entry), NAME(tmp1_RD->entry))) > 0) {
-				//
-					/* swap the two */
-					memcpy(&tmp_entry, &tmp_RD->entry, sizeof(tmp_entry));
-					memcpy(&tmp_RD->entry, &tmp1_RD->entry, sizeof(tmp_entry));
-					memcpy(&tmp1_RD->entry, &tmp_entry, sizeof(tmp_entry));
-				}
-				tmp1_RD = tmp1_RD->fptr;
-			}
-			tmp_RD = tmp_RD->fptr;
-		}
-	}
-
-#endif
+	if (sort)
+		dl_sort(&dl, sort_key);
 
 	if ( (!quick) && (!visual) ) {
 
 		/* accumulate total sizes and inodes in current directory */
 
-
-#ifdef	MEMORY_BASED
-		tmp_RD = head;
-		while (tmp_RD) {
-			file = &tmp_RD->entry;
-			tmp_RD = tmp_RD->fptr;
-#else
-
-		for (file = readdir(dp); file != NULL; file = readdir(dp)) {
-#endif
-			if (strcmp(NAME(*file), "..") != SAME)
-				get_data(NAME(*file),FALSE);
+		if (cr) {
+			if ( (x == NEW) || (dup_inodes) ) {
+				T_NODE(&tree, np)->files += cr->sizes;
+				T_NODE(&tree, np)->inodes += cr->inodes;
+			}
+			for (n = 0; n < cr->nlinks; n++) {
+				if ( (h_enter(CR_LINKS(cr)[n].dev,
+				    CR_LINKS(cr)[n].ino) == OLD) && (!dup_inodes) )
+					continue;
+				T_NODE(&tree, np)->inodes++;
+				T_NODE(&tree, np)->files += CR_LINKS(cr)[n].k;
+			}
 		}
-
-		if (cur_depth<depth) {
-			if (cnt_inodes) printf("   %d",inodes);
-			printf(" : %ld\n",sizes);
-			total_sizes += sizes;
-			total_inodes += inodes;
-			sizes = 0;
-			inodes = 0;
+		else for (n = 0; n < dl.count; n++) {
+			if (S_ISDIR(dl.ents[n].mode))
+				continue;
+			name = DL_NAME(&dl, n);
+			dl_getstat(&dl, n, &st);
+			if (cache_path)
+				cache_file(&cb, &st, K(st.st_blocks * BLOCKSIZE));
+			add_file(np, name, &st);
 		}
-#ifndef	MEMORY_BASED
-		rewinddir(dp);
-#endif
-	} else if (!visual) printf("\n");
-
-	if (visual) {
+	}
 
-/* count subdirectories */
+#else
 
+	/*
+	 * One pass over the directory: files are counted as they come,
+	 * subdirectories are kept, stat and all, to go down into once
+	 * the directory is closed again.
+	 */
 
-#ifdef	MEMORY_BASED
-		tmp_RD = head;
-		while (tmp_RD) {
-			file = &tmp_RD->entry;
-			tmp_RD = tmp_RD->fptr;
-#else
-		for (file = readdir(dp); file != NULL; file = readdir(dp)) {
-			if ( (strcmp(NAME(*file), "..") != SAME) &&
-			     (strcmp(NAME(*file), ".") != SAME) ) {
-				if (chk_4_dir(NAME(*file))) {
+	for (file = readdir(dp); file != NULL; file = readdir(dp)) {
+		name = NAME(*file);
+		if ( strcmp(name, "..") == SAME || strcmp(name, ".") == SAME )
+			continue;
+		if (fl_skip(name))
+			continue;
+#ifdef	LINUX
+		if ( (quick || visual) && file->d_type != DT_UNKNOWN &&
+		     file->d_type != DT_DIR &&
+		     (file->d_type != DT_LNK || !sw_follow_links) )
+			continue;
 #endif
-					sub_dirs[cur_depth]++;
-#ifndef	MEMORY_BASED
-				}
-			}
+		if (get_stat(name, &st) < 0)
+			continue;
+		if (S_ISDIR(st.st_mode)) {
+#ifdef	LINUX
+			if (dl_append(&dl, name, st.st_ino, file->d_type) == 0)
+#else
+			if (dl_append(&dl, name, st.st_ino, 0) == 0)
 #endif
+				dl_setstat(&dl, dl.count - 1, &st);
 		}
-#ifndef	MEMORY_BASED
-		rewinddir(dp);
-#endif
+		else if ( (!quick) && (!visual) )
+			add_file(np, name, &st);
 	}
+	//Mehdad Zaman added
+	closedir(dp);
+	//
 
-/* go down into the subdirectory */
-
-#ifdef	MEMORY_BASED
-	tmp_RD = head;
-	while (tmp_RD) {
-		file = &tmp_RD->entry;
-		tmp_RD = tmp_RD->fptr;
-#else
-	for (file = readdir(dp); file != NULL; file = readdir(dp)) {
 #endif
-		if ( (strcmp(NAME(*file), "..") != SAME) &&
-		     (strcmp(NAME(*file), ".") != SAME) ) {
-			if (chk_4_dir(NAME(*file)))
-				sub_dirs[cur_depth]--;
-			get_data(NAME(*file),TRUE);
-		}
-	}
 
-	if ( (!quick) && (!visual) ) {
+/* go down into the subdirectories */
 
-/* print totals */
-		if (cur_depth == depth) {
-			if (cnt_inodes) printf("   %d",inodes);
-			printf(" : %ld\n",sizes);
-			total_sizes += sizes;
-			total_inodes += inodes;
-			sizes = 0;
-			inodes = 0;
-		}
+	for (n = 0; n < dl.count; n++) {
+		if (!S_ISDIR(dl.ents[n].mode) &&
+		    !dl_isdir(&dl, n, sw_follow_links))
+			continue;
+		name = DL_NAME(&dl, n);
+#ifdef	MEMORY_BASED
+		if (cache_path && !cr)
+			cache_child(&cb, name);
+#endif
+		dl_getstat(&dl, n, &st);
+		if (one_fs && st.st_dev != root_dev)
+			continue;	/* a mount point: leave it alone */
+		add_dir(name, np, &st, link_inside(&dl, n));
 	}
 
 #ifdef	MEMORY_BASED
-				/* free the allocated memory */
-	tmp_RD = head;
-	struct RD_list *tmp_RD2 = tmp_RD;
-	while (tmp_RD) {
-		tmp_RD2 = tmp_RD;
-		tmp_RD = tmp_RD->fptr;
-		free(tmp_RD2);
-
-	}
+	if (cache_path && !cr)
+		cache_finish(&cb);
 #endif
+				/* free the directory arena */
+	dl_free(&dl);
 
-	if (visual && indented) {
-		printf("\n");
-		indented = FALSE;
-		if (last_subdir>=cur_depth-1) {
-			for (i = 1; i <cur_depth; i++) {
-				if (sub_dirs[i]) {
-					if (floating)
-						printf("%*s%s   ",sub_dirs_indents[i]," ",V_CHAR);
-					else printf("%*s%s   ",MAX_COL_WIDTH-4," ",V_CHAR);
-				} else {
-					if (floating)
-/*ZZZ*/						printf("%*s   ",sub_dirs_indents[i] + 1," ");
- 					else printf("%*s   ",MAX_COL_WIDTH-3," ");
- 				}
-			}
-			printf("\n");
-			last_subdir = FALSE;
-		}
-	}
-	indent-=3;
-	sub_dirs[cur_depth] = 0;
 	cur_depth--;
 
 	chdir(cwd);			/* go back where we were */
-
-	//Mehdad Zaman added
-	closedir(dp);
-	//
 } /* down */
 
 
 
-static int	chk_4_dir(path)
-char	*path;
-{
-	#ifndef LINUX
-		int is_directory();
-	#endif
+ /*
+  * stat or lstat path into st, as -l says.  Returns -1 if it can't
+  * be done.
+  */
 
-	if (is_directory(path)) return TRUE;
-	else return FALSE;
+static int	get_stat(path, st)
+char           *path;
+struct	stat	*st;
+{
+int	rc;
+double	t0 = th_begin();	/* -r may make us wait */
 
-} /* chk_4_dir */
+#ifdef LSTAT
+	if (sw_follow_links)
+		rc = stat(path, st);	/* follows symbolic links */
+	else
+		rc = lstat(path, st);	/* doesn't follow symbolic links */
+#else
+	rc = stat(path, st);
+#endif
+	th_end(t0);
+	return rc;
+} /* get_stat */
 
 
 
@@ -489,14 +437,7 @@ static int	is_directory(path)
 char           *path;
 {
 
-#ifdef LSTAT
-	if (sw_follow_links)
-		stat(path, &stb);	/* follows symbolic links */
-	else
-		lstat(path, &stb);	/* doesn't follow symbolic links */
-#else
-	stat(path, &stb);
-#endif
+	get_stat(path, &stb);
 
 	if ((stb.st_mode & S_IFMT) == S_IFDIR)
 		return TRUE;
@@ -505,44 +446,401 @@ char           *path;
 
 
 
+ /*
+  * A file's space goes to node np, unless it's been seen already or
+  * the filters leave it out.  The file is also up for the --top files
+  * list, and goes into the -A histograms.
+  */
+
+static void
+add_file(np, name, st)
+int		np;
+char           *name;
+struct	stat	*st;
+{
+	if (!fl_count(name, st))
+		return;
+
+	    /* Don't do it again if we've already done it once. */
+
+	if (watching) {
+		/* (-W may read this directory again, and so count it again) */
+		if ( (st->st_nlink > 1 ?
+		    !wt_claim(&tree, np, st->st_dev, st->st_ino) :
+		    (T_NODE(&tree, np)->flags & N_SEEN) != 0) && (!dup_inodes) )
+			return;
+	}
+	else if ( (h_enter(st->st_dev, st->st_ino) == OLD) && (!dup_inodes) )
+		return;
+	//Mehdad Zaman added
+	T_NODE(&tree, np)->inodes++;
+	T_NODE(&tree, np)->files += K(st->st_blocks * BLOCKSIZE);
+	//
+	T_NODE(&tree, np)->afiles += K(st->st_size);
+	if (top_files)
+		top_add(&top_fl, K(st->st_blocks * BLOCKSIZE), np, name);
+	if (histo)
+		hist_add(&hist, st, K(st->st_blocks * BLOCKSIZE), now);
+	if (dev_totals)
+		dv_add(&devtab, st->st_dev, K(st->st_blocks * BLOCKSIZE));
+	if (copies)
+		dp_add(&duptab, np, name, st);
+} /* add_file */
+
+
+
+ /*
+  * A directory goes into the tree under node np (or at the top if np
+  * is NONE), and then we go down into it.  Once that's done its
+  * totals are known, and the streamed formats can write it out (or
+  * --top can see if it's one of the largest).
+  *
+  * Symbolic links can lead back to a directory above, which would
+  * have us go round for ever, or to one already gone down into
+  * elsewhere, whose files are counted already.  The first is left
+  * out with a warning, the second quietly, as a second name for a
+  * file is.  A link ('linked') to a directory that is really inside
+  * the tree is left out too, whether or not the walk has got there
+  * yet, so the directory is counted where it really is.  (With -d
+  * they're all gone down into again.)  -W has no dirs_seen, as a
+  * directory read again must find its subdirectories again, and asks
+  * the claims instead.  A directory named on the command line is
+  * always gone down into.
+  */
+
+static void
+add_dir(path, np, st, linked)
+char           *path;
+int		np;
+struct	stat	*st;
+int		linked;
+{
+char	where[NAMELEN];
+int		n;
+
+	if (np != NONE && (n = t_loop(&tree, np, st->st_dev, st->st_ino)) != NONE) {
+		if (t_path(&tree, np, where, sizeof(where)) == 0)
+			fprintf(stderr, "%s: %s/%s: loops back to ", Program, where, path);
+		if (t_path(&tree, n, where, sizeof(where)) == 0)
+			fprintf(stderr, "%s, not followed\n", where);
+		return;
+	}
+	if (linked)
+		return;
+	if (watching) {
+		if ( (!dup_inodes) && (np != NONE) && watched_already(st) )
+			return;
+	}
+	else if ( (!dup_inodes) &&
+	    (hs_enter(&dirs_seen, st->st_dev, st->st_ino) == OLD) && (np != NONE) )
+		return;
+	if ((n = t_add(&tree, np, path)) == NONE)
+		return;
+	T_NODE(&tree, n)->dev = st->st_dev;
+	T_NODE(&tree, n)->ino = st->st_ino;
+	T_NODE(&tree, n)->own = K(st->st_blocks * BLOCKSIZE);
+	T_NODE(&tree, n)->aown = K(st->st_size);
+	if (watching && !wt_claim(&tree, n, st->st_dev, st->st_ino))
+		T_NODE(&tree, n)->flags |= N_SEEN;	/* its files are counted */
+	if (np == NONE)
+		root_dev = st->st_dev;
+	if (dev_totals)
+		dv_add(&devtab, st->st_dev, K(st->st_blocks * BLOCKSIZE));
+	down(path, n, st);
+	t_done(&tree, n);
+	if (!top_n && !histo && !dev_totals && !watching && !copies)
+		render_dir(&tree, n, cur_depth);
+	else if (cur_depth < depth)
+		top_add(&top_dirs, T_NODE(&tree, n)->total, n, NULL);
+} /* add_dir */
+
+
+
+ /*
+  * Is entry n of dl, in the current directory, a symbolic link to a
+  * directory that is really inside the argument at hand?  Only asked
+  * when such links would otherwise be followed; a directory entry
+  * (as getdents says) needs no lstat to tell it isn't a link.
+  */
+static int
+link_inside(dl, n)
+struct dirlist	*dl;
+int	n;
+{
+char	real[MAXPATHLEN];
+struct	stat	lst;
+size_t	len = strlen(root_real);
+
+	if (!sw_follow_links || dup_inodes || len == 0)
+		return FALSE;
+#ifdef	LINUX
+	if (dl->ents[n].type == DT_DIR)
+		return FALSE;
+#endif
+	if (lstat(DL_NAME(dl, n), &lst) < 0 || !S_ISLNK(lst.st_mode))
+		return FALSE;
+	if (realpath(DL_NAME(dl, n), real) == NULL)
+		return FALSE;
+	if (strncmp(real, root_real, len) != SAME)
+		return FALSE;
+	return len == 1 || real[len] == '/' || real[len] == '\0';
+} /* link_inside */
+
+
+
+ /*
+  * -W: is directory st in the tree already, as a node its path still
+  * leads to?  One that moved keeps its old node until its old parent
+  * is read again, and that node doesn't count.  The path is from
+  * topdir, so we go there to look and come back.
+  */
+static int
+watched_already(st)
+struct	stat	*st;
+{
+char	path[NAMELEN];
+struct	stat	cst;
+int	c, here, same;
+
+	if ((c = wt_owner(&tree, st->st_dev, st->st_ino)) == NONE ||
+	    (T_NODE(&tree, c)->flags & N_UNREAD))
+		return FALSE;
+	if ((here = open(".", O_RDONLY)) < 0)
+		return FALSE;
+	same = chdir(topdir) == 0 &&
+	    t_path(&tree, c, path, sizeof(path)) == 0 &&
+	    get_stat(path, &cst) == 0 &&
+	    cst.st_dev == st->st_dev && cst.st_ino == st->st_ino;
+	if (fchdir(here) < 0)
+		same = FALSE;
+	close(here);
+	return same;
+} /* watched_already */
+
+
+
  /*
   * Get the aged data on a file whose name is given.  If the file is a
-  * directory, go down into it, and get the data from all files inside.
+  * directory, add it to the tree and get the data from all files
+  * inside.  Otherwise the file's space goes to node np.
   */
 
 //Mehdad Zaman
 static void
 //
-get_data(path,cont)
+get_data(path,cont,np)
 char           *path;
 int		cont;
+int		np;
 {
-/* struct	stat	stb; */
-int		i;
 	if (cont) {
 		if (is_directory(path))
-		{
-			//Mehdad Zaman added
-			sizes += K(stb.st_blocks * BLOCKSIZE);
-			inodes++;
-			down(path);
-			//
-		}
+			add_dir(path, np, &stb, FALSE);
 	}
+	else if (!is_directory(path))
+		add_file(np, path, &stb);
+} /* get_data */
+
+
+
+ /*
+  * -W: directory n has changed.  Read it again: its files are counted
+  * afresh, new subdirectories are walked as the first scan would walk
+  * them, and ones that are gone are taken out of the tree.  Then the
+  * totals of n and everything above it are added up again.
+  */
+
+static void
+rescan(n)
+int		n;
+{
+char	path[NAMELEN];
+char	*name;
+struct	stat	st, dirst;
+struct dirlist	dl;
+int	i, c, next, level, kept;
+
+	level = t_level(&tree, n);
+	if ( (level >= depth) && (!sum) )
+		return;		/* the first scan didn't read it either */
+
+	chdir(topdir);
+	for (c = n; T_NODE(&tree, c)->parent != NONE; c = T_NODE(&tree, c)->parent)
+		;
+	if (t_path(&tree, c, path, sizeof(path)) < 0 || get_stat(path, &st) < 0)
+		return;
+	root_dev = st.st_dev;
+	if (realpath(path, root_real) == NULL)
+		root_real[0] = '\0';
+	if (t_path(&tree, n, path, sizeof(path)) < 0 ||
+	    get_stat(path, &dirst) < 0 || !S_ISDIR(dirst.st_mode))
+		return;		/* gone, which its parent hears of too */
+
+	wt_rescan();
+	T_NODE(&tree, n)->own = K(dirst.st_blocks * BLOCKSIZE);
+	T_NODE(&tree, n)->aown = K(dirst.st_size);
+	T_NODE(&tree, n)->files = T_NODE(&tree, n)->afiles = 0;
+	T_NODE(&tree, n)->inodes = 0;
+	T_NODE(&tree, n)->flags &= ~(N_UNREAD | N_SEEN);
+	if (!wt_claim(&tree, n, dirst.st_dev, dirst.st_ino))
+		T_NODE(&tree, n)->flags |= N_SEEN;
+	for (c = T_NODE(&tree, n)->child; c != NONE; c = T_NODE(&tree, c)->next)
+		T_NODE(&tree, c)->flags &= ~N_MARK;
+
+	memset((char *) &dl, '\0', sizeof(dl));
+	if (dl_read(&dl, path) < 0 || chdir(path) < 0)
+		T_NODE(&tree, n)->flags |= N_UNREAD;
 	else {
-		if (is_directory(path)) return;
+		sift(&dl);
+		dl_statall(&dl, sw_follow_links, FALSE);
+		for (i = kept = 0; i < dl.count; i++) {
+			name = DL_NAME(&dl, i);
+			if ( strcmp(name, "..") == SAME || strcmp(name, ".") == SAME )
+				continue;
+			if (dl_stat(&dl, i, sw_follow_links) < 0)
+				continue;
+			dl.ents[kept++] = dl.ents[i];
+		}
+		dl.count = kept;
+		if (sort)
+			dl_sort(&dl, sort_key);
+
+		cur_depth = level + 1;
+		for (i = 0; i < dl.count; i++) {
+			name = DL_NAME(&dl, i);
+			dl_getstat(&dl, i, &st);
+			if (!S_ISDIR(st.st_mode)) {
+				if ( (!quick) && (!visual) )
+					add_file(n, name, &st);
+				continue;
+			}
+			/* a subdirectory we know, unless it couldn't be read */
+			c = t_child(&tree, n, name);
+			if (c != NONE && !(T_NODE(&tree, c)->flags & N_UNREAD)) {
+				T_NODE(&tree, c)->flags |= N_MARK;
+				continue;
+			}
+			if (one_fs && st.st_dev != root_dev)
+				continue;
+			c = tree.count;
+			add_dir(name, n, &st, link_inside(&dl, i));
+			if (tree.count > c)
+				T_NODE(&tree, c)->flags |= N_MARK;
+		}
+	}
+	dl_free(&dl);
+	chdir(topdir);
 
-		    /* Don't do it again if we've already done it once. */
+	for (c = T_NODE(&tree, n)->child; c != NONE; c = next) {
+		next = T_NODE(&tree, c)->next;
+		if (!(T_NODE(&tree, c)->flags & N_MARK))
+			t_unlink(&tree, c);
+	}
+	for (c = n; c != NONE; c = T_NODE(&tree, c)->parent)
+		t_done(&tree, c);
+} /* rescan */
 
-		if ( (h_enter(stb.st_dev, stb.st_ino) == OLD) && (!dup_inodes) )
-			return;
-		//Mehdad Zaman added
-		inodes++;
-		sizes += K(stb.st_blocks * BLOCKSIZE);
-		//
-		//sizes+= K(stb.st_size);
+
+
+ /*
+  * Watch the directories added to the tree since node from that the
+  * scan read, and return where to start next time.
+  */
+
+static int
+watch_new(from)
+int		from;
+{
+char	path[NAMELEN];
+int	n;
+
+	chdir(topdir);
+	for (n = from; n < tree.count; n++) {
+		if (T_NODE(&tree, n)->flags & (N_UNREAD | N_GONE))
+			continue;
+		if ( (t_level(&tree, n) >= depth) && (!sum) )
+			continue;
+		if (t_path(&tree, n, path, sizeof(path)) == 0)
+			wt_add(path, n);
 	}
-} /* get_data */
+	return tree.count;
+} /* watch_new */
+
+
+static long
+msecs()
+{
+struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+} /* msecs */
+
+
+
+ /*
+  * -W: after the first scan, keep the tree up to date as directories
+  * change, and answer queries on the standard input, one a line: a
+  * directory's path gets its totals, an empty line the whole output
+  * over again.  Every answer ends with a line holding just a dot,
+  * which no line of the output can be.  The watch ends with the input.
+  */
+
+static void
+watch_tree()
+{
+struct pollfd	fds[2];
+char	line[NAMELEN];
+long	first = 0;
+int	n, watched = 0, pending = FALSE;
+
+	if (wt_open() < 0)
+		exit(-1);
+	setvbuf(stdin, NULL, _IONBF, 0);	/* poll has to see every line */
+	fds[0].fd = wt_fd();
+	fds[1].fd = 0;
+	fds[0].events = fds[1].events = POLLIN;
+
+	for (;;) {
+		watched = watch_new(watched);
+		if (poll(fds, 2, pending ? WT_SETTLE : -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+		if (fds[0].revents) {
+			if ((n = wt_read(&tree)) < 0)
+				break;
+			if (n && !pending)
+				first = msecs();
+			pending = n > 0;
+		}
+
+		/* Apply the changes once they settle, or before a query. */
+		if ( (pending && (!fds[0].revents || msecs() - first >= WT_MAXWAIT)) ||
+		    fds[1].revents ) {
+			wt_read(&tree);
+			while ((n = wt_next(&tree)) != NONE)
+				rescan(n);
+			pending = FALSE;
+		}
+
+		if (fds[1].revents) {
+			if (fgets(line, sizeof(line), stdin) == NULL)
+				break;
+			line[strcspn(line, "\n")] = '\0';
+			if (*line == '\0')
+				render_tree(&tree);
+			else if ((n = t_find(&tree, line)) != NONE)
+				render_node(&tree, n);
+			else fprintf(stderr, "%s: %s is not in the tree\n", Program, line);
+			printf(".\n");
+			fflush(stdout);
+		}
+	}
+	wt_close();
+} /* watch_tree */
 
 
 
@@ -554,6 +852,7 @@ int	i,
 	j,
 	err = FALSE;
 int	option;
+struct dupdir	*dirs;
 int	user_file_list_supplied = 0;
 
 	Program = *argv;		/* save our name for error messages */
@@ -570,6 +869,26 @@ int	user_file_list_supplied = 0;
         {"height", required_argument , NULL, 'h'},
         {"inodes", no_argument, NULL, 'i'},
         {"sort-directories", no_argument, NULL, 'o'},
+        {"sort-key", required_argument, NULL, 'k'},
+        {"cache", required_argument, NULL, 'c'},
+        {"format", required_argument, NULL, 'F'},
+        {"top", required_argument, NULL, 'n'},
+        {"top-files", no_argument, NULL, 'a'},
+        {"histograms", no_argument, NULL, 'A'},
+        {"uring", required_argument, NULL, 'u'},
+        {"rate", required_argument, NULL, 'r'},
+        {"background", no_argument, NULL, 'b'},
+        {"one-file-system", no_argument, NULL, 'x'},
+        {"devices", no_argument, NULL, 'D'},
+        {"copies", no_argument, NULL, 'C'},
+        {"apparent-size", no_argument, NULL, 'S'},
+        {"watch", no_argument, NULL, 'W'},
+        {"exclude", required_argument, NULL, 'e'},
+        {"exclude-regex", required_argument, NULL, 'E'},
+        {"include", required_argument, NULL, 'I'},
+        {"include-regex", required_argument, NULL, 'R'},
+        {"min-size", required_argument, NULL, 'm'},
+        {"newer", required_argument, NULL, 'N'},
         {"include-subdirectories", no_argument, NULL, 's'},
         {"totals", no_argument, NULL, 't'},
         {"quick-display", no_argument, NULL,  'q'},
@@ -583,13 +902,16 @@ int	user_file_list_supplied = 0;
 
 	//Mehdad Zaman added
     #ifdef LINUX
-    	while ((option = getopt_long(argc, argv, "dfh:iostqvVl", long_var_options, &op_index)) != EOF) {
+    	while ((option = getopt_long(argc, argv, "AabCDc:de:E:fF:h:I:ik:m:n:N:or:R:sStqu:vVWxl", long_var_options, &op_index)) != EOF) {
    	#else
-		while ((option = getopt(argc, argv, "dfh:iostqvVl")) != EOF) {
+		while ((option = getopt(argc, argv, "AabCDc:de:E:fF:h:I:ik:m:n:N:or:R:sStqu:vVWxl")) != EOF) {
     #endif
 	//
 		switch (option) {
 			case 'f':	floating = TRUE; break;
+			case 'F':	if ((out_format = render_format(optarg)) < 0)
+						err = TRUE;
+					break;
 			case 'h':	depth = atoi(optarg);
 					while (*optarg) {
 						if (!isdigit(*optarg)) {
@@ -599,6 +921,55 @@ int	user_file_list_supplied = 0;
 						optarg++;
 					}
 					break;
+			case 'n':	top_n = atoi(optarg);
+					if (top_n <= 0)
+						err = TRUE;
+					while (*optarg) {
+						if (!isdigit(*optarg)) {
+							err = TRUE;
+							break;
+						}
+						optarg++;
+					}
+					break;
+			case 'a':	top_files = TRUE;
+					break;
+			case 'A':	histo = TRUE;
+					break;
+			case 'b':	background = TRUE;
+					break;
+			case 'x':	one_fs = TRUE;
+					break;
+			case 'C':	copies = TRUE;
+					break;
+			case 'D':	dev_totals = TRUE;
+					break;
+			case 'S':	apparent = TRUE;
+					break;
+			case 'W':	watching = TRUE;
+					break;
+			case 'e':	if (fl_add(optarg, FL_GLOB, FALSE) < 0)
+						err = TRUE;
+					break;
+			case 'E':	if (fl_add(optarg, FL_REGEX, FALSE) < 0)
+						err = TRUE;
+					break;
+			case 'I':	if (fl_add(optarg, FL_GLOB, TRUE) < 0)
+						err = TRUE;
+					break;
+			case 'R':	if (fl_add(optarg, FL_REGEX, TRUE) < 0)
+						err = TRUE;
+					break;
+			case 'm':	if (fl_minsize(optarg) < 0)
+						err = TRUE;
+					break;
+			case 'N':	if (fl_newer(optarg) < 0)
+						err = TRUE;
+					break;
+			case 'r':	op_rate = atof(optarg);
+					if (op_rate <= 0)
+						err = TRUE;
+					break;
 			case 'd':	dup_inodes = TRUE;
 					break;
 			case 'i':	cnt_inodes = TRUE;
@@ -606,6 +977,17 @@ int	user_file_list_supplied = 0;
 			//Mehdad Zaman added
 			#ifdef MEMORY_BASED
 			case 'o':	sort = TRUE; break;
+			case 'k':	sort = TRUE;
+					if ((sort_key = dl_sortkey(optarg)) < 0)
+						err = TRUE;
+					by_total = (sort_key == SORT_SIZE);
+					break;
+			case 'c':	cache_path = optarg;
+					break;
+			case 'u':	uring_depth = atoi(optarg);
+					if (uring_depth <= 0 || uring_depth > UR_MAXDEPTH)
+						err = TRUE;
+					break;
 			#endif
 			//
 
@@ -634,29 +1016,53 @@ int	user_file_list_supplied = 0;
 		if (err) {
 			//Mehdad Zaman added
 			#if (defined(MEMORY_BASED) && defined(LSTAT))
-				fprintf(stderr,"%s: [ -d ] [ -h # ] [ -i ] [ -o ] [ -s ] [ -q ] [ -v ] [ -V ] [-l]\n",Program);
+				fprintf(stderr,"%s: [ -b ] [ -c file ] [ -d ] [ -e glob ] [ -E re ] [ -F fmt ] [ -h # ] [ -i ] [ -I glob ] [ -R re ] [ -m size ] [ -N days|file ] [ -n N [ -a ] | -A | -C | -D | -W ] [ -o ] [ -k key ] [ -s ] [ -S ] [ -q ] [ -r ops ] [ -u depth ] [ -v ] [ -V ] [ -x ] [-l]\n",Program);
 			#elif defined(LSTAT)
-				fprintf(stderr,"%s: [ -d ] [ -h # ] [ -i ] [ -s ] [ -q ] [ -v ] [ -V ] [-l]\n",Program);
+				fprintf(stderr,"%s: [ -b ] [ -d ] [ -e glob ] [ -E re ] [ -F fmt ] [ -h # ] [ -i ] [ -I glob ] [ -R re ] [ -m size ] [ -N days|file ] [ -n N [ -a ] | -A | -C | -D | -W ] [ -s ] [ -S ] [ -q ] [ -r ops ] [ -v ] [ -V ] [ -x ] [-l]\n",Program);
 			#elif defined(MEMORY_BASED)
-				fprintf(stderr,"%s: [ -d ] [ -h # ] [ -i ] [ -o ] [ -s ] [ -q ] [ -v ] [ -V ]\n",Program);
+				fprintf(stderr,"%s: [ -b ] [ -c file ] [ -d ] [ -e glob ] [ -E re ] [ -F fmt ] [ -h # ] [ -i ] [ -I glob ] [ -R re ] [ -m size ] [ -N days|file ] [ -n N [ -a ] | -A | -C | -D | -W ] [ -o ] [ -k key ] [ -s ] [ -S ] [ -q ] [ -r ops ] [ -u depth ] [ -v ] [ -V ] [ -x ]\n",Program);
 			#else
-				fprintf(stderr,"%s: [ -d ] [ -h # ] [ -i ] [ -s ] [ -q ] [ -v ] [ -V ]\n",Program);
+				fprintf(stderr,"%s: [ -b ] [ -d ] [ -e glob ] [ -E re ] [ -F fmt ] [ -h # ] [ -i ] [ -I glob ] [ -R re ] [ -m size ] [ -N days|file ] [ -n N [ -a ] | -A | -C | -D | -W ] [ -s ] [ -S ] [ -q ] [ -r ops ] [ -v ] [ -V ] [ -x ]\n",Program);
 			#endif
 			//fprintf(stderr,"%s: [ -d ] [ -h # ] [ -i ] [ -o ] [ -s ] [ -q ] [ -v ] [ -V ]\n",Program);
 
+			fprintf(stderr,"	-b	run in the background: lowest CPU and I/O priority\n");
+			#ifdef MEMORY_BASED
+			fprintf(stderr,"	-c file	keep a scan cache in file, skip unchanged directories\n");
+			#endif
 			fprintf(stderr,"	-d	count duplicate inodes\n");
+			fprintf(stderr,"	-e glob	leave out entries named like glob\n");
+			fprintf(stderr,"	-E re	leave out entries whose names match re\n");
 			fprintf(stderr,"	-f	floating column widths\n");
+			fprintf(stderr,"	-F fmt	output format: text, json or csv\n");
 			fprintf(stderr,"	-h #	height of tree to look at\n");
 			fprintf(stderr,"	-i	count inodes\n");
+			fprintf(stderr,"	-I glob	count only files named like glob\n");
+			fprintf(stderr,"	-R re	count only files whose names match re\n");
+			fprintf(stderr,"	-m size	count only files of at least size (K, or with k, M, G, T)\n");
+			fprintf(stderr,"	-N days|file	count only files changed since, or since file was\n");
+			fprintf(stderr,"	-n N	list only the N largest directories\n");
+			fprintf(stderr,"	-a	and the N largest files (with -n)\n");
+			fprintf(stderr,"	-A	size and age histograms instead\n");
+			fprintf(stderr,"	-C	directories holding copies of other files instead\n");
+			fprintf(stderr,"	-D	space and inodes per device instead\n");
 			#ifdef MEMORY_BASED
 			fprintf(stderr,"	-o	sort directories before processing\n");
+			fprintf(stderr,"	-k key	sort on key: name, size, mtime or inode (implies -o)\n");
 			#endif
 			fprintf(stderr,"	-s	include subdirectories not shown due to -h option\n");
+			fprintf(stderr,"	-S	apparent sizes and allocated %% too\n");
 			fprintf(stderr,"	-t	totals at the end\n");
 			fprintf(stderr,"	-q	quick display, no counts\n");
+			fprintf(stderr,"	-r ops	at most ops stats/directory reads a second, less if slow\n");
+			#ifdef MEMORY_BASED
+			fprintf(stderr,"	-u depth	stat through io_uring, depth at a time\n");
+			#endif
 			fprintf(stderr,"	-v	visual display\n");
 			fprintf(stderr,"	-V	show current version\n");
 			fprintf(stderr,"		(2 Vs shows specified options)\n");
+			fprintf(stderr,"	-W	watch, and answer queries on stdin\n");
+			fprintf(stderr,"	-x	stay on one file system\n");
 			#ifdef LSTAT
         	fprintf(stderr,"	-l	don't follow symbolic links\n");
 			#endif
@@ -666,6 +1072,31 @@ int	user_file_list_supplied = 0;
 
 	}
 
+	if ((top_n != 0) + histo + copies + dev_totals + watching > 1) {
+		fprintf(stderr,"%s: only one of -n, -A, -C, -D and -W at a time\n",Program);
+		exit(-1);
+	}
+
+	/* The streamed formats, --top, -A, -C and -D want the counts, not the displays */
+	if (out_format != OUT_TEXT || top_n || histo || copies || dev_totals)
+		quick = visual = FALSE;
+	if (!top_n)
+		top_files = FALSE;
+	per_file = top_files || histo || copies || dev_totals || apparent ||
+	    watching || fl_active();
+	now = time(NULL);
+	th_init(op_rate);
+	if (background)
+		th_background();
+	top_init(&top_dirs, top_n);
+	top_init(&top_fl, top_files ? top_n : 0);
+	render_start(out_format);
+
+#ifdef	MEMORY_BASED
+	if (uring_depth)
+		dl_uring(uring_depth);	/* stays with stat(2) if it can't */
+#endif
+
 	if (version > 0 ) {
 
 #ifdef	MEMORY_BASED
@@ -682,7 +1113,30 @@ int	user_file_list_supplied = 0;
 			if (sw_summary) printf("Print totals at end\n");
 			if (quick) printf("Quick display only\n");
 			if (visual) printf("Visual tree\n");
+			if (out_format != OUT_TEXT)
+				printf("Output format:	%s\n", render_formatname(out_format));
+			if (top_n) printf("Largest %s:	%d\n",
+			    top_files ? "directories and files" : "directories", top_n);
+			if (histo) printf("Size and age histograms\n");
+			if (copies) printf("Directories holding copies\n");
+			if (op_rate) printf("Operations a second:	%g\n", op_rate);
+			if (background) printf("Background priority\n");
+			if (one_fs) printf("Stay on one file system\n");
+			if (dev_totals) printf("Totals per device\n");
+			if (apparent) printf("Apparent sizes too\n");
+			if (watching) printf("Watch for changes\n");
+			fl_print();
 			if (sort) printf("Sort directories before processing\n");
+#ifdef	MEMORY_BASED
+			if (sort && sort_key != SORT_NAME)
+				printf("Sort key:	%s\n", dl_keyname(sort_key));
+			if (cache_path) printf("Scan cache:	%s\n", cache_path);
+			if (uring_depth) {
+				if (dl_uringdepth())
+					printf("Stat batching:	io_uring, depth %u\n", dl_uringdepth());
+				else printf("Stat batching:	io_uring unavailable, using stat\n");
+			}
+#endif
 		}
 	}
 
@@ -700,29 +1154,57 @@ int	user_file_list_supplied = 0;
 	getcwd(topdir, sizeof (topdir));	/* find out where we are */
 #endif
 
-    /* Zero out grand totals */
-	total_inodes = total_sizes = 0;
-    /* Zero out sub_dirs */
-	for (i=0; i<=MAX_V_DEPTH; i++) {
-		sub_dirs[i] = 0;
-		sub_dirs_indents[i] = 0;
-	}
+	t_init(&tree);
+
+#ifdef	MEMORY_BASED
+	if (cache_path && cache_open(cache_path) < 0)
+		exit(-1);
+	hs_init(&cache_dirs);
+#endif
 
     /* Inspect each argument */
 	for (i = optind; i < argc || (!user_file_list_supplied && i == argc); i++) {
-		cur_depth = inodes = sizes = 0;
+		cur_depth = 0;
 
 		chdir(topdir);		/* be sure to start from the same place */
-		get_data(user_file_list_supplied?argv[i] : topdir, TRUE);/* this may change our cwd */
-
-		total_inodes += inodes;
-		total_sizes += sizes;
+		hs_init(&dirs_seen);	/* each argument is a tree of its own */
+		if (realpath(user_file_list_supplied ? argv[i] : topdir, root_real) == NULL)
+			root_real[0] = '\0';
+		j = tree.lastroot;
+		get_data(user_file_list_supplied?argv[i] : topdir, TRUE, NONE);/* this may change our cwd */
+
+		if (histo && tree.lastroot != j)	/* it was a directory */
+			render_hist(&tree, tree.lastroot, &hist);
+		memset((char *) &hist, '\0', sizeof(hist));
+		hs_free(&dirs_seen);
 	}
 
-	if (sw_summary) {
-		printf("\n\nTotal space used: %ld\n",total_sizes);
-		if (cnt_inodes) printf("Total inodes: %d\n", total_inodes);
+#ifdef	MEMORY_BASED
+	chdir(topdir);
+	if (cache_path)
+		cache_close();
+#endif
+
+    /* Now show what we found */
+	if (watching) {
+		render_tree(&tree);
+		printf(".\n");
+		fflush(stdout);
+		watch_tree();
+	}
+	else if (top_n)
+		render_top(&tree, &top_dirs, top_files ? &top_fl : NULL);
+	else if (histo)
+		fflush(stdout);
+	else if (copies) {
+		chdir(topdir);		/* the paths are from there */
+		if ((i = dp_find(&duptab, &tree, &dirs)) < 0)
+			perror("can't look for copies");
+		else render_dups(&tree, &duptab, dirs, i);
 	}
+	else if (dev_totals)
+		render_devs(&devtab);
+	else render_end(&tree);
 
 #ifdef HSTATS
 	fflush(stdout);
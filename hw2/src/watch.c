@@ -0,0 +1,320 @@
+/* watch.c
+
+ * The inotify side of vtree's watch mode, and the claim table that
+ * keeps hard links counted once as directories are read again.
+ *
+ * Watch descriptors are small integers handed out in order, so the
+ * node each one watches is kept in an array indexed by them.  Changed
+ * directories are marked N_DIRTY in the tree and queued; wt_next
+ * hands them back one at a time.  If the kernel's queue overflows,
+ * which events were lost can't be known, and every directory is
+ * queued to be read again.
+ *
+ * The claim table maps a (device, inode) to the node it's counted
+ * under and the reading of that node that counted it: the same node
+ * reading it twice in one go is a second name for it, another node
+ * finding it leaves it alone, unless the node it was counted under is
+ * gone from the tree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "watch.h"
+
+#ifdef LINUX
+#include <sys/inotify.h>
+
+#define WT_MASK		(IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+			 IN_MODIFY | IN_ATTRIB | IN_ONLYDIR)
+#endif
+
+struct claim {
+    dev_t           dev;
+    ino_t           ino;
+    int             node;	/* NONE if the slot is free */
+    unsigned        gen;	/* the reading that counted it */
+};
+
+static int      fd = -1;	/* the inotify instance */
+static int     *wdnode;		/* node of each watch descriptor */
+static int      nwd;		/* slots in wdnode */
+static int     *queue;		/* dirty nodes, in the order they came */
+static int      queued, qmax, qnext;
+static struct claim *claims;
+static size_t   nclaims, used;	/* slots, and slots filled */
+static unsigned gen;		/* bumped by wt_rescan */
+
+static void enqueue(struct tree *t, int n);
+static struct claim *find(dev_t dev, ino_t ino);
+static int grow(void);
+
+
+#ifdef LINUX
+
+ /* Start watching; returns -1 (and says why) if it can't. */
+int
+wt_open()
+{
+    if ((fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+	perror("inotify");
+    return fd;
+}
+
+
+ /* Watch directory path on behalf of node.  -1 if it can't. */
+int
+wt_add(path, node)
+    char           *path;
+    int             node;
+{
+    static int      warned = 0;
+    int            *nodes, wd, n;
+
+    if ((wd = inotify_add_watch(fd, path, WT_MASK)) < 0) {
+	if (errno == ENOSPC && !warned++)
+	    fprintf(stderr, "out of inotify watches, some directories won't "
+		    "be followed (see fs.inotify.max_user_watches)\n");
+	return -1;
+    }
+    if (wd >= nwd) {
+	for (n = nwd ? nwd : 256; n <= wd; n *= 2);
+	if ((nodes = realloc(wdnode, n * sizeof(int))) == NULL)
+	    return -1;
+	while (nwd < n)
+	    nodes[nwd++] = NONE;
+	wdnode = nodes;
+    }
+    wdnode[wd] = node;		/* a directory watched again moves over */
+    return 0;
+}
+
+
+ /*
+  * Read what events there are without waiting, and queue the
+  * directories they happened in.  Returns how many are queued, -1 if
+  * the events couldn't be read.
+  */
+int
+wt_read(t)
+    struct tree    *t;
+{
+    static char     buf[WT_EVBUF]
+		    __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *ev;
+    ssize_t         len;
+    char           *p;
+    int             n;
+
+    while ((len = read(fd, buf, sizeof(buf))) > 0)
+	for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+	    ev = (struct inotify_event *) p;
+	    if (ev->mask & IN_Q_OVERFLOW) {
+		for (n = 0; n < t->count; n++)
+		    if (!(t->nodes[n].flags & N_GONE))
+			enqueue(t, n);
+		continue;
+	    }
+	    if (ev->wd < 0 || ev->wd >= nwd || wdnode[ev->wd] == NONE)
+		continue;
+	    if (ev->mask & IN_IGNORED)
+		wdnode[ev->wd] = NONE;	/* the directory went away */
+	    else enqueue(t, wdnode[ev->wd]);
+	}
+    if (len < 0 && errno != EAGAIN && errno != EINTR) {
+	perror("inotify");
+	return -1;
+    }
+    return queued - qnext;
+}
+
+#else
+
+int
+wt_open()
+{
+    fprintf(stderr, "watching needs inotify, which is Linux only\n");
+    return -1;
+}
+
+int
+wt_add(path, node)
+    char           *path;
+    int             node;
+{
+    return -1;
+}
+
+int
+wt_read(t)
+    struct tree    *t;
+{
+    return -1;
+}
+
+#endif
+
+
+int
+wt_fd()
+{
+    return fd;
+}
+
+
+ /* Queue node n to be read again, once. */
+static void
+enqueue(t, n)
+    struct tree    *t;
+    int             n;
+{
+    int            *q;
+
+    if (t->nodes[n].flags & (N_DIRTY | N_GONE))
+	return;
+    if (qnext == queued)
+	qnext = queued = 0;
+    if (queued == qmax) {
+	if ((q = realloc(queue, (qmax ? qmax * 2 : 64) * sizeof(int))) == NULL)
+	    return;
+	queue = q;
+	qmax = qmax ? qmax * 2 : 64;
+    }
+    t->nodes[n].flags |= N_DIRTY;
+    queue[queued++] = n;
+}
+
+
+ /* The next directory to read again, or NONE. */
+int
+wt_next(t)
+    struct tree    *t;
+{
+    int             n;
+
+    while (qnext < queued) {
+	n = queue[qnext++];
+	t->nodes[n].flags &= ~N_DIRTY;
+	if (!t_gone(t, n))
+	    return n;
+    }
+    qnext = queued = 0;
+    return NONE;
+}
+
+
+ /* A node is about to be read again: what it counted before is its. */
+void
+wt_rescan()
+{
+    gen++;
+}
+
+
+ /* The slot for (dev, ino), or the free one it would go in. */
+static struct claim *
+find(dev, ino)
+    dev_t           dev;
+    ino_t           ino;
+{
+    size_t          i;
+
+    i = ((unsigned long long) ino * 0x9E3779B97F4A7C15ULL ^ dev)
+	& (nclaims - 1);
+    while (claims[i].node != NONE
+	   && (claims[i].ino != ino || claims[i].dev != dev))
+	i = (i + 1) & (nclaims - 1);
+    return &claims[i];
+}
+
+
+ /* Double the claim table. */
+static int
+grow()
+{
+    struct claim   *old = claims, *c;
+    size_t          n = nclaims, i;
+
+    nclaims = n ? n * 2 : WT_CLAIMS;
+    if ((claims = malloc(nclaims * sizeof(struct claim))) == NULL) {
+	claims = old;
+	nclaims = n;
+	return -1;
+    }
+    for (i = 0; i < nclaims; i++)
+	claims[i].node = NONE;
+    for (i = 0; i < n; i++)
+	if (old[i].node != NONE) {
+	    c = find(old[i].dev, old[i].ino);
+	    *c = old[i];
+	}
+    free(old);
+    return 0;
+}
+
+
+ /*
+  * Node wants to count (dev, ino): may it?  It may if nobody has, if
+  * it counted it itself before this reading, or if whoever did has
+  * left the tree.  With no memory to remember it, it's counted.
+  */
+int
+wt_claim(t, node, dev, ino)
+    struct tree    *t;
+    int             node;
+    dev_t           dev;
+    ino_t           ino;
+{
+    struct claim   *c;
+
+    if (used >= nclaims / 2 && grow() < 0 && used == nclaims)
+	return 1;
+    c = find(dev, ino);
+    if (c->node == NONE) {
+	c->dev = dev;
+	c->ino = ino;
+	used++;
+    }
+    else if (c->node == node ? c->gen == gen : !t_gone(t, c->node))
+	return 0;
+    c->node = node;
+    c->gen = gen;
+    return 1;
+}
+
+
+ /* The node still in the tree that (dev, ino) is counted under, or NONE. */
+int
+wt_owner(t, dev, ino)
+    struct tree    *t;
+    dev_t           dev;
+    ino_t           ino;
+{
+    struct claim   *c;
+
+    if (nclaims == 0)
+	return NONE;
+    c = find(dev, ino);
+    if (c->node == NONE || t_gone(t, c->node))
+	return NONE;
+    return c->node;
+}
+
+
+ /* Stop watching, and forget the claims. */
+void
+wt_close()
+{
+    if (fd >= 0)
+	close(fd);
+    fd = -1;
+    free(wdnode);
+    free(queue);
+    free(claims);
+    wdnode = queue = NULL;
+    claims = NULL;
+    nwd = queued = qmax = qnext = 0;
+    nclaims = used = 0;
+}
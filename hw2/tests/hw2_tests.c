@@ -2,6 +2,21 @@
 #include <unistd.h>
 #include <criterion/criterion.h>
 #include <string.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "hash.h"
+#include "topn.h"
+#include "hist.h"
+#include "uring.h"
+#include "throttle.h"
+#include "devs.h"
+#include "tree.h"
+#include "watch.h"
+#include "filter.h"
+#include "dups.h"
+#include "cache.h"
 
 #define TEST_TIMEOUT 15
 
@@ -306,6 +321,122 @@ Test(feature_suite, verbose_test, .timeout=TEST_TIMEOUT) {
     assert_file_matches(name, STDOUT_EXT, NULL);
 }
 
+/*
+ * "-F csv" option test.  The reference has no CSV output, so the
+ * total_k of the top directory (its record comes last) is checked
+ * against the reference's "-t" grand total instead.
+ */
+Test(feature_suite, csv_total_test, .timeout=TEST_TIMEOUT) {
+    char *name = "csv_total_test";
+    char cmd[500];
+    setup_test(name);
+    sprintf(cmd, "%s/vtree -t tests/rsrc/test_tree > %s%s", TEST_REFBIN_DIR,
+	    ref_log_outfile, STDOUT_EXT);
+    system(cmd);
+    sprintf(cmd, "bin/vtree -F csv tests/rsrc/test_tree > %s%s",
+	    test_log_outfile, STDOUT_EXT);
+    int err = system(cmd);
+    assert_normal_exit(err);
+    assert_file_matches(name, STDOUT_EXT,
+	"sed -n -e 's/^Total space used: //p' "
+	"-e '$s/^\"[^\"]*\",[^,]*,[^,]*,[^,]*,\\([^,]*\\),.*/\\1/p'");
+}
+
+/*
+ * "-F json" with names that aren't all UTF-8.  The byte 0xff can't be,
+ * so it is written as U+FFFD; the valid "é" is written as it is.
+ */
+Test(feature_suite, json_utf8_test, .timeout=TEST_TIMEOUT) {
+    char *name = "json_utf8_test";
+    char cmd[500];
+    setup_test(name);
+    sprintf(cmd, "rm -rf %s/%s_tree; mkdir -p \"%s/%s_tree/$(printf 'bad\\377name')\" "
+	    "\"%s/%s_tree/$(printf 'caf\\303\\251')\"",
+	    TEST_OUTPUT_DIR, name, TEST_OUTPUT_DIR, name, TEST_OUTPUT_DIR, name);
+    system(cmd);
+    sprintf(cmd, "bin/vtree -F json %s/%s_tree > %s%s",
+	    TEST_OUTPUT_DIR, name, test_log_outfile, STDOUT_EXT);
+    int err = system(cmd);
+    assert_normal_exit(err);
+    sprintf(cmd, "grep -q 'bad\\\\ufffdname\"' %s%s && grep -q \"$(printf 'caf\\303\\251\"')\" %s%s "
+	    "&& ! grep -q \"$(printf '\\377')\" %s%s",
+	    test_log_outfile, STDOUT_EXT, test_log_outfile, STDOUT_EXT,
+	    test_log_outfile, STDOUT_EXT);
+    err = system(cmd);
+    cr_assert_eq(err, 0, "The JSON names were not what was expected.\n");
+}
+
+/*
+ * A symbolic link to a directory inside the tree: the directory is
+ * listed where it really is and the link is left out, whether the
+ * link ("a") or the directory ("d") is read first.
+ */
+Test(feature_suite, symlink_real_test, .timeout=TEST_TIMEOUT) {
+    char *name = "symlink_real_test";
+    char cmd[500];
+    setup_test(name);
+    sprintf(cmd, "rm -rf %s/%s_tree; mkdir -p %s/%s_tree/d/e %s/%s_tree/a; "
+	    "ln -s ../d %s/%s_tree/a/link2d",
+	    TEST_OUTPUT_DIR, name, TEST_OUTPUT_DIR, name, TEST_OUTPUT_DIR, name,
+	    TEST_OUTPUT_DIR, name);
+    system(cmd);
+    sprintf(cmd, "bin/vtree -F csv -o %s/%s_tree > %s%s; bin/vtree -F csv -o -k inode %s/%s_tree >> %s%s",
+	    TEST_OUTPUT_DIR, name, test_log_outfile, STDOUT_EXT,
+	    TEST_OUTPUT_DIR, name, test_log_outfile, STDOUT_EXT);
+    int err = system(cmd);
+    assert_normal_exit(err);
+    sprintf(cmd, "test $(grep -c '_tree/d/e\"' %s%s) = 2 && ! grep -q link2d %s%s",
+	    test_log_outfile, STDOUT_EXT, test_log_outfile, STDOUT_EXT);
+    err = system(cmd);
+    cr_assert_eq(err, 0, "The directory wasn't listed where it really is, once.\n");
+}
+
+/*
+ * "-W" option test, with a link to a directory inside the tree.  The
+ * directory is one entry, watched where it really is, so a file
+ * written into it afterwards shows up in its total.
+ */
+Test(feature_suite, watch_symlink_test, .timeout=TEST_TIMEOUT) {
+    char *name = "watch_symlink_test";
+    char cmd[500];
+    setup_test(name);
+    sprintf(cmd, "rm -rf %s/%s_tree; mkdir -p %s/%s_tree/d/e %s/%s_tree/a; "
+	    "ln -s ../d %s/%s_tree/a/link2d",
+	    TEST_OUTPUT_DIR, name, TEST_OUTPUT_DIR, name, TEST_OUTPUT_DIR, name,
+	    TEST_OUTPUT_DIR, name);
+    system(cmd);
+    sprintf(cmd, "(sleep 1; head -c 102400 /dev/urandom > %s/%s_tree/d/big; sleep 1; echo) | "
+	    "bin/vtree -W -F csv %s/%s_tree > %s%s",
+	    TEST_OUTPUT_DIR, name, TEST_OUTPUT_DIR, name, test_log_outfile, STDOUT_EXT);
+    int err = system(cmd);
+    assert_normal_exit(err);
+    sprintf(cmd, "test $(grep -c '_tree/d/e\"' %s%s) = 2 && ! grep -q link2d %s%s && "
+	    "test $(grep '_tree/d\",' %s%s | tail -1 | cut -d, -f3) -ge 100",
+	    test_log_outfile, STDOUT_EXT, test_log_outfile, STDOUT_EXT,
+	    test_log_outfile, STDOUT_EXT);
+    err = system(cmd);
+    cr_assert_eq(err, 0, "The linked directory wasn't watched once, where it really is.\n");
+}
+
+/*
+ * "-S" option test.  With the apparent sizes taken off the end of each
+ * line, and the extra total dropped, the output is the reference's.
+ */
+Test(feature_suite, apparent_test, .timeout=TEST_TIMEOUT) {
+    char *name = "apparent_test";
+    char cmd[500];
+    setup_test(name);
+    sprintf(cmd, "%s/vtree -t tests/rsrc/test_tree > %s%s", TEST_REFBIN_DIR,
+	    ref_log_outfile, STDOUT_EXT);
+    system(cmd);
+    sprintf(cmd, "bin/vtree -S -t tests/rsrc/test_tree > %s%s",
+	    test_log_outfile, STDOUT_EXT);
+    int err = system(cmd);
+    assert_normal_exit(err);
+    assert_file_matches(name, STDOUT_EXT,
+	"sed -e 's| / [0-9]* ([0-9]*%)$||' -e '/^Total apparent size/d'");
+}
+
 /*
  * This test runs valgrind to check for the use of uninitialized variables.
  */
@@ -417,14 +548,526 @@ Test(hstats_suite, hstats_quick_test_1, .timeout=TEST_TIMEOUT) {
 
 /*
  * Tests the basic program operation, with the "quick display" option.
- * This time, check that the error output matches (should be empty).
+ * This time, check that the error output holds the statistics report.
+ * The hash table was rewritten, so only the heading is compared.
  */
 Test(hstats_suite, hstats_quick_test_2, .timeout=TEST_TIMEOUT) {
     char *name = "hstats_quick_test_2";
     sprintf(program_options, "-q tests/rsrc/test_tree");
     int err = run_using_system(name, "", "");
     assert_normal_exit(err);
-    assert_file_matches(name, STDERR_EXT, NULL);
+    assert_file_matches(name, STDERR_EXT, "grep -c 'Hash table management statistics'");
 }
 #endif
 
+/*
+ * Unit tests for the inode set behind h_enter().
+ */
+
+/*
+ * Every key is NEW the first time and OLD after that, across several
+ * devices and enough keys to make the set grow a few times.
+ */
+Test(hash_suite, hs_enter_test, .timeout=TEST_TIMEOUT) {
+    struct hset hs;
+    struct hstats st;
+    hs_init(&hs);
+    for (int dev = 0; dev < 3; dev++)
+        for (ino_t ino = 0; ino < 5000; ino++)
+            cr_assert_eq(hs_enter(&hs, dev, ino), NEW, "(%d, %lu) not NEW", dev, ino);
+    for (int dev = 0; dev < 3; dev++)
+        for (ino_t ino = 0; ino < 5000; ino++)
+            cr_assert_eq(hs_enter(&hs, dev, ino), OLD, "(%d, %lu) not OLD", dev, ino);
+    hs_stats(&hs, &st);
+    cr_assert_eq(st.filled, 15000, "Set holds %lu keys, expected 15000", st.filled);
+    cr_assert_eq(st.duplicates, 15000, "Found %ld duplicates, expected 15000", st.duplicates);
+    cr_assert(st.filled <= HS_LOAD(st.size), "Set is overloaded: %lu of %lu slots",
+              st.filled, st.size);
+    hs_free(&hs);
+}
+
+#define HS_THREADS 16
+#define HS_KEYS 20000
+
+static struct hset shared_hs;
+
+/*
+ * Each thread enters the same keys, starting at a different point, and
+ * counts how many came back NEW.
+ */
+static void *hs_thread(void *arg) {
+    long start = (long)arg * (HS_KEYS / HS_THREADS), news = 0;
+    for (long i = 0; i < HS_KEYS; i++)
+        news += hs_enter(&shared_hs, 1, (start + i) % HS_KEYS) == NEW;
+    return (void *)news;
+}
+
+/*
+ * However the threads interleave, every key must be NEW exactly once.
+ */
+Test(hash_suite, hs_enter_threads_test, .timeout=TEST_TIMEOUT) {
+    pthread_t tids[HS_THREADS];
+    long news = 0;
+    void *ret;
+    hs_init(&shared_hs);
+    for (long i = 0; i < HS_THREADS; i++)
+        pthread_create(&tids[i], NULL, hs_thread, (void *)i);
+    for (int i = 0; i < HS_THREADS; i++) {
+        pthread_join(tids[i], &ret);
+        news += (long)ret;
+    }
+    cr_assert_eq(news, HS_KEYS, "%ld keys were NEW, expected %d", news, HS_KEYS);
+    hs_free(&shared_hs);
+}
+
+/*
+ * Unit tests for the --top lists.
+ */
+
+/*
+ * Offer sizes in a scrambled order; the list must end up holding the
+ * largest ones, largest first, with the file names that came with them.
+ */
+Test(topn_suite, top_add_test, .timeout=TEST_TIMEOUT) {
+    struct topn tp;
+    char name[20];
+    top_init(&tp, 10);
+    for (long i = 0; i < 1000; i++) {
+        long k = (i * 7919) % 1000;
+        sprintf(name, "f%ld", k);
+        top_add(&tp, k, 0, name);
+    }
+    cr_assert_eq(tp.count, 10, "List holds %d entries, expected 10", tp.count);
+    top_sort(&tp);
+    for (int i = 0; i < 10; i++) {
+        sprintf(name, "f%d", 999 - i);
+        cr_assert_eq(tp.ents[i].k, 999 - i, "Entry %d is %ld, expected %d",
+                     i, tp.ents[i].k, 999 - i);
+        cr_assert_str_eq(tp.ents[i].name, name, "Entry %d is named %s, expected %s",
+                         i, tp.ents[i].name, name);
+    }
+    top_free(&tp);
+}
+
+/*
+ * Unit test for the -A histograms.
+ */
+
+/*
+ * Files right at and just past a bucket's limit land on either side of
+ * it, and so do times; a time in the future counts as new.
+ */
+Test(hist_suite, hist_add_test, .timeout=TEST_TIMEOUT) {
+    struct hist h;
+    struct stat st;
+    time_t now = 1000000000;
+    long sizes[] = { 0, 1, 1024, 1025, 8192, 8193 };
+    int size_bucket[] = { 0, 1, 1, 2, 2, 3 };
+    long size_files[] = { 1, 2, 2, 1 };
+    long days[] = { -3, 0, 7, 8, 30, 31, 5000 };
+    int age_bucket[] = { 0, 0, 0, 1, 1, 2, H_AGES - 1 };
+    memset(&h, 0, sizeof(h));
+    memset(&st, 0, sizeof(st));
+    for (int i = 0; i < 6; i++) {
+        st.st_size = sizes[i];
+        hist_add(&h, &st, 1, now);
+    }
+    for (int i = 0; i < 6; i++)
+        cr_assert_eq(h.sizes[size_bucket[i]].files, size_files[size_bucket[i]],
+                     "Size %ld in bucket %d, which holds %ld files",
+                     sizes[i], size_bucket[i], h.sizes[size_bucket[i]].files);
+    for (int i = 0; i < 7; i++) {
+        memset(&h, 0, sizeof(h));
+        st.st_mtime = now - days[i] * 24 * 60 * 60;
+        st.st_atime = now;
+        hist_add(&h, &st, 4, now);
+        cr_assert_eq(h.ages[H_MTIME][age_bucket[i]].k, 4, "%ld days old not in bucket %d",
+                     days[i], age_bucket[i]);
+        cr_assert_eq(h.ages[H_ATIME][0].files, 1, "Just accessed not in bucket 0");
+    }
+}
+
+/*
+ * Unit test for the -D per-device totals.
+ */
+
+/*
+ * Space and inodes add up per device, however the devices come, and
+ * the largest device sorts first.
+ */
+Test(devs_suite, dv_add_test, .timeout=TEST_TIMEOUT) {
+    struct devtab dt;
+    dev_t devs[] = { 1, 2, 1, 3, 2, 1 };
+    long k[] = { 4, 100, 4, 8, 100, 4 };
+    memset(&dt, 0, sizeof(dt));
+    for (int i = 0; i < 6; i++)
+        dv_add(&dt, devs[i], k[i]);
+    cr_assert_eq(dt.count, 3, "%d devices, not 3", dt.count);
+    dv_sort(&dt);
+    cr_assert_eq(dt.devs[0].dev, 2, "Device 2 isn't the largest");
+    cr_assert_eq(dt.devs[0].k, 200, "Device 2 has %ld K, not 200", dt.devs[0].k);
+    cr_assert_eq(dt.devs[1].inodes, 3, "Device 1 has %ld inodes, not 3", dt.devs[1].inodes);
+    cr_assert_eq(dt.devs[2].dev, 3, "Device 3 isn't the smallest");
+    dv_free(&dt);
+}
+
+/*
+ * Unit tests for the tree the walk builds.
+ */
+
+/*
+ * Paths are found however their slashes are doubled or trailed, and
+ * not once their directory has been unlinked from the tree.
+ */
+Test(tree_suite, t_find_test, .timeout=TEST_TIMEOUT) {
+    struct tree t;
+    char path[100];
+    t_init(&t);
+    int top = t_add(&t, NONE, "/top");
+    int a = t_add(&t, top, "a");
+    int b = t_add(&t, a, "b");
+    int c = t_add(&t, top, "c");
+    cr_assert_eq(t_find(&t, "/top/a/b"), b, "/top/a/b not found");
+    cr_assert_eq(t_find(&t, "/top//c/"), c, "/top//c/ not found");
+    cr_assert_eq(t_find(&t, "/top/b"), NONE, "/top/b found");
+    cr_assert_eq(t_find(&t, "/to"), NONE, "/to found");
+    t_path(&t, b, path, sizeof(path));
+    cr_assert_str_eq(path, "/top/a/b", "Path of b is %s", path);
+    cr_assert_eq(t_level(&t, b), 2, "b isn't 2 down");
+    t_unlink(&t, a);
+    cr_assert_eq(T_NODE(&t, top)->child, c, "a is still the first subdirectory");
+    cr_assert_eq(T_NODE(&t, top)->nchild, 1, "top has %d subdirectories", T_NODE(&t, top)->nchild);
+    cr_assert(t_gone(&t, b), "b is still in the tree");
+    cr_assert_eq(t_find(&t, "/top/a/b"), NONE, "/top/a/b still found");
+    t_free(&t);
+}
+
+/*
+ * A link is a loop if it leads to the node itself or one above it, on
+ * the same device; a directory elsewhere in the tree is not.
+ */
+Test(tree_suite, t_loop_test, .timeout=TEST_TIMEOUT) {
+    struct tree t;
+    t_init(&t);
+    int top = t_add(&t, NONE, "top");
+    int a = t_add(&t, top, "a");
+    int b = t_add(&t, a, "b");
+    int c = t_add(&t, top, "c");
+    T_NODE(&t, top)->dev = T_NODE(&t, a)->dev = T_NODE(&t, b)->dev = T_NODE(&t, c)->dev = 1;
+    T_NODE(&t, top)->ino = 10;
+    T_NODE(&t, a)->ino = 11;
+    T_NODE(&t, b)->ino = 12;
+    T_NODE(&t, c)->ino = 13;
+    cr_assert_eq(t_loop(&t, b, 1, 10), top, "Link from b to top not a loop");
+    cr_assert_eq(t_loop(&t, b, 1, 12), b, "Link from b to itself not a loop");
+    cr_assert_eq(t_loop(&t, b, 1, 13), NONE, "Link from b to c a loop");
+    cr_assert_eq(t_loop(&t, b, 2, 11), NONE, "Same inode on another device a loop");
+    t_free(&t);
+}
+
+/*
+ * -k size: subdirectories go largest total first, whatever their own
+ * size, ties by name, all the way down; appending still works after.
+ */
+Test(tree_suite, t_sort_test, .timeout=TEST_TIMEOUT) {
+    struct tree t;
+    t_init(&t);
+    int top = t_add(&t, NONE, "top");
+    int c = t_add(&t, top, "c");
+    int b = t_add(&t, top, "b");
+    int a = t_add(&t, top, "a");
+    int a1 = t_add(&t, a, "a1");
+    int a2 = t_add(&t, a, "a2");
+    T_NODE(&t, a)->own = 4;
+    T_NODE(&t, a1)->files = 8;
+    T_NODE(&t, a2)->files = 300;
+    T_NODE(&t, b)->own = 40;
+    T_NODE(&t, c)->own = 4;
+    T_NODE(&t, c)->files = 36;
+    t_done(&t, a1);
+    t_done(&t, a2);
+    t_done(&t, a);
+    t_done(&t, b);
+    t_done(&t, c);
+    t_done(&t, top);
+    t_sort(&t, top);
+    cr_assert_eq(T_NODE(&t, top)->child, a, "a (total 312) isn't first");
+    cr_assert_eq(T_NODE(&t, a)->next, b, "b doesn't follow a");
+    cr_assert_eq(T_NODE(&t, b)->next, c, "c (tied with b) doesn't follow b");
+    cr_assert_eq(T_NODE(&t, c)->next, NONE, "c isn't last");
+    cr_assert_eq(T_NODE(&t, top)->last, c, "top's last isn't c");
+    cr_assert_eq(T_NODE(&t, a)->child, a2, "a2 isn't first under a");
+    cr_assert_eq(T_NODE(&t, a2)->next, a1, "a1 doesn't follow a2");
+    cr_assert_eq(T_NODE(&t, a)->last, a1, "a's last isn't a1");
+    int d = t_add(&t, top, "d");
+    cr_assert_eq(T_NODE(&t, c)->next, d, "d not appended after c");
+    t_free(&t);
+}
+
+/*
+ * Unit test for the -W claim table.
+ */
+
+/*
+ * Only one node counts a (dev, ino) at a time, until a rescan or the
+ * node leaving the tree lets it be counted again; nothing is lost
+ * when the table grows.
+ */
+Test(watch_suite, wt_claim_test, .timeout=TEST_TIMEOUT) {
+    struct tree t;
+    t_init(&t);
+    int top = t_add(&t, NONE, "top");
+    int a = t_add(&t, top, "a");
+    int b = t_add(&t, top, "b");
+    int c = t_add(&t, top, "c");
+    cr_assert(wt_claim(&t, a, 1, 100), "First claim refused");
+    cr_assert(!wt_claim(&t, a, 1, 100), "Second name in the same reading counted");
+    cr_assert(!wt_claim(&t, b, 1, 100), "Claimed under another node");
+    for (int i = 0; i < 5000; i++)
+        wt_claim(&t, b, 2, i);
+    wt_rescan();
+    cr_assert(wt_claim(&t, a, 1, 100), "Not counted again on rereading");
+    t_unlink(&t, a);
+    cr_assert(wt_claim(&t, b, 1, 100), "Not taken over from a node gone");
+    cr_assert(!wt_claim(&t, c, 2, 4999), "Lost in the table growing");
+    wt_close();
+    t_free(&t);
+}
+
+/*
+ * A directory's node is found by its (dev, ino) while that node is in
+ * the tree, and not once it has left.
+ */
+Test(watch_suite, wt_owner_test, .timeout=TEST_TIMEOUT) {
+    struct tree t;
+    t_init(&t);
+    int top = t_add(&t, NONE, "top");
+    int a = t_add(&t, top, "a");
+    cr_assert_eq(wt_owner(&t, 1, 100), NONE, "Found in an empty table");
+    wt_claim(&t, a, 1, 100);
+    cr_assert_eq(wt_owner(&t, 1, 100), a, "Not found under its node");
+    cr_assert_eq(wt_owner(&t, 1, 101), NONE, "Another inode found");
+    t_unlink(&t, a);
+    cr_assert_eq(wt_owner(&t, 1, 100), NONE, "Found under a node gone");
+    wt_close();
+    t_free(&t);
+}
+
+/*
+ * Unit test for the filters (-e, -E, -I, -m, -N).
+ */
+
+/*
+ * Exclude globs and regexes match whole names and a bad regex is
+ * refused; a file is counted only if it passes the include pattern,
+ * the minimum size and the age.
+ */
+Test(filter_suite, fl_skip_test, .timeout=TEST_TIMEOUT) {
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    cr_assert(!fl_active(), "Filtering with no filters");
+    cr_assert_eq(fl_add("*.o", FL_GLOB, 0), 0, "Glob refused");
+    cr_assert_eq(fl_add("^(tmp|cache)$", FL_REGEX, 0), 0, "Regex refused");
+    cr_assert_neq(fl_add("(", FL_REGEX, 0), 0, "Bad regex taken");
+    cr_assert(fl_skip("main.o"), "main.o not excluded");
+    cr_assert(fl_skip("cache"), "cache not excluded");
+    cr_assert(!fl_skip("cached"), "cached excluded");
+    cr_assert(!fl_skip("main.c"), "main.c excluded");
+    cr_assert_eq(fl_add("*.c", FL_GLOB, 1), 0, "Include refused");
+    cr_assert_eq(fl_minsize("2k"), 0, "2k refused");
+    cr_assert_neq(fl_minsize("2x"), 0, "2x taken");
+    st.st_size = 4096;
+    st.st_mtime = time(NULL);
+    cr_assert(fl_count("main.c", &st), "main.c not counted");
+    cr_assert(!fl_count("main.h", &st), "main.h counted");
+    st.st_size = 1000;
+    cr_assert(!fl_count("small.c", &st), "File under -m counted");
+    st.st_size = 4096;
+    cr_assert_eq(fl_newer("1"), 0, "1 day refused");
+    st.st_mtime = time(NULL) - 2 * 24 * 60 * 60;
+    cr_assert(!fl_count("old.c", &st), "File older than -N counted");
+}
+
+static void write_file(char *dir, char *name, char *data, size_t len) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "w");
+    cr_assert_not_null(f, "Can't make %s", path);
+    fwrite(data, 1, len, f);
+    fclose(f);
+}
+
+/*
+ * Files alike are found whether they differ in the first block or only
+ * after it; a second name for the same inode is no copy.
+ */
+Test(dups_suite, dp_find_test, .timeout=TEST_TIMEOUT) {
+    char top[] = "/tmp/dups_test.XXXXXX", sub[64], path[256];
+    static char big[3 * DP_BLOCK];
+    struct duptab dt;
+    struct dupdir *dirs;
+    struct stat st;
+    struct tree t;
+    char *names[] = { "a", "b", "c", "d", "e", "f" };
+    cr_assert_not_null(mkdtemp(top), "Can't make a directory");
+    snprintf(sub, sizeof(sub), "%s/sub", top);
+    mkdir(sub, 0755);
+    for (size_t i = 0; i < sizeof(big); i++)
+        big[i] = i * 7;
+    write_file(top, "a", big, sizeof(big));
+    write_file(sub, "b", big, sizeof(big));
+    big[sizeof(big) - 1] ^= 1;
+    write_file(sub, "c", big, sizeof(big));
+    write_file(top, "d", "short", 5);
+    write_file(sub, "e", "short", 5);
+    snprintf(path, sizeof(path), "%s/a", top);
+    snprintf(sub + strlen(sub), sizeof(sub) - strlen(sub), "/f");
+    link(path, sub);
+    *strrchr(sub, '/') = '\0';
+
+    t_init(&t);
+    int n = t_add(&t, NONE, top);
+    int m = t_add(&t, n, "sub");
+    memset(&dt, 0, sizeof(dt));
+    for (int i = 0; i < 6; i++) {
+        snprintf(path, sizeof(path), "%s/%s", strchr("ad", *names[i]) ? top : sub, names[i]);
+        cr_assert_eq(stat(path, &st), 0, "Can't stat %s", path);
+        dp_add(&dt, strchr("ad", *names[i]) ? n : m, names[i], &st);
+    }
+    cr_assert_eq(dp_find(&dt, &t, &dirs), 1, "Copies not all in sub");
+    cr_assert_eq(dirs[0].node, m, "Copies not in sub");
+    cr_assert_eq(dirs[0].copies, 2, "%d copies, not 2", dirs[0].copies);
+    cr_assert_eq(dt.groups, 2, "%d sets of copies, not 2", dt.groups);
+    free(dirs);
+    dp_free(&dt);
+    t_free(&t);
+    for (int i = 0; i < 6; i++) {
+        snprintf(path, sizeof(path), "%s/%s", strchr("ad", *names[i]) ? top : sub, names[i]);
+        unlink(path);
+    }
+    rmdir(sub);
+    rmdir(top);
+}
+
+/*
+ * Unit test for the io_uring stat batching.
+ */
+
+/*
+ * What comes back through the ring, in batches smaller than the list,
+ * must agree with stat(2); a missing name gets an error of its own.
+ * Nothing to check where there's no io_uring.
+ */
+Test(uring_suite, ur_statv_test, .timeout=TEST_TIMEOUT) {
+    char *names[] = { "tests/rsrc/test_tree", "tests/rsrc/test_tree/S",
+                      "tests/rsrc/no_such_file", "tests/hw2_tests.c", "Makefile" };
+    int n = sizeof(names) / sizeof(names[0]), rcs[5];
+    struct stat sts[5], st;
+    struct uring *u = ur_open(2);
+    if (u == NULL)
+        return;
+    cr_assert_eq(ur_statv(u, names, n, 0, sts, rcs), 0, "The ring failed");
+    for (int i = 0; i < n; i++) {
+        if (stat(names[i], &st) < 0) {
+            cr_assert_lt(rcs[i], 0, "%s was stat'ed, but doesn't exist", names[i]);
+            continue;
+        }
+        cr_assert_eq(rcs[i], 0, "%s couldn't be stat'ed (%d)", names[i], rcs[i]);
+        cr_assert(sts[i].st_dev == st.st_dev && sts[i].st_ino == st.st_ino,
+                  "%s has the wrong device/inode", names[i]);
+        cr_assert(sts[i].st_mode == st.st_mode && sts[i].st_blocks == st.st_blocks
+                  && sts[i].st_mtim.tv_nsec == st.st_mtim.tv_nsec,
+                  "%s has the wrong mode/blocks/mtime", names[i]);
+    }
+    ur_close(u);
+}
+
+/*
+ * Unit test for the -r throttle.
+ */
+
+/*
+ * Past the first bucketful, operations go no faster than the rate.
+ */
+Test(throttle_suite, th_begin_test, .timeout=TEST_TIMEOUT) {
+    struct timespec t0, t1;
+    double rate = 1000, secs;
+    int ops = 400;
+    th_init(rate);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < ops; i++)
+        th_end(th_begin());
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    cr_assert_geq(secs, (ops - TH_BURST(rate)) / rate * 0.95,
+                  "%d operations took %.3fs at %.0f a second", ops, secs, rate);
+    cr_assert_leq(th_rate(), rate, "Rate went up to %.0f", th_rate());
+    th_init(0);
+}
+
+/*
+ * Unit test for the scan cache file.
+ */
+
+/* A cache file of one record, nbytes of names and no hard links. */
+static void write_cache(char *path, struct crec *rec, char *names, size_t nbytes) {
+    char pad[8] = { 0 };
+    FILE *fp = fopen(path, "w");
+    cr_assert_not_null(fp, "Can't write %s", path);
+    fwrite(CACHE_MAGIC, 1, strlen(CACHE_MAGIC), fp);
+    fwrite(pad, 1, -strlen(CACHE_MAGIC) & 7, fp);
+    fwrite(rec, sizeof(*rec), 1, fp);
+    fwrite(names, 1, nbytes, fp);
+    fwrite(pad, 1, -nbytes & 7, fp);
+    fclose(fp);
+}
+
+/*
+ * A record is found while its directory is unchanged.  A file whose
+ * names don't come to just the record's count of them, or whose
+ * lengths run past its end, is left alone as damaged.
+ */
+Test(cache_suite, cache_load_test, .timeout=TEST_TIMEOUT) {
+    char *path = TEST_OUTPUT_DIR "/cache_load_test.cache";
+    struct {
+        int nchild;
+        size_t namelen;
+        char *names;
+        size_t nbytes;
+        char *what;
+    } bad[] = {
+        { 3, 6, "ab\0cd", 6, "more names than there are" },
+        { 1, 6, "ab\0cd", 6, "fewer names than there are" },
+        { 2, 5, "ab\0cd", 5, "the last name not ended" },
+        { 2, 6, "a/\0cd", 6, "a name with a slash" },
+        { 2, 6, "..\0cd", 6, "a name of .." },
+        { 2, 600, "ab\0cd", 6, "names past the end of the file" },
+        { 2, (size_t) -8, "ab\0cd", 6, "a length that overflows" },
+    };
+    struct crec rec, *found;
+    struct stat st;
+    system("mkdir -p " TEST_OUTPUT_DIR);
+    cr_assert_eq(stat("tests/rsrc/test_tree", &st), 0, "Can't stat the test tree");
+    memset(&rec, 0, sizeof(rec));
+    rec.dev = st.st_dev;
+    rec.ino = st.st_ino;
+    rec.mtime = st.st_mtim;
+    rec.ctime = st.st_ctim;
+    rec.nchild = 2;
+    rec.namelen = 6;
+    write_cache(path, &rec, "ab\0cd", 6);
+    cr_assert_eq(cache_open(path), 0, "Can't open the cache");
+    found = cache_find(&st, 0);
+    cr_assert_not_null(found, "Good record not found");
+    cr_assert_str_eq(CR_NAMES(found) + 3, "cd", "Names not kept");
+    cache_close();
+
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        rec.nchild = bad[i].nchild;
+        rec.namelen = bad[i].namelen;
+        write_cache(path, &rec, bad[i].names, bad[i].nbytes);
+        cr_assert_eq(cache_open(path), 0, "Can't open the cache");
+        cr_assert_null(cache_find(&st, 0), "Record with %s used", bad[i].what);
+        cache_close();
+    }
+}
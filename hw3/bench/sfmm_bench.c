@@ -0,0 +1,296 @@
+/**
+ * Microbenchmark for the allocator's fast paths.
+ *
+ * Times the size-class lookup on its own, then a window of large buffers (2 to 6K)
+ * freed and replaced at random, printing how big the heap had to grow for them and
+ * how many requests it could not satisfy. Then sf_malloc/sf_free pairs of small
+ * sizes, a window of live blocks of mixed sizes that are freed and replaced
+ * round robin, and bursts of 64 allocations that are then all freed. Then a
+ * buffer grown 64 bytes at a time with sf_realloc, up to 8K and back. The last
+ * two cases fill a free list with blocks that are all a little too small, kept
+ * apart by allocated ones: 384 and 448 bytes when asking for 512, then 2240
+ * bytes when asking for 2304. Each case runs a number of times and the median
+ * ns per operation is printed.
+ *
+ *   sfmm_bench [ -n operations ] [ -r runs ] [ -d threshold ] [ -g ] [ -i ]
+ *
+ * -d, -g and -i run it all with deferred coalescing, geometric heap growth or
+ * in-place sf_realloc (see include/sfmm_modes.h).
+ *
+ * Lives in bench/ rather than tests/, because every .c under tests/ is linked
+ * into the criterion binary.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sfmm.h"
+#include "sfmm_modes.h"
+
+#define BENCH_OPS 1000000    //operations per run
+#define BENCH_RUNS 5         //runs per case, the median is kept
+#define BENCH_SIZES 4096     //precomputed request sizes, a power of 2
+#define BENCH_WINDOW 16      //live blocks in the mixed case
+#define BENCH_MAX_SIZE 2048  //largest request in the mixed case
+#define BENCH_FRAGMENTS 80   //most free blocks too small for the request in the fragmented cases
+#define BENCH_LARGE_WINDOW 10  //live buffers in the large case
+#define BENCH_LARGE_MIN 2200   //their sizes
+#define BENCH_LARGE_MAX 6000
+#define BENCH_BURST 64         //allocations in a burst
+#define BENCH_GROW_STEPS 128   //64 byte steps up to the largest buffer in the realloc case
+
+int find_fib_index(unsigned long size_class);
+unsigned long find_blocksize(size_t size);
+
+static size_t sizes[BENCH_SIZES];
+static volatile unsigned long sink;
+static long large_failed;
+static size_t fragmented_request;
+
+//xorshift, so that every build sees the same request sizes
+static unsigned long next_random(unsigned long *state)
+{
+    unsigned long x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//size class lookup for every request size, as sf_malloc does it
+static void bench_index(long ops)
+{
+    unsigned long total = 0;
+    for(long i = 0; i < ops; i++)
+    {
+        total += find_fib_index(find_blocksize(sizes[i & (BENCH_SIZES - 1)]) / 64UL);
+    }
+    sink = total;
+}
+
+//a window of large buffers, a random one replaced each time
+static void bench_large(long ops)
+{
+    void *live[BENCH_LARGE_WINDOW] = { NULL };
+    unsigned long state = 2463534242UL;
+    for(long i = 0; i < ops; i++)
+    {
+        int slot = next_random(&state) % BENCH_LARGE_WINDOW;
+        if(live[slot] != NULL)
+        {
+            sf_free(live[slot]);
+        }
+        live[slot] = sf_malloc(BENCH_LARGE_MIN + next_random(&state) % (BENCH_LARGE_MAX - BENCH_LARGE_MIN));
+        if(live[slot] == NULL)
+        {
+            large_failed++;
+        }
+    }
+    for(int slot = 0; slot < BENCH_LARGE_WINDOW; slot++)
+    {
+        if(live[slot] != NULL)
+        {
+            sf_free(live[slot]);
+        }
+    }
+}
+
+//malloc and free straight away, sizes up to 64 bytes
+static void bench_small(long ops)
+{
+    for(long i = 0; i < ops; i++)
+    {
+        void *p = sf_malloc((sizes[i & (BENCH_SIZES - 1)] & 63) + 1);
+        sf_free(p);
+    }
+}
+
+//a window of live blocks of mixed sizes, the oldest replaced each time
+static void bench_mixed(long ops)
+{
+    void *live[BENCH_WINDOW] = { NULL };
+    for(long i = 0; i < ops; i++)
+    {
+        int slot = i % BENCH_WINDOW;
+        if(live[slot] != NULL)
+        {
+            sf_free(live[slot]);
+        }
+        live[slot] = sf_malloc(sizes[i & (BENCH_SIZES - 1)]);
+    }
+    for(int slot = 0; slot < BENCH_WINDOW; slot++)
+    {
+        if(live[slot] != NULL)
+        {
+            sf_free(live[slot]);
+        }
+    }
+}
+
+//BENCH_BURST mallocs of mixed sizes up to 512 bytes, then all of them freed
+static void bench_burst(long ops)
+{
+    void *burst[BENCH_BURST];
+    for(long i = 0; i < ops; i += 2 * BENCH_BURST)
+    {
+        for(int j = 0; j < BENCH_BURST; j++)
+        {
+            burst[j] = sf_malloc((sizes[(i + j) & (BENCH_SIZES - 1)] & 511) + 1);
+        }
+        for(int j = 0; j < BENCH_BURST; j++)
+        {
+            sf_free(burst[j]);
+        }
+    }
+}
+
+//one buffer grown 64 bytes at a time with sf_realloc, then started again from 64 bytes
+static void bench_realloc(long ops)
+{
+    char *buffer = sf_malloc(1);
+    for(long i = 0; i < ops; i++)
+    {
+        char *grown = sf_realloc(buffer, (i % BENCH_GROW_STEPS + 1) * 64 - 8);
+        if(grown == NULL)
+        {
+            break;
+        }
+        buffer = grown;
+        buffer[0] = (char)i;
+    }
+    sf_free(buffer);
+}
+
+//malloc and free a block bigger than any in its own free list
+static void bench_fragmented(long ops)
+{
+    for(long i = 0; i < ops; i++)
+    {
+        void *p = sf_malloc(fragmented_request);
+        sf_free(p);
+    }
+}
+
+//Leaves count free blocks, of the two block sizes in turn, each after an allocated one
+static void make_fragments(void *separators[], int count, size_t size1, size_t size2)
+{
+    void *fragments[BENCH_FRAGMENTS];
+    for(int i = 0; i < count; i++)
+    {
+        fragments[i] = sf_malloc((i % 2 ? size2 : size1) - 8);
+        separators[i] = sf_malloc(1);
+    }
+    for(int i = 0; i < count; i++)
+    {
+        sf_free(fragments[i]);
+    }
+}
+
+static void free_separators(void *separators[], int count)
+{
+    for(int i = 0; i < count; i++)
+    {
+        sf_free(separators[i]);
+    }
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void run_case(char *name, void (*bench)(long), long ops, int runs)
+{
+    double times[runs];
+    for(int r = 0; r < runs; r++)
+    {
+        double start = now_ns();
+        bench(ops);
+        times[r] = (now_ns() - start) / ops;
+    }
+    qsort(times, runs, sizeof(times[0]), compare_doubles);
+    printf("%-28s %8.2f ns/op  (min %.2f, max %.2f)\n", name, times[runs / 2], times[0], times[runs - 1]);
+}
+
+int main(int argc, char *argv[])
+{
+    long ops = BENCH_OPS;
+    int runs = BENCH_RUNS;
+    int c;
+
+    while((c = getopt(argc, argv, "n:r:d:gi")) != -1)
+    {
+        switch(c)
+        {
+            case 'n':
+                ops = atol(optarg);
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                break;
+            case 'd':
+                sf_set_deferred_coalescing(atoi(optarg));
+                break;
+            case 'g':
+                sf_set_geometric_growth(1);
+                break;
+            case 'i':
+                sf_set_realloc_in_place(1);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [ -n operations ] [ -r runs ] [ -d threshold ] [ -g ] [ -i ]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if(ops <= 0 || runs <= 0)
+    {
+        fprintf(stderr, "%s: operations and runs must be positive\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    unsigned long state = 88172645463325252UL;
+    for(int i = 0; i < BENCH_SIZES; i++)
+    {
+        sizes[i] = next_random(&state) % BENCH_MAX_SIZE + 1;
+    }
+
+    sf_mem_init();
+
+    printf("%ld operations, median of %d runs\n", ops, runs);
+    run_case("size class lookup", bench_index, ops, runs);
+    run_case("malloc/free large", bench_large, ops, runs);
+    printf("%-28s %8ld bytes, %ld of %ld requests failed\n", "  heap grown to",
+        (long)((char *)sf_mem_end() - (char *)sf_mem_start()), large_failed, ops * runs);
+    run_case("malloc/free 1-64", bench_small, ops, runs);
+    run_case("malloc/free mixed", bench_mixed, ops, runs);
+    run_case("malloc/free bursts", bench_burst, ops, runs);
+    run_case("realloc growing", bench_realloc, ops, runs);
+
+    void *separators[BENCH_FRAGMENTS];
+    make_fragments(separators, BENCH_FRAGMENTS, 384, 448);
+    fragmented_request = 512 - 8;
+    run_case("malloc/free fragmented", bench_fragmented, ops, runs);
+    free_separators(separators, BENCH_FRAGMENTS);
+
+    make_fragments(separators, 20, 2240, 2240);
+    fragmented_request = 2304 - 8;
+    run_case("malloc/free large fragmented", bench_fragmented, ops, runs);
+    free_separators(separators, 20);
+
+    sf_mem_fini();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,175 @@
+/**
+ * Multi-threaded benchmark for the thread-safe mode (-DSF_THREADS).
+ *
+ * Each thread keeps a small window of live blocks of 1 to 248 bytes, freeing
+ * the oldest and allocating another for every operation. It runs with 1, 2, 4,
+ * ... up to the given number of threads, first with only the global lock and
+ * then with the per-thread caches, and prints the total operations a second
+ * for each.
+ *
+ *   sfmm_mt_bench [ -n operations per thread ] [ -t most threads ] [ -r runs ]
+ *
+ * The heap is only MAX_SIZE bytes, shared by all the threads, so the windows
+ * are kept small. Requests the heap could not satisfy are counted and printed.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "sfmm.h"
+#include "sfmm_threads.h"
+
+#define BENCH_OPS 200000     //operations per thread per run
+#define BENCH_THREADS 8      //most threads
+#define BENCH_RUNS 3         //runs per case, the median is kept
+#define BENCH_WINDOW 4       //live blocks per thread
+#define BENCH_MAX_SIZE 248   //largest request, so every block can be cached
+
+struct worker {
+    pthread_t thread;
+    long ops;
+    unsigned long seed;
+    long failed;
+};
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void *run_worker(void *arg)
+{
+    struct worker *w = arg;
+    void *live[BENCH_WINDOW] = { NULL };
+    unsigned long x = w->seed;
+
+    for(long i = 0; i < w->ops; i++)
+    {
+        int slot = i % BENCH_WINDOW;
+        if(live[slot] != NULL)
+        {
+            sf_free(live[slot]);
+        }
+
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        live[slot] = sf_malloc(x % BENCH_MAX_SIZE + 1);
+        if(live[slot] == NULL)
+        {
+            w->failed++;
+        }
+        else
+        {
+            //touch the block, as a real caller would
+            *(char *)live[slot] = (char)i;
+        }
+    }
+    for(int slot = 0; slot < BENCH_WINDOW; slot++)
+    {
+        if(live[slot] != NULL)
+        {
+            sf_free(live[slot]);
+        }
+    }
+    return NULL;
+}
+
+//One run with the given number of threads, returns operations a second
+static double run_threads(int threads, long ops, long *failed)
+{
+    struct worker workers[threads];
+
+    double start = now_ns();
+    for(int t = 0; t < threads; t++)
+    {
+        workers[t].ops = ops;
+        workers[t].seed = 88172645463325252UL + t;
+        workers[t].failed = 0;
+        pthread_create(&workers[t].thread, NULL, run_worker, &workers[t]);
+    }
+    for(int t = 0; t < threads; t++)
+    {
+        pthread_join(workers[t].thread, NULL);
+        *failed += workers[t].failed;
+    }
+    return (threads * ops) / ((now_ns() - start) / 1e9);
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[])
+{
+    long ops = BENCH_OPS;
+    int max_threads = BENCH_THREADS;
+    int runs = BENCH_RUNS;
+    int c;
+
+    while((c = getopt(argc, argv, "n:t:r:")) != -1)
+    {
+        switch(c)
+        {
+            case 'n':
+                ops = atol(optarg);
+                break;
+            case 't':
+                max_threads = atoi(optarg);
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [ -n operations ] [ -t threads ] [ -r runs ]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if(ops <= 0 || max_threads <= 0 || runs <= 0)
+    {
+        fprintf(stderr, "%s: operations, threads and runs must be positive\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    sf_mem_init();
+
+    printf("%ld operations per thread, median of %d runs, %ld processors\n", ops, runs, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-8s %16s %16s %8s\n", "threads", "lock ops/s", "caches ops/s", "ratio");
+    for(int threads = 1; threads <= max_threads; threads *= 2)
+    {
+        double rates[2];
+        long failed = 0;
+
+        for(int mode = 0; mode < 2; mode++)
+        {
+            double times[runs];
+
+            sf_set_thread_caches(mode);
+            for(int r = 0; r < runs; r++)
+            {
+                times[r] = run_threads(threads, ops, &failed);
+            }
+            qsort(times, runs, sizeof(times[0]), compare_doubles);
+            rates[mode] = times[runs / 2];
+        }
+        printf("%-8d %16.0f %16.0f %7.2fx", threads, rates[0], rates[1], rates[1] / rates[0]);
+        if(failed != 0)
+        {
+            printf("  (%ld requests failed)", failed);
+        }
+        printf("\n");
+    }
+
+    sf_mem_fini();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,47 @@
+/**
+ * Consistency check of the allocator's heap, and the internals the tests drive
+ * directly. None of it is part of the interface sfmm.h describes.
+ */
+#ifndef SFMM_CHECK_H
+#define SFMM_CHECK_H
+
+#include "sfmm.h"
+
+/*
+ * Walks the heap, the free lists, the exact size bins and the red-black tree of
+ * large free blocks, and checks that they agree with each other and with the
+ * bitmaps of the lists and bins that are not empty, and that the tree is a valid
+ * red-black tree. Blocks whose free was deferred (sfmm_modes.h) must still be
+ * marked allocated, each in the bin for its size. Returns NULL when they do, or else says what the first thing it
+ * found wrong was. With -DSF_THREADS, call it while no other thread is allocating.
+ */
+const char *sf_check_heap(void);
+
+/*
+ * Checks the free lists, the exact size bins and the tree against each other,
+ * and the bins against their bitmaps, without walking the heap. Returns what is
+ * wrong, or NULL, and counts the blocks in the free lists in *free_blocks.
+ */
+const char *check_free_lists(int *free_blocks);
+
+/*
+ * Puts a free block in free list size_class_index and in the exact size bin or
+ * the tree for its size, or takes it out of them, keeping the bitmaps up to date.
+ */
+void insert_into_free_list(sf_block *block, int size_class_index);
+void remove_from_free_list(sf_block *temp_block);
+
+/*
+ * The smallest free block in the tree of at least blocksize bytes, or NULL.
+ */
+sf_block *tree_best_fit(unsigned long blocksize);
+
+/*
+ * The index of the Fibonacci free list for a size class (blocksize / 64), and
+ * the block size for a request of size bytes: the header added and rounded up
+ * to a multiple of 64, or 0 if that would overflow.
+ */
+int find_fib_index(unsigned long size_class);
+unsigned long find_blocksize(size_t size);
+
+#endif
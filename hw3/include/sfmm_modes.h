@@ -0,0 +1,32 @@
+/**
+ * Optional modes of the allocator. Both are off by default, which is the behaviour
+ * sfmm.h describes and the tests check.
+ */
+#ifndef SFMM_MODES_H
+#define SFMM_MODES_H
+
+/*
+ * Deferred coalescing. With a threshold above 0, a freed block smaller than
+ * 35 * 64 bytes is not coalesced or put in a free list. It waits, still marked
+ * allocated, and sf_malloc hands it out again for a request of the same block size.
+ * Once threshold blocks are waiting, or when sf_malloc finds nothing else that fits,
+ * they are all freed and coalesced at once. A threshold of 0 frees the waiting
+ * blocks and turns the mode off.
+ */
+void sf_set_deferred_coalescing(int threshold);
+
+/*
+ * Geometric heap growth. When the heap has to grow, it grows by at least as many
+ * pages as it already has, as far as sf_mem_grow allows.
+ */
+void sf_set_geometric_growth(int enable);
+
+/*
+ * In-place sf_realloc. A block that has to get bigger takes the free block after
+ * it, and gives back what it does not need. At the end of the heap, the heap grows
+ * under it. The block only moves when neither works. Without this mode it always
+ * moves, as the README says.
+ */
+void sf_set_realloc_in_place(int enable);
+
+#endif
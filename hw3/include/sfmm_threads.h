@@ -0,0 +1,29 @@
+/**
+ * Thread-safe mode of the allocator, compiled in with -DSF_THREADS.
+ *
+ * sf_malloc, sf_free, sf_realloc and sf_memalign then share the heap under one
+ * lock. Each thread also keeps a small cache of blocks of the smallest sizes
+ * (64 to 256 bytes). A cache is refilled from the free lists several blocks at
+ * a time and drained back to them the same way, so small sf_malloc and sf_free
+ * calls only take the lock once per batch. The cached blocks stay allocated in
+ * the heap, so nothing coalesces with them while they are cached. A thread's
+ * cache goes back to the free lists when the thread exits.
+ *
+ * sf_errno stays a single global, as sfmm.h declares it.
+ */
+#ifndef SFMM_THREADS_H
+#define SFMM_THREADS_H
+
+#define SF_CACHE_BINS 4            //cached block sizes: 64, 128, 192 and 256
+#define SF_CACHE_BATCH_BYTES 512   //bytes moved per refill or drain, at least 2 blocks
+
+/*
+ * Turns the per-thread caches on (the default) or off, leaving only the lock.
+ * Any thread may call it at any time. Turning them off returns the calling
+ * thread's cache to the free lists; other threads' cached blocks stay allocated
+ * in the heap until those threads exit, as only a thread may touch its own cache.
+ * Call it before starting other threads that allocate to keep every block free.
+ */
+void sf_set_thread_caches(int enable);
+
+#endif
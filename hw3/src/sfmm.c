@@ -3,26 +3,110 @@
  * Do not submit your assignment with a main function in this file.
  * If you submit with a main function in this file, you will get a zero.
  */
+#ifdef SF_THREADS
+#define _POSIX_C_SOURCE 200809L
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#ifdef SF_THREADS
+#include <pthread.h>
+#endif
 
 #include "debug.h"
 #include "sfmm.h"
+#include "sfmm_modes.h"
+#include "sfmm_check.h"
+#ifdef SF_THREADS
+#include "sfmm_threads.h"
+#endif
 
 #define ULONG_MAX  ((unsigned long)-1)
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p) ((p->header) & (~0x3))
 
+/* Set or clear the prev alloc bit in the header at address p, which belongs to the next block */
+#ifdef SF_THREADS
+/* That block may be allocated and sitting in a thread cache, whose thread reads its header without the lock */
+#define SET_PREV_ALLOC(p) __atomic_or_fetch((p), 0x2UL, __ATOMIC_RELAXED)
+#define CLEAR_PREV_ALLOC(p) __atomic_and_fetch((p), (~0x2UL), __ATOMIC_RELAXED)
+#else
+#define SET_PREV_ALLOC(p) ((*(p)) |= 0x2)
+#define CLEAR_PREV_ALLOC(p) ((*(p)) &= (~0x2))
+#endif
+
 static int number_of_malloc_calls = 0;
 
+/* After the free list links, a free block says which other index it is in, if any. The header
+   cannot tell, because coalescing changes the size before the block is taken out */
+#define INDEX_NONE 0
+#define INDEX_BIN 1
+#define INDEX_TREE 2
+#define INDEX_KIND(bp) (*(unsigned long *)((char *)(bp) + 32))
+
+/* Second pair of links in a free block, for its exact size bin */
+typedef struct sf_bin_links {
+    unsigned long kind;
+    struct sf_bin_links *next;
+    struct sf_bin_links *prev;
+} sf_bin_links;
+#define BIN_LINKS(bp) ((sf_bin_links *)((char *)(bp) + 32))
+#define BIN_BLOCK(lp) ((sf_block *)((char *)(lp) - 32))
+
+/* Red-black tree node in a free block of the largest Fibonacci list, ordered by size. The size
+   is kept in the node, for the same reason as the kind */
+typedef struct sf_tree_node {
+    unsigned long kind;
+    struct sf_tree_node *left;
+    struct sf_tree_node *right;
+    struct sf_tree_node *parent;
+    unsigned long size;
+    int red;
+} sf_tree_node;
+#define TREE_NODE(bp) ((sf_tree_node *)((char *)(bp) + 32))
+#define TREE_BLOCK(np) ((sf_block *)((char *)(np) - 32))
+
+static sf_tree_node *large_tree_root = NULL;
+
+/* Free blocks of 64 to 34 * 64 bytes (the last Fibonacci list bound) are also kept in a bin for
+   their exact size class, indexed by blocksize / 64, so the best fit is found without a search */
+#define NUM_EXACT_BINS 35
+static sf_bin_links exact_bins[NUM_EXACT_BINS];
+
+/* Bit i set when sf_free_list_heads[i] or exact_bins[i] is not empty */
+static unsigned long free_list_bitmap = 0;
+static unsigned long exact_bin_bitmap = 0;
+
+/* Deferred coalescing (sfmm_modes.h), off while the threshold is 0. A small block that is freed
+   stays as it is, still marked allocated, in a bin for its exact size, linked through
+   body.links.next; body.links.prev points at the bin, so that freeing it twice is caught */
+static sf_block *deferred_bins[NUM_EXACT_BINS];
+static int deferred_count = 0;
+static int deferred_threshold = 0;
+
+/* Geometric heap growth (sfmm_modes.h) */
+static int geometric_growth = 0;
+
+/* sf_realloc growing a block where it is (sfmm_modes.h) */
+static int realloc_in_place = 0;
+
 void remove_from_free_list(sf_block *temp_block);
+void insert_into_free_list(sf_block *block, int size_class_index);
+void set_wilderness_block(sf_block *block);
+void tree_insert(sf_block *block);
+void tree_remove(sf_tree_node *node);
+sf_block *tree_best_fit(unsigned long blocksize);
 void split_block(unsigned long blocksize, sf_block *big_block, int is_wildblock);
 void initialize_senteniel_nodes();
 int find_fib_index(unsigned long size_class);
+unsigned long find_blocksize(size_t size);
+sf_block *find_fit(unsigned long size_class, int size_class_index);
+unsigned long grow_heap(unsigned long needed_size);
+unsigned long grow_wildblock(sf_block *wild_block, unsigned long wildblock_blocksize, unsigned long blocksize, int new_wild_block);
+void flush_deferred();
 
-void *sf_malloc(size_t size) {
+void *sf_malloc_unlocked(size_t size) {
     if(number_of_malloc_calls == 0)
     {
         //First memory initializations
@@ -49,10 +133,7 @@ void *sf_malloc(size_t size) {
         //Set free block's prev alloc bit to 1, because header block is allocated
         (first_wild_block->header) |= 0x2;
         //Add this large free block to the last index of the segregated free lists
-        sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.next = first_wild_block;
-        sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.prev = first_wild_block;
-        (first_wild_block->body).links.next = &sf_free_list_heads[NUM_FREE_LISTS - 1];
-        (first_wild_block->body).links.prev = &sf_free_list_heads[NUM_FREE_LISTS - 1];
+        set_wilderness_block(first_wild_block);
 
         //Setting up the footer of the new LARGE block in the heap
         temp_ptr = sf_mem_end();
@@ -76,19 +157,10 @@ void *sf_malloc(size_t size) {
         return NULL;
     }
 
-    //Find the correct alignment by incrementing until blocksize is a multiple of 4
-    unsigned long blocksize = 8UL + size;
-
-    unsigned long required_margin_size = blocksize;
-    while((required_margin_size % 64UL) != 0UL)
-    {
-        required_margin_size++;
-    }
-
-    //Set blocksize equal to margin with padding
-    blocksize = required_margin_size;
+    //Header plus padding up to a multiple of 64
+    unsigned long blocksize = find_blocksize(size);
 
-    //Checking if blocksize is 0 again because of overflow
+    //Checking if blocksize is 0 because of overflow
     if(blocksize == 0)
     {
         sf_errno = ENOMEM;
@@ -101,40 +173,46 @@ void *sf_malloc(size_t size) {
     //Retrieving correct index for size_class_index
     int size_class_index = find_fib_index(size_class);
 
+    //A block of the same size whose free was deferred is used as it is
+    if(deferred_count != 0 && size_class < NUM_EXACT_BINS && deferred_bins[size_class] != NULL)
+    {
+        sf_block *deferred_block = deferred_bins[size_class];
+        deferred_bins[size_class] = (deferred_block->body).links.next;
+        (deferred_block->body).links.prev = NULL;
+        deferred_count--;
+        return ((void *)(deferred_block->body).payload);
+    }
+
     //look for the block in the different segregated lists
     int valid_block_found = 0;
-    sf_block *temp_block;
+    sf_block *temp_block = find_fit(size_class, size_class_index);
 
-    for(int i = size_class_index; i < (NUM_FREE_LISTS - 1); i++)
+    //Nothing fits: coalesce the deferred frees and look again before growing the heap
+    if(temp_block == NULL && deferred_count != 0)
     {
-        //Start at the next node after the senteniel node
-        temp_block = sf_free_list_heads[i].body.links.next;
-        //while not equal to the senteniel node
-        while(temp_block != (&sf_free_list_heads[i]))
-        {
-            //If less than or matches, it is found
-            if(blocksize <= GET_SIZE(temp_block))
-            {
-                valid_block_found = 1;
-                break;
-            }
-            temp_block = (*temp_block).body.links.next;
-        }
-        //valid block was found, so exit
-        if (valid_block_found == 1)
-        {
-            break;
-        }
+        flush_deferred();
+        temp_block = find_fit(size_class, size_class_index);
+    }
+
+    if(temp_block != NULL)
+    {
+        valid_block_found = 1;
     }
 
     //valid block was found, so split it
     if (valid_block_found == 1)
     {
+        //Take it out of its list first, as splitting writes into its body
+        remove_from_free_list(temp_block);
+
         //Split the block
         split_block(blocksize, temp_block, 0);
     }
     else
     {
+        unsigned long wildblock_blocksize = 0;
+        int new_wild_block = 0;
+
         //if there is no wildblock node in the last list
         if(sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.prev == (&sf_free_list_heads[NUM_FREE_LISTS - 1]))
         {
@@ -142,102 +220,31 @@ void *sf_malloc(size_t size) {
             char *block_header = sf_mem_end();
             block_header -= 16;
             temp_block = (sf_block *)block_header;
-
-            unsigned long wildblock_blocksize = 0;
-            while(blocksize > wildblock_blocksize)
-            {
-                char *ret_grow = sf_mem_grow();
-
-                //If no more space is available in the heap
-                if(ret_grow == NULL)
-                {
-                    sf_errno = ENOMEM;
-                    return NULL;
-                }
-
-                wildblock_blocksize += 4096UL;
-
-                //Start coalescing returne page and current block
-                //Set up large block and epilogue
-                (temp_block->header) &= 0x3;
-                (temp_block->header) |= wildblock_blocksize;
-                //Set allocated bit to 0
-                (temp_block->header) &= (~0x1);
-
-                //Set up footer of large block
-                char *epilogue_block_temp = sf_mem_end();
-                epilogue_block_temp -= 16;
-                unsigned long *epilogue_block_temp2 = (unsigned long *)epilogue_block_temp;
-                (*epilogue_block_temp2) = (temp_block->header);
-
-                //Set up epilogue
-                epilogue_block_temp = sf_mem_end();
-                epilogue_block_temp -= 8;
-                epilogue_block_temp2 = (unsigned long *)epilogue_block_temp;
-                (*epilogue_block_temp2) = 1;
-
-                //Add new block to wildblock segregated free list
-                sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.next = temp_block;
-                sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.prev = temp_block;
-                (temp_block->body).links.next = &sf_free_list_heads[NUM_FREE_LISTS - 1];
-                (temp_block->body).links.prev = &sf_free_list_heads[NUM_FREE_LISTS - 1];
-            }
-            //clearing top 62 bits and oring it with the new wildblocksize
-            (temp_block->header) &= 0x3;
-            (temp_block->header) |= wildblock_blocksize;
+            new_wild_block = 1;
         }
         else
         {
-            unsigned long wildblock_blocksize = GET_SIZE(sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.next);
             temp_block = sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.next;
-            while(blocksize > wildblock_blocksize)
-            {
-                char *ret_grow = sf_mem_grow();
+            wildblock_blocksize = GET_SIZE(temp_block);
+        }
 
-                //If no more space is available in the heap
-                if(ret_grow == NULL)
-                {
-                    sf_errno = ENOMEM;
-                    return NULL;
-                }
+        if(blocksize > wildblock_blocksize)
+        {
+            wildblock_blocksize = grow_wildblock(temp_block, wildblock_blocksize, blocksize, new_wild_block);
+        }
 
-                wildblock_blocksize += 4096UL;
-
-                //Start coalescing returne page and current block
-                //Set up large block and epilogue
-                (temp_block->header) &= 0x3;
-                (temp_block->header) |= wildblock_blocksize;
-                //Set allocated bit to 0
-                (temp_block->header) &= (~0x1);
-
-                //Set up footer of large block
-                char *epilogue_block_temp = sf_mem_end();
-                epilogue_block_temp -= 16;
-                unsigned long *epilogue_block_temp2 = (unsigned long *)epilogue_block_temp;
-                (*epilogue_block_temp2) = (temp_block->header);
-
-                //Set up epilogue
-                epilogue_block_temp = sf_mem_end();
-                epilogue_block_temp -= 8;
-                epilogue_block_temp2 = (unsigned long *)epilogue_block_temp;
-                (*epilogue_block_temp2) = 1;
-            }
-            //clearing top 62 bits and oring it with the new wildblocksize
-            (temp_block->header) &= 0x3;
-            (temp_block->header) |= wildblock_blocksize;
+        //If no more space is available in the heap, what was added stays in the wildblock
+        if(blocksize > wildblock_blocksize)
+        {
+            sf_errno = ENOMEM;
+            return NULL;
         }
-        //Recreating the epilogue block
-        char *epilogue_block_temp = sf_mem_end();
-        epilogue_block_temp -= 8;
-        unsigned long *epilogue_block_temp2 = (unsigned long *)epilogue_block_temp;
-        (*epilogue_block_temp2) = 1;
 
         //Now we can split the block
+        remove_from_free_list(temp_block);
         split_block(blocksize, temp_block, 1);
     }
 
-    remove_from_free_list(temp_block);
-
     //return a void point to its body
     return ((void *)(temp_block->body).payload);
 }
@@ -249,6 +256,16 @@ void initialize_senteniel_nodes()
         sf_free_list_heads[i].body.links.next = &sf_free_list_heads[i];
         sf_free_list_heads[i].body.links.prev = &sf_free_list_heads[i];
     }
+    free_list_bitmap = 0;
+
+    for(int i = 0; i < NUM_EXACT_BINS; i++)
+    {
+        exact_bins[i].next = &exact_bins[i];
+        exact_bins[i].prev = &exact_bins[i];
+    }
+    exact_bin_bitmap = 0;
+
+    large_tree_root = NULL;
 }
 
 void split_block(unsigned long blocksize, sf_block *big_block, int is_wildblock)
@@ -283,7 +300,7 @@ void split_block(unsigned long blocksize, sf_block *big_block, int is_wildblock)
     //if not-splittable, just toggle next prevalloc bit
     if(unsplittable_flag == 1)
     {
-        (new_block_ptr->header) |= 0x2;
+        SET_PREV_ALLOC(&(new_block_ptr->header));
         return;
     }
     //else just make it a free block
@@ -302,7 +319,7 @@ void split_block(unsigned long blocksize, sf_block *big_block, int is_wildblock)
     (block_after_new->prev_footer) = (new_block_ptr->header);
 
     //toggle prevalloc bit of next block to 0 because new block is free
-    (block_after_new->header) &= (~0x2);
+    CLEAR_PREV_ALLOC(&(block_after_new->header));
 
     //Add to free list
     unsigned long size_class = smaller_blocksize / 64UL;
@@ -315,22 +332,92 @@ void split_block(unsigned long blocksize, sf_block *big_block, int is_wildblock)
         size_class_index = NUM_FREE_LISTS - 1;
     }
 
-    //Circular linked-list update (LIFO STRUCTURE)
-    (new_block_ptr->body).links.next = sf_free_list_heads[size_class_index].body.links.next;
-    ((new_block_ptr->body).links.next)->body.links.prev = new_block_ptr;
+    insert_into_free_list(new_block_ptr, size_class_index);
+}
+
+//Circular linked-list update (LIFO STRUCTURE), in the exact size bin as well if the block is small enough
+void insert_into_free_list(sf_block *block, int size_class_index)
+{
+    (block->body).links.next = sf_free_list_heads[size_class_index].body.links.next;
+    ((block->body).links.next)->body.links.prev = block;
+
+    (block->body).links.prev = (&sf_free_list_heads[size_class_index]);
+    sf_free_list_heads[size_class_index].body.links.next = block;
+
+    free_list_bitmap |= (1UL << size_class_index);
+
+    unsigned long size_class = GET_SIZE(block) / 64UL;
+    if(size_class_index == (NUM_FREE_LISTS - 1))
+    {
+        INDEX_KIND(block) = INDEX_NONE;
+        return;
+    }
+    if(size_class >= NUM_EXACT_BINS)
+    {
+        tree_insert(block);
+        return;
+    }
+
+    sf_bin_links *links = BIN_LINKS(block);
+    links->kind = INDEX_BIN;
+    links->next = exact_bins[size_class].next;
+    (links->next)->prev = links;
+    links->prev = &exact_bins[size_class];
+    exact_bins[size_class].next = links;
+
+    exact_bin_bitmap |= (1UL << size_class);
+}
+
+//The wilderness block is always the only one in the last list
+void set_wilderness_block(sf_block *block)
+{
+    sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.next = block;
+    sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.prev = block;
+    (block->body).links.next = &sf_free_list_heads[NUM_FREE_LISTS - 1];
+    (block->body).links.prev = &sf_free_list_heads[NUM_FREE_LISTS - 1];
+    INDEX_KIND(block) = INDEX_NONE;
 
-    (new_block_ptr->body).links.prev = (&sf_free_list_heads[size_class_index]);
-    sf_free_list_heads[size_class_index].body.links.next = new_block_ptr;
+    free_list_bitmap |= (1UL << (NUM_FREE_LISTS - 1));
 }
 
+//The block's header may already have its coalesced size, so nothing here depends on it
 void remove_from_free_list(sf_block *temp_block)
 {
+    sf_block *next = (*temp_block).body.links.next;
+
     (*((*temp_block).body.links.next)).body.links.prev = (*temp_block).body.links.prev;
     (*((*temp_block).body.links.prev)).body.links.next = (*temp_block).body.links.next;
+
+    //Only a senteniel node can point back at itself, and then its list is empty
+    if(next->body.links.next == next)
+    {
+        free_list_bitmap &= ~(1UL << (next - sf_free_list_heads));
+    }
+
+    if(INDEX_KIND(temp_block) == INDEX_TREE)
+    {
+        tree_remove(TREE_NODE(temp_block));
+        return;
+    }
+    if(INDEX_KIND(temp_block) != INDEX_BIN)
+    {
+        return;
+    }
+
+    sf_bin_links *links = BIN_LINKS(temp_block);
+    sf_bin_links *next_links = links->next;
+    (links->next)->prev = links->prev;
+    (links->prev)->next = links->next;
+
+    if(next_links->next == next_links)
+    {
+        exact_bin_bitmap &= ~(1UL << (next_links - exact_bins));
+    }
 }
 void add_to_free_list(sf_block *temp_block);
+int defer_free(sf_block *block);
 
-void sf_free(void *pp) {
+void sf_free_unlocked(void *pp) {
     //Checking for invalid pointers
     if(pp == NULL)
     {
@@ -431,6 +518,12 @@ void sf_free(void *pp) {
         abort();
     }
 
+    //Deferred coalescing: keep a small block as it is for now
+    if(deferred_threshold != 0 && defer_free((sf_block *)(header_ptr - 1)))
+    {
+        return;
+    }
+
     //Now start checking cases for coalescing
     //Case 1 -- Previous block and next block are both free
     if((((*header_ptr) & (0x2)) == 0) && (((*next_header_ptr) & (0x1)) == 0))
@@ -472,7 +565,7 @@ void sf_free(void *pp) {
 
         //toggling prev_alloc bit in next block
         unsigned long *next_block_in_heap = (unsigned long *)temp_ptr;
-        (*next_block_in_heap) &= (~0x2);
+        CLEAR_PREV_ALLOC(next_block_in_heap);
     }
 
     //Case 2 -- Only previous block is free
@@ -514,7 +607,7 @@ void sf_free(void *pp) {
 
         //toggling prev_alloc bit in next block
         unsigned long *next_block_in_heap = (unsigned long *)temp_ptr;
-        (*next_block_in_heap) &= (~0x2);
+        CLEAR_PREV_ALLOC(next_block_in_heap);
     }
 
     //Case 3 -- Only next block is free
@@ -546,7 +639,7 @@ void sf_free(void *pp) {
 
         //toggling prev_alloc bit in next block
         unsigned long *next_block_in_heap = (unsigned long *)temp_ptr;
-        (*next_block_in_heap) &= (~0x2);
+        CLEAR_PREV_ALLOC(next_block_in_heap);
     }
 
     //Case 4 -- Neither next nor previous block is free
@@ -575,7 +668,7 @@ void sf_free(void *pp) {
 
         //toggling prev_alloc bit in next block
         unsigned long *next_block_in_heap = (unsigned long *)temp_ptr;
-        (*next_block_in_heap) &= (~0x2);
+        CLEAR_PREV_ALLOC(next_block_in_heap);
     }
 }
 
@@ -597,10 +690,7 @@ void add_to_free_list(sf_block *temp_block)
     //If the next block is the epilogue block
     if(next_block_blocksize == 0)
     {
-        sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.next = temp_block;
-        sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.prev = temp_block;
-        (temp_block->body).links.next = &sf_free_list_heads[NUM_FREE_LISTS - 1];
-        (temp_block->body).links.prev = &sf_free_list_heads[NUM_FREE_LISTS - 1];
+        set_wilderness_block(temp_block);
     }
     else
     {
@@ -610,229 +700,725 @@ void add_to_free_list(sf_block *temp_block)
         //Retrieving correct index for size_class_index
         int size_class_index = find_fib_index(size_class);
 
-        //Circular linked-list update (LIFO STRUCTURE)
-        (temp_block->body).links.next = sf_free_list_heads[size_class_index].body.links.next;
-        ((temp_block->body).links.next)->body.links.prev = temp_block;
-
-        (temp_block->body).links.prev = (&sf_free_list_heads[size_class_index]);
-        sf_free_list_heads[size_class_index].body.links.next = temp_block;
+        insert_into_free_list(temp_block, size_class_index);
     }
 }
 
+//Fibonacci list index for every size class (blocksize / 64) up to 34, the bound of the
+//last Fibonacci list. Anything bigger goes in list NUM_FREE_LISTS - 2.
+static const unsigned char fib_index_table[35] = {
+    0, 0,                                           //1
+    1,                                              //2
+    2,                                              //3
+    3, 3,                                           //4 - 5
+    4, 4, 4,                                        //6 - 8
+    5, 5, 5, 5, 5,                                  //9 - 13
+    6, 6, 6, 6, 6, 6, 6, 6,                         //14 - 21
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7           //22 - 34
+};
+
 int find_fib_index(unsigned long size_class)
 {
-    unsigned long fib1 = 1;
-    unsigned long fib2 = 1;
+    //Past the last Fibonacci bound, so it is the largest non-wilderness list
+    if(size_class >= (sizeof(fib_index_table) / sizeof(fib_index_table[0])))
+    {
+        return NUM_FREE_LISTS - 2;
+    }
 
-    //The index that will be returned
-    int size_class_index = 0;
+    return fib_index_table[size_class];
+}
 
-    while(size_class > fib2)
+//Adds the 8 byte header to size and rounds up to a multiple of 64 with a mask, rather
+//than counting up a byte at a time. Returns 0 if that would overflow.
+unsigned long find_blocksize(size_t size)
+{
+    if(size > (ULONG_MAX - 8UL - 63UL))
     {
-        //If reached the largest fib size, then break
-        if(size_class_index == (NUM_FREE_LISTS - 2))
-        {
-            break;
-        }
-        //increment the index
-        size_class_index++;
-
-        //update the 2 fibonacci numbers
-        unsigned long temp = fib2;
-        fib2 = fib2 + fib1;
-        fib1 = temp;
+        return 0;
     }
 
-    return size_class_index;
+    return (size + 8UL + 63UL) & ~63UL;
 }
 
-int is_invalid_mallocd_ptr(void *pp);
-void split_and_free_small_block(sf_block *current_block, unsigned long size);
-
-void *sf_realloc(void *pp, size_t rsize) {
-    //Checking if pointer is invalid
-    int invalid_ptr_ret_value = is_invalid_mallocd_ptr(pp);
+//Largest size class (blocksize / 64) in each Fibonacci list but the last two
+static const unsigned char fib_bound_table[NUM_FREE_LISTS - 2] = {1, 2, 3, 5, 8, 13, 21, 34};
 
-    //If sf_realloc is called with an invalid pointer sf_errno should be set to EINVAL.
-    if(invalid_ptr_ret_value == 1)
+//Finds a free block of at least size_class * 64 bytes outside the wilderness, or NULL.
+//In its own list that is the best fit, from the lowest non-empty exact size bin that is big enough,
+//or from the tree for the list of the largest blocks. In any list above its own every block fits,
+//so the first non-empty one found in the bitmap gives its head, or the smallest block in the tree.
+sf_block *find_fit(unsigned long size_class, int size_class_index)
+{
+    if(size_class_index < (NUM_FREE_LISTS - 2))
     {
-        sf_errno = EINVAL;
-        return NULL;
+        unsigned long bound = fib_bound_table[size_class_index];
+        unsigned long bins = exact_bin_bitmap & (~0UL << size_class) & ((2UL << bound) - 1UL);
+        if(bins != 0)
+        {
+            return BIN_BLOCK(exact_bins[__builtin_ctzl(bins)].next);
+        }
+    }
+    else
+    {
+        return tree_best_fit(size_class * 64UL);
     }
 
-    //checking if size is equal to 0
-    //If sf_realloc is called with a valid pointer and a size of 0 it should free
-    if(rsize == 0)
+    //non-empty lists above its own, but not the wilderness
+    unsigned long lists = free_list_bitmap & (~0UL << (size_class_index + 1)) & ((1UL << (NUM_FREE_LISTS - 1)) - 1UL);
+    if(lists == 0)
     {
-        sf_free(pp);
         return NULL;
     }
 
-    //Going to the footer of the previous block to create an sf_block pointer
-    char *temp_ptr = pp;
-    temp_ptr -= 16;
-
-    sf_block *current_block = (sf_block *)temp_ptr;
-    unsigned long current_block_size = GET_SIZE(current_block);
-
-    unsigned long new_block_size = rsize;
-    //header size is added to rsize
-    new_block_size += 8;
-    //look for closest multiple of 64 for new block
-    while((new_block_size % 64UL) != 0UL)
+    int i = __builtin_ctzl(lists);
+    if(i == (NUM_FREE_LISTS - 2))
     {
-        new_block_size++;
+        return tree_best_fit(size_class * 64UL);
     }
+    return sf_free_list_heads[i].body.links.next;
+}
 
-    char *new_block_ptr;
+void tree_rotate_left(sf_tree_node *node)
+{
+    sf_tree_node *child = node->right;
 
-    //if rsize is greater than current blocksize
-    if(current_block_size < new_block_size)
+    node->right = child->left;
+    if(child->left != NULL)
     {
-        new_block_ptr = sf_malloc(rsize);
-
-        //check if return of sf_malloc is NULL
-        if(new_block_ptr == NULL)
-        {
-            return NULL;
-        }
-
-        //payload size is the entire blocksize minus the header
-        unsigned long payload_size = current_block_size - 8;
-        memcpy(new_block_ptr, pp, payload_size);
-
-        //free the current block
-        sf_free(pp);
-
-        //return new malloc'd pointer
-        return new_block_ptr;
+        child->left->parent = node;
+    }
+    child->parent = node->parent;
+    if(node->parent == NULL)
+    {
+        large_tree_root = child;
+    }
+    else if(node == node->parent->left)
+    {
+        node->parent->left = child;
     }
-    //if rsize is less or equal to current blocksize
     else
     {
-        //checking if the next block is the epilogue or not
-        //Pass in the new blocksize with the added header and padding
-        split_and_free_small_block(current_block, rsize);
-
-        //returning current given pointer
-        return pp;
+        node->parent->right = child;
     }
+    child->left = node;
+    node->parent = child;
 }
 
-int is_invalid_mallocd_ptr(void *pp)
+void tree_rotate_right(sf_tree_node *node)
 {
-    //Checking for invalid pointers
-    if(pp == NULL)
+    sf_tree_node *child = node->left;
+
+    node->left = child->right;
+    if(child->right != NULL)
     {
-        return 1;
+        child->right->parent = node;
     }
-    long unsigned var = (long unsigned)pp;
-    if((var % 64) != 0)
+    child->parent = node->parent;
+    if(node->parent == NULL)
     {
-        return 1;
+        large_tree_root = child;
     }
-
-    //Go to the header of the block
-    char *pp2 = pp;
-    pp2 -= 8;
-
-    //Skip padding and go to the end of the end of the prologue
-    char *prologue_end = sf_mem_start();
-    prologue_end += 56;
-    prologue_end += 64;
-
-    //header is less than the ending address of prologue
-    if(pp2 < prologue_end)
+    else if(node == node->parent->right)
     {
-        return 1;
+        node->parent->right = child;
     }
-
-    //Going to the footer of the block and getting the size
-    pp2 -= 8;
-    sf_block *current_block_check = (sf_block *)pp2;
-    int current_block_size = GET_SIZE(current_block_check);
-
-    //Go the end of the footer
-    pp2 += 8;
-    pp2 += current_block_size;
-
-    //Go to the beginning of the epilogue
-    char *epilogue_start = sf_mem_end();
-    epilogue_start -= 8;
-
-    //greater than the starting address of epilogue
-    if(pp2 > epilogue_start)
+    else
     {
-        return 1;
+        node->parent->left = child;
     }
+    child->right = node;
+    node->parent = child;
+}
 
-    //going to header
-    char *temp_ptr = pp;
-    temp_ptr -= 8;
-
-    //if allocated bit is equal to 0
-    unsigned long *header_ptr = (unsigned long *)temp_ptr;
-    if(((*header_ptr) & (0x1)) == 0)
+//Adds a free block of the largest Fibonacci list to the tree, after any of the same size
+void tree_insert(sf_block *block)
+{
+    sf_tree_node *node = TREE_NODE(block);
+    node->kind = INDEX_TREE;
+    node->size = GET_SIZE(block);
+    node->left = NULL;
+    node->right = NULL;
+    node->red = 1;
+
+    //Walk down to where it belongs
+    sf_tree_node *parent = NULL;
+    sf_tree_node *cursor = large_tree_root;
+    while(cursor != NULL)
     {
-        return 1;
+        parent = cursor;
+        cursor = (node->size < cursor->size) ? cursor->left : cursor->right;
     }
-
-    //prev_alloc field is 0, indicating that the previous block is free,
-    //but the alloc field of the previous block header is not 0.
-    if(((*header_ptr) & (0x2)) == 0)
+    node->parent = parent;
+    if(parent == NULL)
     {
-        //Go to footer of previous block
-        temp_ptr -= 8;
-        unsigned long *prev_footer_ptr = (unsigned long *)temp_ptr;
-        //Get the blocksize of the previous block
-        unsigned long prev_size = ((*prev_footer_ptr) & (~0x3));
-        //Go to header of previous block
-        temp_ptr += 8;
-        temp_ptr -= prev_size;
-        unsigned long *prev_header_ptr = (unsigned long *)temp_ptr;
+        large_tree_root = node;
+    }
+    else if(node->size < parent->size)
+    {
+        parent->left = node;
+    }
+    else
+    {
+        parent->right = node;
+    }
 
-        //footer and header are not equal to eachother
-        if((*prev_header_ptr) != (*prev_footer_ptr))
+    //A red node may not have a red parent
+    while(node->parent != NULL && node->parent->red)
+    {
+        sf_tree_node *grandparent = node->parent->parent;
+        if(node->parent == grandparent->left)
         {
-            return 1;
+            sf_tree_node *uncle = grandparent->right;
+            if(uncle != NULL && uncle->red)
+            {
+                node->parent->red = 0;
+                uncle->red = 0;
+                grandparent->red = 1;
+                node = grandparent;
+            }
+            else
+            {
+                if(node == node->parent->right)
+                {
+                    node = node->parent;
+                    tree_rotate_left(node);
+                }
+                node->parent->red = 0;
+                grandparent->red = 1;
+                tree_rotate_right(grandparent);
+            }
         }
-
-        if(((*prev_footer_ptr) & (0x1)) == 1)
+        else
         {
-            return 1;
+            sf_tree_node *uncle = grandparent->left;
+            if(uncle != NULL && uncle->red)
+            {
+                node->parent->red = 0;
+                uncle->red = 0;
+                grandparent->red = 1;
+                node = grandparent;
+            }
+            else
+            {
+                if(node == node->parent->left)
+                {
+                    node = node->parent;
+                    tree_rotate_right(node);
+                }
+                node->parent->red = 0;
+                grandparent->red = 1;
+                tree_rotate_left(grandparent);
+            }
         }
     }
+    large_tree_root->red = 0;
+}
 
-    //Go to next block
-    unsigned long size_value = ((*header_ptr) & (~0x3));
-    temp_ptr = (char *)header_ptr;
-    temp_ptr += size_value;
-
-    //Go to footer of the same block
-    temp_ptr -= 8;
-
-    //increment ptr to go to next block's head
-    temp_ptr += 8;
-    //if next blocks prev alloc bit is equal to 0 (block is already free)
-    unsigned long *next_header_ptr = (unsigned long *)temp_ptr;
-    if(((*next_header_ptr) & (0x2)) == 0)
+//Puts replacement where node was under node's parent
+void tree_transplant(sf_tree_node *node, sf_tree_node *replacement)
+{
+    if(node->parent == NULL)
     {
-        return 1;
+        large_tree_root = replacement;
     }
-
-    //passed all of the cases
+    else if(node == node->parent->left)
+    {
+        node->parent->left = replacement;
+    }
+    else
+    {
+        node->parent->right = replacement;
+    }
+    if(replacement != NULL)
+    {
+        replacement->parent = node->parent;
+    }
+}
+
+//Takes a node out of the tree. Leaves are NULL, so the parent of the node that moved up is
+//tracked separately for the rebalancing
+void tree_remove(sf_tree_node *node)
+{
+    sf_tree_node *moved = node;
+    int moved_red = moved->red;
+    sf_tree_node *child;
+    sf_tree_node *child_parent;
+
+    if(node->left == NULL)
+    {
+        child = node->right;
+        child_parent = node->parent;
+        tree_transplant(node, node->right);
+    }
+    else if(node->right == NULL)
+    {
+        child = node->left;
+        child_parent = node->parent;
+        tree_transplant(node, node->left);
+    }
+    else
+    {
+        //Replace it with the smallest node on its right
+        moved = node->right;
+        while(moved->left != NULL)
+        {
+            moved = moved->left;
+        }
+        moved_red = moved->red;
+        child = moved->right;
+        if(moved->parent == node)
+        {
+            child_parent = moved;
+        }
+        else
+        {
+            child_parent = moved->parent;
+            tree_transplant(moved, moved->right);
+            moved->right = node->right;
+            moved->right->parent = moved;
+        }
+        tree_transplant(node, moved);
+        moved->left = node->left;
+        moved->left->parent = moved;
+        moved->red = node->red;
+    }
+
+    if(moved_red)
+    {
+        return;
+    }
+
+    //A black node went, so child's side is one black short
+    while(child != large_tree_root && (child == NULL || !child->red))
+    {
+        if(child == child_parent->left)
+        {
+            sf_tree_node *sibling = child_parent->right;
+            if(sibling->red)
+            {
+                sibling->red = 0;
+                child_parent->red = 1;
+                tree_rotate_left(child_parent);
+                sibling = child_parent->right;
+            }
+            if((sibling->left == NULL || !sibling->left->red) && (sibling->right == NULL || !sibling->right->red))
+            {
+                sibling->red = 1;
+                child = child_parent;
+                child_parent = child->parent;
+            }
+            else
+            {
+                if(sibling->right == NULL || !sibling->right->red)
+                {
+                    sibling->left->red = 0;
+                    sibling->red = 1;
+                    tree_rotate_right(sibling);
+                    sibling = child_parent->right;
+                }
+                sibling->red = child_parent->red;
+                child_parent->red = 0;
+                sibling->right->red = 0;
+                tree_rotate_left(child_parent);
+                child = large_tree_root;
+            }
+        }
+        else
+        {
+            sf_tree_node *sibling = child_parent->left;
+            if(sibling->red)
+            {
+                sibling->red = 0;
+                child_parent->red = 1;
+                tree_rotate_right(child_parent);
+                sibling = child_parent->left;
+            }
+            if((sibling->left == NULL || !sibling->left->red) && (sibling->right == NULL || !sibling->right->red))
+            {
+                sibling->red = 1;
+                child = child_parent;
+                child_parent = child->parent;
+            }
+            else
+            {
+                if(sibling->left == NULL || !sibling->left->red)
+                {
+                    sibling->right->red = 0;
+                    sibling->red = 1;
+                    tree_rotate_left(sibling);
+                    sibling = child_parent->left;
+                }
+                sibling->red = child_parent->red;
+                child_parent->red = 0;
+                sibling->left->red = 0;
+                tree_rotate_right(child_parent);
+                child = large_tree_root;
+            }
+        }
+    }
+    if(child != NULL)
+    {
+        child->red = 0;
+    }
+}
+
+//Smallest free block in the tree of at least blocksize bytes, or NULL
+sf_block *tree_best_fit(unsigned long blocksize)
+{
+    sf_tree_node *best = NULL;
+    sf_tree_node *cursor = large_tree_root;
+
+    while(cursor != NULL)
+    {
+        if(cursor->size >= blocksize)
+        {
+            best = cursor;
+            cursor = cursor->left;
+        }
+        else
+        {
+            cursor = cursor->right;
+        }
+    }
+
+    return (best == NULL) ? NULL : TREE_BLOCK(best);
+}
+
+//Adds pages to the heap until at least needed_size bytes were added, or as many as the heap
+//already has in geometric mode. Returns the bytes added, fewer than needed_size if it ran out
+unsigned long grow_heap(unsigned long needed_size)
+{
+    unsigned long wanted_size = needed_size;
+    if(geometric_growth)
+    {
+        unsigned long heap_size = (char *)sf_mem_end() - (char *)sf_mem_start();
+        if(wanted_size < heap_size)
+        {
+            wanted_size = heap_size;
+        }
+    }
+
+    unsigned long added_size = 0;
+    while(added_size < wanted_size)
+    {
+        if(sf_mem_grow() == NULL)
+        {
+            break;
+        }
+        added_size += 4096UL;
+    }
+
+    return added_size;
+}
+
+//Grows the heap until the wildblock has at least blocksize bytes, then sets up its header, its
+//footer and the epilogue once. A new wildblock starts where the epilogue was. Returns the size of
+//the wildblock, which is less than blocksize if the heap ran out
+unsigned long grow_wildblock(sf_block *wild_block, unsigned long wildblock_blocksize, unsigned long blocksize, int new_wild_block)
+{
+    //Get all the pages first
+    unsigned long added_size = grow_heap(blocksize - wildblock_blocksize);
+    if(added_size == 0)
+    {
+        return wildblock_blocksize;
+    }
+    wildblock_blocksize += added_size;
+
+    //clearing top 62 bits and oring it with the new wildblocksize
+    (wild_block->header) &= 0x3;
+    (wild_block->header) |= wildblock_blocksize;
+    //Set allocated bit to 0
+    (wild_block->header) &= (~0x1);
+
+    //Set up footer of large block
+    char *epilogue_block_temp = sf_mem_end();
+    epilogue_block_temp -= 16;
+    unsigned long *epilogue_block_temp2 = (unsigned long *)epilogue_block_temp;
+    (*epilogue_block_temp2) = (wild_block->header);
+
+    //Recreating the epilogue block
+    epilogue_block_temp = sf_mem_end();
+    epilogue_block_temp -= 8;
+    epilogue_block_temp2 = (unsigned long *)epilogue_block_temp;
+    (*epilogue_block_temp2) = 1;
+
+    //Add new block to wildblock segregated free list
+    if(new_wild_block == 1)
+    {
+        set_wilderness_block(wild_block);
+    }
+
+    return wildblock_blocksize;
+}
+
+//Keeps a block being freed in its deferred bin if it is small enough, and returns 1 if it did.
+//Once there are deferred_threshold of them, they are all freed properly
+int defer_free(sf_block *block)
+{
+    unsigned long size_class = GET_SIZE(block) / 64UL;
+    if(size_class >= NUM_EXACT_BINS)
+    {
+        return 0;
+    }
+
+    //Marked as in this bin, so it may be a second free: look for it
+    if((block->body).links.prev == (sf_block *)&deferred_bins[size_class])
+    {
+        for(sf_block *deferred = deferred_bins[size_class]; deferred != NULL; deferred = (deferred->body).links.next)
+        {
+            if(deferred == block)
+            {
+                abort();
+            }
+        }
+    }
+
+    (block->body).links.next = deferred_bins[size_class];
+    (block->body).links.prev = (sf_block *)&deferred_bins[size_class];
+    deferred_bins[size_class] = block;
+    deferred_count++;
+
+    if(deferred_count >= deferred_threshold)
+    {
+        flush_deferred();
+    }
+    return 1;
+}
+
+//Frees every deferred block, coalescing it with its neighbours
+void flush_deferred()
+{
+    int threshold = deferred_threshold;
+
+    //so that sf_free_unlocked does not defer them again
+    deferred_threshold = 0;
+    for(int i = 0; i < NUM_EXACT_BINS; i++)
+    {
+        while(deferred_bins[i] != NULL)
+        {
+            sf_block *block = deferred_bins[i];
+            deferred_bins[i] = (block->body).links.next;
+            (block->body).links.prev = NULL;
+            sf_free_unlocked((block->body).payload);
+        }
+    }
+    deferred_count = 0;
+    deferred_threshold = threshold;
+}
+
+void sf_set_deferred_coalescing(int threshold)
+{
+    if(threshold <= 0)
+    {
+        flush_deferred();
+        threshold = 0;
+    }
+    deferred_threshold = threshold;
+}
+
+void sf_set_geometric_growth(int enable)
+{
+    geometric_growth = enable;
+}
+
+void sf_set_realloc_in_place(int enable)
+{
+    realloc_in_place = enable;
+}
+
+int is_invalid_mallocd_ptr(void *pp);
+void split_and_free_small_block(sf_block *current_block, unsigned long size);
+int grow_in_place(sf_block *current_block, unsigned long new_block_size);
+
+void *sf_realloc_unlocked(void *pp, size_t rsize) {
+    //Checking if pointer is invalid
+    int invalid_ptr_ret_value = is_invalid_mallocd_ptr(pp);
+
+    //If sf_realloc is called with an invalid pointer sf_errno should be set to EINVAL.
+    if(invalid_ptr_ret_value == 1)
+    {
+        sf_errno = EINVAL;
+        return NULL;
+    }
+
+    //checking if size is equal to 0
+    //If sf_realloc is called with a valid pointer and a size of 0 it should free
+    if(rsize == 0)
+    {
+        sf_free_unlocked(pp);
+        return NULL;
+    }
+
+    //Going to the footer of the previous block to create an sf_block pointer
+    char *temp_ptr = pp;
+    temp_ptr -= 16;
+
+    sf_block *current_block = (sf_block *)temp_ptr;
+    unsigned long current_block_size = GET_SIZE(current_block);
+
+    //header size is added to rsize and padded to the closest multiple of 64
+    unsigned long new_block_size = find_blocksize(rsize);
+
+    //rsize so large the block size overflowed
+    if(new_block_size == 0)
+    {
+        sf_errno = ENOMEM;
+        return NULL;
+    }
+
+    char *new_block_ptr;
+
+    //if rsize is greater than current blocksize
+    if(current_block_size < new_block_size)
+    {
+        //Take the space from the next block if it is free (or from the heap, at the end of it),
+        //and give back what is not needed
+        if(realloc_in_place && grow_in_place(current_block, new_block_size))
+        {
+            split_and_free_small_block(current_block, rsize);
+            return pp;
+        }
+
+        //Otherwise move it
+        new_block_ptr = sf_malloc_unlocked(rsize);
+
+        //check if return of sf_malloc is NULL
+        if(new_block_ptr == NULL)
+        {
+            return NULL;
+        }
+
+        //payload size is the entire blocksize minus the header
+        unsigned long payload_size = current_block_size - 8;
+        memcpy(new_block_ptr, pp, payload_size);
+
+        //free the current block
+        sf_free_unlocked(pp);
+
+        //return new malloc'd pointer
+        return new_block_ptr;
+    }
+    //if rsize is less or equal to current blocksize
+    else
+    {
+        //checking if the next block is the epilogue or not
+        //Pass in the new blocksize with the added header and padding
+        split_and_free_small_block(current_block, rsize);
+
+        //returning current given pointer
+        return pp;
+    }
+}
+
+int is_invalid_mallocd_ptr(void *pp)
+{
+    //Checking for invalid pointers
+    if(pp == NULL)
+    {
+        return 1;
+    }
+    long unsigned var = (long unsigned)pp;
+    if((var % 64) != 0)
+    {
+        return 1;
+    }
+
+    //Go to the header of the block
+    char *pp2 = pp;
+    pp2 -= 8;
+
+    //Skip padding and go to the end of the end of the prologue
+    char *prologue_end = sf_mem_start();
+    prologue_end += 56;
+    prologue_end += 64;
+
+    //header is less than the ending address of prologue
+    if(pp2 < prologue_end)
+    {
+        return 1;
+    }
+
+    //Going to the footer of the block and getting the size
+    pp2 -= 8;
+    sf_block *current_block_check = (sf_block *)pp2;
+    int current_block_size = GET_SIZE(current_block_check);
+
+    //Go the end of the footer
+    pp2 += 8;
+    pp2 += current_block_size;
+
+    //Go to the beginning of the epilogue
+    char *epilogue_start = sf_mem_end();
+    epilogue_start -= 8;
+
+    //greater than the starting address of epilogue
+    if(pp2 > epilogue_start)
+    {
+        return 1;
+    }
+
+    //going to header
+    char *temp_ptr = pp;
+    temp_ptr -= 8;
+
+    //if allocated bit is equal to 0
+    unsigned long *header_ptr = (unsigned long *)temp_ptr;
+    if(((*header_ptr) & (0x1)) == 0)
+    {
+        return 1;
+    }
+
+    //prev_alloc field is 0, indicating that the previous block is free,
+    //but the alloc field of the previous block header is not 0.
+    if(((*header_ptr) & (0x2)) == 0)
+    {
+        //Go to footer of previous block
+        temp_ptr -= 8;
+        unsigned long *prev_footer_ptr = (unsigned long *)temp_ptr;
+        //Get the blocksize of the previous block
+        unsigned long prev_size = ((*prev_footer_ptr) & (~0x3));
+        //Go to header of previous block
+        temp_ptr += 8;
+        temp_ptr -= prev_size;
+        unsigned long *prev_header_ptr = (unsigned long *)temp_ptr;
+
+        //footer and header are not equal to eachother
+        if((*prev_header_ptr) != (*prev_footer_ptr))
+        {
+            return 1;
+        }
+
+        if(((*prev_footer_ptr) & (0x1)) == 1)
+        {
+            return 1;
+        }
+    }
+
+    //Go to next block
+    unsigned long size_value = ((*header_ptr) & (~0x3));
+    temp_ptr = (char *)header_ptr;
+    temp_ptr += size_value;
+
+    //Go to footer of the same block
+    temp_ptr -= 8;
+
+    //increment ptr to go to next block's head
+    temp_ptr += 8;
+    //if next blocks prev alloc bit is equal to 0 (block is already free)
+    unsigned long *next_header_ptr = (unsigned long *)temp_ptr;
+    if(((*next_header_ptr) & (0x2)) == 0)
+    {
+        return 1;
+    }
+
+    //passed all of the cases
     return 0;
 }
 
 void split_and_free_small_block(sf_block *current_block, unsigned long new_size)
 {
-    //header size is added to rsize
-    new_size += 8;
-    //look for closest multiple of 64 for new block
-    while((new_size % 64UL) != 0UL)
-    {
-        new_size++;
-    }
+    //header size is added to rsize and padded to the closest multiple of 64
+    new_size = find_blocksize(new_size);
 
     unsigned long smaller_blocksize = 0;
 
@@ -870,12 +1456,66 @@ void split_and_free_small_block(sf_block *current_block, unsigned long new_size)
     //Now go to the payload area of the block, so that it can be freed
     char *temp_ptr = (char *)new_block_ptr;
     temp_ptr += 16;
-    sf_free(temp_ptr);
+    sf_free_unlocked(temp_ptr);
+}
+
+//Makes the block at least new_block_size bytes by taking all of the next block, if it is free
+//and big enough. If the next block is the wildblock, or the epilogue, the heap grows as well.
+//Returns 1 if it did, 0 (with the block as it was) if not
+int grow_in_place(sf_block *current_block, unsigned long new_block_size)
+{
+    unsigned long current_block_size = GET_SIZE(current_block);
+
+    //Go to the next block
+    char *byte_cursor = (char *)current_block;
+    byte_cursor += current_block_size;
+    sf_block *next_block = (sf_block *)byte_cursor;
+
+    //An allocated next block has nothing to give
+    unsigned long next_block_size = 0;
+    if(((next_block->header) & (0x1)) == 0)
+    {
+        next_block_size = GET_SIZE(next_block);
+    }
+
+    //Go to the beginning of the epilogue
+    char *epilogue_start = sf_mem_end();
+    epilogue_start -= 16;
+
+    //The next block ends at the epilogue (or is the epilogue), so the heap can grow under it
+    if((current_block_size + next_block_size < new_block_size) && (byte_cursor + next_block_size == epilogue_start))
+    {
+        int new_wild_block = 0;
+        if(next_block_size == 0)
+        {
+            //The new wildblock comes after this allocated block
+            new_wild_block = 1;
+            SET_PREV_ALLOC(&(next_block->header));
+        }
+        next_block_size = grow_wildblock(next_block, next_block_size, new_block_size - current_block_size, new_wild_block);
+    }
+
+    if(current_block_size + next_block_size < new_block_size)
+    {
+        return 0;
+    }
+
+    //Absorb the whole next block
+    remove_from_free_list(next_block);
+    (current_block->header) &= 0x3;
+    (current_block->header) |= 0x1;
+    (current_block->header) |= (current_block_size + next_block_size);
+
+    //The block after it now follows an allocated block
+    byte_cursor += next_block_size;
+    SET_PREV_ALLOC(&(((sf_block *)byte_cursor)->header));
+
+    return 1;
 }
 
 int is_power_of_2(unsigned long size);
 
-void *sf_memalign(size_t size, size_t align) {
+void *sf_memalign_unlocked(size_t size, size_t align) {
 
     //If align is less than the minimum block size, then NULL is returned and sf_errno is set to EINVAL.
     if(align < 64UL)
@@ -901,7 +1541,7 @@ void *sf_memalign(size_t size, size_t align) {
     //requested size, plus the alignment size, plus the minimum block size, plus the size required for a block header
     unsigned long minimum_size = size + align + 64UL;
 
-    char *large_block = sf_malloc(minimum_size);
+    char *large_block = sf_malloc_unlocked(minimum_size);
 
     //Get the current sf_block that holds the information
     char *byte_cursor = large_block;
@@ -959,7 +1599,7 @@ void *sf_memalign(size_t size, size_t align) {
                 (previous_block->header) |= previous_block_size;
 
                 //now free the previous block
-                sf_free(large_block);
+                sf_free_unlocked(large_block);
 
                 break;
             }
@@ -1017,4 +1657,495 @@ int is_power_of_2(unsigned long size)
     {
         return 0;
     }
-}
\ No newline at end of file
+}
+//Checks the subtree under node: its parent links, its order by sizes between low and high,
+//no red node with a red child and the same number of black nodes down every path. Returns
+//that number, or -1 with *problem set, and counts the nodes in *nodes
+int check_tree(sf_tree_node *node, sf_tree_node *parent, unsigned long low, unsigned long high, int *nodes, const char **problem)
+{
+    if(node == NULL)
+    {
+        return 0;
+    }
+    (*nodes)++;
+
+    if(node->parent != parent)
+    {
+        *problem = "tree node with the wrong parent";
+        return -1;
+    }
+    if(node->kind != INDEX_TREE)
+    {
+        *problem = "tree node not marked as one";
+        return -1;
+    }
+    if(node->size < low || node->size > high)
+    {
+        *problem = "tree nodes out of order";
+        return -1;
+    }
+    if(node->red && ((node->left != NULL && node->left->red) || (node->right != NULL && node->right->red)))
+    {
+        *problem = "red tree node with a red child";
+        return -1;
+    }
+
+    int left_height = check_tree(node->left, node, low, node->size, nodes, problem);
+    int right_height = check_tree(node->right, node, node->size, high, nodes, problem);
+    if(left_height < 0 || right_height < 0)
+    {
+        return -1;
+    }
+    if(left_height != right_height)
+    {
+        *problem = "tree paths with different numbers of black nodes";
+        return -1;
+    }
+    return left_height + !(node->red);
+}
+
+//Checks the free lists, the exact size bins and the tree against each other and the bins
+//against their bitmaps. Returns what is wrong, or NULL, and counts the blocks in the free
+//lists in *free_blocks
+const char *check_free_lists(int *free_blocks)
+{
+    unsigned long list_bitmap = 0;
+    unsigned long bin_bitmap = 0;
+    int binned = 0;
+    int in_tree = 0;
+
+    for(int i = 0; i < NUM_FREE_LISTS; i++)
+    {
+        for(sf_block *block = sf_free_list_heads[i].body.links.next; block != &sf_free_list_heads[i]; block = (block->body).links.next)
+        {
+            unsigned long size_class = GET_SIZE(block) / 64UL;
+            list_bitmap |= (1UL << i);
+            (*free_blocks)++;
+
+            if(((block->header) & 0x1) != 0)
+            {
+                return "allocated block in a free list";
+            }
+            if((((block->body).links.next)->body.links.prev) != block)
+            {
+                return "free list links do not match";
+            }
+            if(i == (NUM_FREE_LISTS - 1))
+            {
+                if(INDEX_KIND(block) != INDEX_NONE)
+                {
+                    return "wilderness block in another index";
+                }
+                continue;
+            }
+            if(find_fib_index(size_class) != i)
+            {
+                return "block in the wrong free list";
+            }
+            if(size_class < NUM_EXACT_BINS)
+            {
+                if(INDEX_KIND(block) != INDEX_BIN)
+                {
+                    return "small free block not in an exact size bin";
+                }
+                binned++;
+            }
+            else
+            {
+                if(INDEX_KIND(block) != INDEX_TREE)
+                {
+                    return "large free block not in the tree";
+                }
+                if(TREE_NODE(block)->size != GET_SIZE(block))
+                {
+                    return "tree node size does not match its block";
+                }
+                in_tree++;
+            }
+        }
+    }
+
+    for(int i = 0; i < NUM_EXACT_BINS; i++)
+    {
+        for(sf_bin_links *links = exact_bins[i].next; links != &exact_bins[i]; links = links->next)
+        {
+            bin_bitmap |= (1UL << i);
+            binned--;
+
+            if((links->next)->prev != links)
+            {
+                return "exact size bin links do not match";
+            }
+            if(GET_SIZE(BIN_BLOCK(links)) / 64UL != (unsigned long)i)
+            {
+                return "block in the wrong exact size bin";
+            }
+        }
+    }
+    if(binned != 0)
+    {
+        return "exact size bins and free lists hold different blocks";
+    }
+
+    const char *problem = NULL;
+    int nodes = 0;
+    if(large_tree_root != NULL && large_tree_root->red)
+    {
+        return "red tree root";
+    }
+    if(check_tree(large_tree_root, NULL, 0, ULONG_MAX, &nodes, &problem) < 0)
+    {
+        return problem;
+    }
+    if(nodes != in_tree)
+    {
+        return "tree and free lists hold different blocks";
+    }
+
+    if(list_bitmap != free_list_bitmap)
+    {
+        return "free list bitmap does not match the free lists";
+    }
+    if(bin_bitmap != exact_bin_bitmap)
+    {
+        return "exact size bin bitmap does not match the bins";
+    }
+    return NULL;
+}
+
+const char *sf_check_heap(void)
+{
+    //Nothing is set up before the first sf_malloc
+    if(number_of_malloc_calls == 0)
+    {
+        return NULL;
+    }
+
+    int free_blocks = 0;
+    const char *problem = check_free_lists(&free_blocks);
+    if(problem != NULL)
+    {
+        return problem;
+    }
+
+    //Deferred blocks are still marked allocated, each in the bin for its size
+    int deferred = 0;
+    for(int i = 0; i < NUM_EXACT_BINS; i++)
+    {
+        for(sf_block *block = deferred_bins[i]; block != NULL; block = (block->body).links.next)
+        {
+            deferred++;
+            if(((block->header) & 0x1) == 0)
+            {
+                return "deferred block marked free";
+            }
+            if(GET_SIZE(block) / 64UL != (unsigned long)i || (block->body).links.prev != (sf_block *)&deferred_bins[i])
+            {
+                return "block in the wrong deferred bin";
+            }
+        }
+    }
+    if(deferred != deferred_count)
+    {
+        return "deferred blocks miscounted";
+    }
+
+    //From the block after the prologue up to the epilogue
+    sf_block *block = (sf_block *)((char *)sf_mem_start() + 56 + 56);
+    sf_block *epilogue = (sf_block *)((char *)sf_mem_end() - 16);
+    int prev_free = 0;
+    int heap_free_blocks = 0;
+    while(block != epilogue)
+    {
+        unsigned long blocksize = GET_SIZE(block);
+        int is_free = (((block->header) & 0x1) == 0);
+        sf_block *next = (sf_block *)((char *)block + blocksize);
+
+        if(blocksize < 64 || (blocksize % 64) != 0 || (char *)next > (char *)epilogue)
+        {
+            return "block of a bad size";
+        }
+        if((((block->header) & 0x2) == 0) != prev_free)
+        {
+            return "prev alloc bit does not match the block before";
+        }
+        if(is_free)
+        {
+            if(prev_free)
+            {
+                return "two free blocks next to each other";
+            }
+            if((next->prev_footer) != (block->header))
+            {
+                return "footer of a free block does not match its header";
+            }
+            if(next == epilogue && sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.next != block)
+            {
+                return "free block at the end of the heap is not the wilderness block";
+            }
+            heap_free_blocks++;
+        }
+        prev_free = is_free;
+        block = next;
+    }
+
+    if(heap_free_blocks != free_blocks)
+    {
+        return "free blocks in the heap and in the free lists differ";
+    }
+    return NULL;
+}
+
+#ifndef SF_THREADS
+
+void *sf_malloc(size_t size) {
+    return sf_malloc_unlocked(size);
+}
+
+void sf_free(void *pp) {
+    sf_free_unlocked(pp);
+}
+
+void *sf_realloc(void *pp, size_t rsize) {
+    return sf_realloc_unlocked(pp, rsize);
+}
+
+void *sf_memalign(size_t size, size_t align) {
+    return sf_memalign_unlocked(size, align);
+}
+
+#else
+
+//Blocks of one size, linked through body.links.next (they are allocated, so the links are free to use).
+//body.links.prev of a cached block points at its cache, so that freeing it twice is caught.
+struct sf_thread_cache {
+    sf_block *bins[SF_CACHE_BINS];
+    int counts[SF_CACHE_BINS];
+    int registered;
+};
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+static __thread struct sf_thread_cache thread_cache;
+//Read on every fast path and set by any thread, so only through __atomic_load_n/__atomic_store_n
+static int caches_enabled = 1;
+
+//Blocks moved per refill or drain of a bin: more of the smaller sizes, at least 2
+int cache_batch(int bin)
+{
+    int batch = SF_CACHE_BATCH_BYTES / ((bin + 1) * 64);
+    return batch < 2 ? 2 : batch;
+}
+
+//Returns every cached block to the free lists, heap_lock must be held
+void flush_cache_locked(struct sf_thread_cache *cache)
+{
+    for(int bin = 0; bin < SF_CACHE_BINS; bin++)
+    {
+        while(cache->bins[bin] != NULL)
+        {
+            sf_block *block = cache->bins[bin];
+            cache->bins[bin] = (block->body).links.next;
+            sf_free_unlocked((block->body).payload);
+        }
+        cache->counts[bin] = 0;
+    }
+}
+
+//Key destructor, so that a thread's cache is not lost when it exits
+void flush_cache_at_exit(void *arg)
+{
+    pthread_mutex_lock(&heap_lock);
+    flush_cache_locked((struct sf_thread_cache *)arg);
+    pthread_mutex_unlock(&heap_lock);
+}
+
+void create_cache_key()
+{
+    pthread_key_create(&cache_key, flush_cache_at_exit);
+}
+
+//First use of a thread's cache
+void register_cache(struct sf_thread_cache *cache)
+{
+    pthread_once(&cache_key_once, create_cache_key);
+    pthread_setspecific(cache_key, cache);
+    cache->registered = 1;
+}
+
+//Takes a batch of blocks for the bin from the free lists. If the heap cannot give even one,
+//the rest of this thread's cache is returned first and it is tried again.
+void refill_cache(struct sf_thread_cache *cache, int bin)
+{
+    size_t size = (bin + 1) * 64 - 8;
+
+    pthread_mutex_lock(&heap_lock);
+    int saved_errno = sf_errno;
+    for(int tries = 0; tries < 2 && cache->counts[bin] == 0; tries++)
+    {
+        if(tries == 1)
+        {
+            flush_cache_locked(cache);
+        }
+        for(int i = 0; i < cache_batch(bin); i++)
+        {
+            char *payload = sf_malloc_unlocked(size);
+            if(payload == NULL)
+            {
+                break;
+            }
+            sf_block *block = (sf_block *)(payload - 16);
+            (block->body).links.next = cache->bins[bin];
+            (block->body).links.prev = (sf_block *)cache;
+            cache->bins[bin] = block;
+            cache->counts[bin]++;
+        }
+    }
+
+    //ENOMEM from the end of a batch is not this call's failure
+    if(cache->counts[bin] != 0)
+    {
+        sf_errno = saved_errno;
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+//Returns a batch of blocks of the bin to the free lists
+void drain_cache(struct sf_thread_cache *cache, int bin)
+{
+    pthread_mutex_lock(&heap_lock);
+    for(int i = 0; i < cache_batch(bin); i++)
+    {
+        sf_block *block = cache->bins[bin];
+        cache->bins[bin] = (block->body).links.next;
+        cache->counts[bin]--;
+        sf_free_unlocked((block->body).payload);
+    }
+    pthread_mutex_unlock(&heap_lock);
+}
+
+//Other threads' caches are theirs alone, so only this thread's is flushed
+void sf_set_thread_caches(int enable)
+{
+    __atomic_store_n(&caches_enabled, enable, __ATOMIC_RELAXED);
+    if(!enable)
+    {
+        pthread_mutex_lock(&heap_lock);
+        flush_cache_locked(&thread_cache);
+        pthread_mutex_unlock(&heap_lock);
+    }
+}
+
+void *sf_malloc(size_t size) {
+    unsigned long blocksize = find_blocksize(size);
+
+    //Small sizes come from this thread's cache
+    if(__atomic_load_n(&caches_enabled, __ATOMIC_RELAXED) && size != 0 && blocksize != 0 && blocksize <= (SF_CACHE_BINS * 64UL))
+    {
+        struct sf_thread_cache *cache = &thread_cache;
+        int bin = (blocksize / 64UL) - 1;
+
+        if(!cache->registered)
+        {
+            register_cache(cache);
+        }
+        if(cache->counts[bin] == 0)
+        {
+            refill_cache(cache, bin);
+            if(cache->counts[bin] == 0)
+            {
+                return NULL;
+            }
+        }
+
+        sf_block *block = cache->bins[bin];
+        cache->bins[bin] = (block->body).links.next;
+        cache->counts[bin]--;
+        (block->body).links.prev = NULL;
+        return (void *)(block->body).payload;
+    }
+
+    pthread_mutex_lock(&heap_lock);
+    void *payload = sf_malloc_unlocked(size);
+
+    //Out of memory, but this thread's cached blocks may be enough once they are coalesced
+    if(payload == NULL && size != 0 && blocksize != 0 && __atomic_load_n(&caches_enabled, __ATOMIC_RELAXED))
+    {
+        flush_cache_locked(&thread_cache);
+        payload = sf_malloc_unlocked(size);
+    }
+    pthread_mutex_unlock(&heap_lock);
+
+    return payload;
+}
+
+void sf_free(void *pp) {
+    //Only the block's own header is checked here, the rest of the checks are done
+    //when the block is drained from the cache
+    if(__atomic_load_n(&caches_enabled, __ATOMIC_RELAXED) && pp != NULL && (((unsigned long)pp % 64) == 0)
+        && ((char *)pp - 8) >= ((char *)sf_mem_start() + 56 + 64))
+    {
+        sf_block *block = (sf_block *)((char *)pp - 16);
+        //Neighbours may change the prev alloc bit meanwhile, the rest is ours
+        unsigned long header = __atomic_load_n(&(block->header), __ATOMIC_RELAXED);
+        unsigned long blocksize = header & (~0x3UL);
+
+        if((header & 0x1) && blocksize != 0 && (blocksize % 64UL) == 0
+            && blocksize <= (SF_CACHE_BINS * 64UL))
+        {
+            struct sf_thread_cache *cache = &thread_cache;
+            int bin = (blocksize / 64UL) - 1;
+
+            if(!cache->registered)
+            {
+                register_cache(cache);
+            }
+
+            //Marked as in this cache, so it may be a second free: look for it in the bin
+            if((block->body).links.prev == (sf_block *)cache)
+            {
+                for(sf_block *cached = cache->bins[bin]; cached != NULL; cached = (cached->body).links.next)
+                {
+                    if(cached == block)
+                    {
+                        abort();
+                    }
+                }
+            }
+
+            (block->body).links.next = cache->bins[bin];
+            (block->body).links.prev = (sf_block *)cache;
+            cache->bins[bin] = block;
+            cache->counts[bin]++;
+
+            if(cache->counts[bin] > 2 * cache_batch(bin))
+            {
+                drain_cache(cache, bin);
+            }
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&heap_lock);
+    sf_free_unlocked(pp);
+    pthread_mutex_unlock(&heap_lock);
+}
+
+void *sf_realloc(void *pp, size_t rsize) {
+    pthread_mutex_lock(&heap_lock);
+    void *payload = sf_realloc_unlocked(pp, rsize);
+    pthread_mutex_unlock(&heap_lock);
+
+    return payload;
+}
+
+void *sf_memalign(size_t size, size_t align) {
+    pthread_mutex_lock(&heap_lock);
+    void *payload = sf_memalign_unlocked(size, align);
+    pthread_mutex_unlock(&heap_lock);
+
+    return payload;
+}
+
+#endif
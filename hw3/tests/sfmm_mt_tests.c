@@ -0,0 +1,159 @@
+/**
+ * Tests of the thread-safe mode (-DSF_THREADS), built into their own binary,
+ * bin/sfmm_mt_tests. Without SF_THREADS, as in bin/sfmm_tests, this file is empty.
+ *
+ * Threads allocate and free at the same time, with and without the per-thread
+ * caches and while another thread turns them off and on, each filling its blocks
+ * with its own byte and checking it is still there before freeing them. Once they have all exited, the heap is checked and
+ * every block must have been coalesced back into the wilderness block.
+ */
+#ifdef SF_THREADS
+#define _POSIX_C_SOURCE 200809L
+#include <criterion/criterion.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "sfmm.h"
+#include "sfmm_threads.h"
+#include "sfmm_check.h"
+
+#define TEST_TIMEOUT 15
+#define TEST_THREADS 8
+#define TEST_OPS 20000      //operations per thread
+#define TEST_WINDOW 4       //live blocks per thread
+#define TEST_MAX_SIZE 600   //largest request, so some blocks are cached and some are not
+
+struct worker {
+    pthread_t thread;
+    unsigned long seed;
+    char fill;
+    long failed;
+    long overwritten;
+};
+
+static void *run_worker(void *arg)
+{
+    struct worker *w = arg;
+    char *live[TEST_WINDOW] = { NULL };
+    size_t sizes[TEST_WINDOW] = { 0 };
+    unsigned long x = w->seed;
+
+    for(long i = 0; i < TEST_OPS; i++)
+    {
+        int slot = i % TEST_WINDOW;
+        if(live[slot] != NULL)
+        {
+            for(size_t j = 0; j < sizes[slot]; j++)
+            {
+                if(live[slot][j] != w->fill)
+                {
+                    w->overwritten++;
+                    break;
+                }
+            }
+            sf_free(live[slot]);
+        }
+
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        sizes[slot] = x % TEST_MAX_SIZE + 1;
+        live[slot] = sf_malloc(sizes[slot]);
+        if(live[slot] == NULL)
+        {
+            w->failed++;
+        }
+        else
+        {
+            memset(live[slot], w->fill, sizes[slot]);
+        }
+    }
+    for(int slot = 0; slot < TEST_WINDOW; slot++)
+    {
+        if(live[slot] != NULL)
+        {
+            sf_free(live[slot]);
+        }
+    }
+    return NULL;
+}
+
+static void run_workers()
+{
+    struct worker workers[TEST_THREADS];
+    for(int t = 0; t < TEST_THREADS; t++)
+    {
+        workers[t].seed = 88172645463325252UL + t;
+        workers[t].fill = (char)(t + 1);
+        workers[t].failed = 0;
+        workers[t].overwritten = 0;
+        cr_assert_eq(pthread_create(&workers[t].thread, NULL, run_worker, &workers[t]), 0, "Thread not started");
+    }
+    for(int t = 0; t < TEST_THREADS; t++)
+    {
+        pthread_join(workers[t].thread, NULL);
+    }
+
+    for(int t = 0; t < TEST_THREADS; t++)
+    {
+        cr_assert_eq(workers[t].failed, 0, "Thread %d could not allocate %ld times", t, workers[t].failed);
+        cr_assert_eq(workers[t].overwritten, 0, "Thread %d found its blocks overwritten %ld times", t, workers[t].overwritten);
+    }
+}
+
+//The threads' caches went back to the free lists when they exited, and were coalesced
+static void assert_heap_coalesced()
+{
+    const char *problem = sf_check_heap();
+    cr_assert_null(problem, "Heap inconsistent: %s", problem);
+
+    int count = 0;
+    for(int i = 0; i < NUM_FREE_LISTS; i++)
+    {
+        for(sf_block *bp = sf_free_list_heads[i].body.links.next; bp != &sf_free_list_heads[i]; bp = bp->body.links.next)
+        {
+            count++;
+        }
+    }
+    cr_assert_eq(count, 1, "Wrong number of free blocks (exp=1, found=%d)", count);
+    cr_assert_neq(sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.next, &sf_free_list_heads[NUM_FREE_LISTS - 1],
+                  "Free block is not the wilderness block");
+}
+
+Test(sf_memsuite_threads, malloc_free_caches, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+    run_workers();
+    assert_heap_coalesced();
+}
+
+//Turns the caches off and on while the workers run
+static void *run_toggler(void *arg)
+{
+    int *stop = arg;
+    while(!__atomic_load_n(stop, __ATOMIC_RELAXED))
+    {
+        sf_set_thread_caches(0);
+        sched_yield();
+        sf_set_thread_caches(1);
+        sched_yield();
+    }
+    return NULL;
+}
+
+Test(sf_memsuite_threads, malloc_free_caches_toggled, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+    pthread_t toggler;
+    int stop = 0;
+    cr_assert_eq(pthread_create(&toggler, NULL, run_toggler, &stop), 0, "Thread not started");
+    run_workers();
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    pthread_join(toggler, NULL);
+    assert_heap_coalesced();
+}
+
+Test(sf_memsuite_threads, malloc_free_lock_only, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+    sf_set_thread_caches(0);
+    run_workers();
+    assert_heap_coalesced();
+}
+
+#endif
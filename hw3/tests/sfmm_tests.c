@@ -1,8 +1,12 @@
 #include <criterion/criterion.h>
 #include <errno.h>
+#include <limits.h>
 #include <signal.h>
+#include <stdlib.h>
 #include "debug.h"
 #include "sfmm.h"
+#include "sfmm_check.h"
+#include "sfmm_modes.h"
 #define TEST_TIMEOUT 15
 
 void assert_free_block_count(size_t size, int count);
@@ -205,3 +209,394 @@ Test(sf_memsuite_student, realloc_smaller_block_free_block, .init = sf_mem_init,
 //STUDENT UNIT TESTS SHOULD BE WRITTEN BELOW
 //DO NOT DELETE THESE COMMENTS
 //############################################
+
+#define WORKLOAD_SLOTS 24
+
+//xorshift, so that every run sees the same requests
+static unsigned long next_random(unsigned long *state)
+{
+    unsigned long x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static void assert_heap_consistent(int operation)
+{
+    const char *problem = sf_check_heap();
+    cr_assert_null(problem, "Heap inconsistent after %d operations: %s", operation, problem);
+}
+
+//Random sf_malloc, sf_free and sf_realloc of up to 4000 bytes in a window of live blocks,
+//checking the heap after every call, then everything is freed
+static void run_mixed_workload(int operations, size_t max_size)
+{
+    void *live[WORKLOAD_SLOTS] = { NULL };
+    unsigned long state = 88172645463325252UL;
+    for(int i = 0; i < operations; i++)
+    {
+        int slot = next_random(&state) % WORKLOAD_SLOTS;
+        int choice = next_random(&state) % 10;
+        size_t size = next_random(&state) % (choice < 5 ? 600 : max_size) + 1;
+        if(live[slot] == NULL)
+        {
+            live[slot] = sf_malloc(size);
+        }
+        else if(choice < 2)
+        {
+            void *moved = sf_realloc(live[slot], size);
+            if(moved != NULL)
+            {
+                live[slot] = moved;
+            }
+        }
+        else
+        {
+            sf_free(live[slot]);
+            live[slot] = NULL;
+        }
+        assert_heap_consistent(i);
+    }
+    for(int slot = 0; slot < WORKLOAD_SLOTS; slot++)
+    {
+        if(live[slot] != NULL)
+        {
+            sf_free(live[slot]);
+        }
+    }
+    assert_heap_consistent(operations);
+}
+
+//The free list and exact size bin bitmaps have a bit set exactly for the lists and bins that
+//are not empty, and each block is in the bin for its size, all through a mixed workload
+Test(sf_memsuite_student, bins_and_bitmaps_mixed_workload, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+    sf_errno = 0;
+    run_mixed_workload(20000, 4000);
+
+    //Everything coalesced back into the wilderness block
+    assert_free_block_count(0, 1);
+    assert_free_list_size(NUM_FREE_LISTS - 1, 1);
+}
+
+#define TREE_BLOCKS 4000
+#define TREE_STRIDE 128
+
+static void assert_free_lists_consistent(int operation)
+{
+    int free_blocks = 0;
+    const char *problem = check_free_lists(&free_blocks);
+    cr_assert_null(problem, "Free lists inconsistent after %d operations: %s", operation, problem);
+}
+
+//The tree's best fit for a size, against a search of every block in it
+static void assert_tree_best_fit(char *blocks, int in_tree[], unsigned long blocksize)
+{
+    unsigned long best_size = 0;
+    for(int n = 0; n < TREE_BLOCKS; n++)
+    {
+        unsigned long size = ((sf_block *)(blocks + n * TREE_STRIDE))->header & BLOCK_SIZE_MASK;
+        if(in_tree[n] && size >= blocksize && (best_size == 0 || size < best_size))
+        {
+            best_size = size;
+        }
+    }
+
+    sf_block *best = tree_best_fit(blocksize);
+    if(best_size == 0)
+    {
+        cr_assert_null(best, "Best fit for %lu found a block, but none is big enough", blocksize);
+        return;
+    }
+    cr_assert_not_null(best, "No best fit for %lu, expected a block of %lu", blocksize, best_size);
+    cr_assert_eq(best->header & BLOCK_SIZE_MASK, best_size, "Best fit for %lu is %lu bytes, expected %lu",
+                 blocksize, best->header & BLOCK_SIZE_MASK, best_size);
+    cr_assert(in_tree[((char *)best - blocks) / TREE_STRIDE], "Best fit for %lu is not in the tree", blocksize);
+}
+
+//Thousands of large blocks, many of the same size, put in and taken out of the largest
+//Fibonacci list at random, so that the tree rebalances in every way it can. The blocks
+//are not in the heap: only their headers and tree nodes are used
+Test(sf_memsuite_student, tree_insert_remove_best_fit, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+    //Sets up the free lists
+    sf_free(sf_malloc(1));
+
+    char *blocks = malloc(TREE_BLOCKS * TREE_STRIDE);
+    int in_tree[TREE_BLOCKS] = { 0 };
+    unsigned long state = 2463534242UL;
+    cr_assert_not_null(blocks, "No memory for the test blocks");
+
+    for(int i = 0; i < 20 * TREE_BLOCKS; i++)
+    {
+        int n = next_random(&state) % TREE_BLOCKS;
+        sf_block *block = (sf_block *)(blocks + n * TREE_STRIDE);
+        if(in_tree[n])
+        {
+            remove_from_free_list(block);
+        }
+        else
+        {
+            block->header = (35 + next_random(&state) % 300) * 64;
+            insert_into_free_list(block, NUM_FREE_LISTS - 2);
+        }
+        in_tree[n] = !in_tree[n];
+
+        if(i % 200 == 0)
+        {
+            assert_free_lists_consistent(i);
+            assert_tree_best_fit(blocks, in_tree, (35 + next_random(&state) % 310) * 64);
+        }
+    }
+
+    for(int n = 0; n < TREE_BLOCKS; n++)
+    {
+        if(in_tree[n])
+        {
+            remove_from_free_list((sf_block *)(blocks + n * TREE_STRIDE));
+            in_tree[n] = 0;
+        }
+    }
+    assert_free_lists_consistent(20 * TREE_BLOCKS);
+    cr_assert_null(tree_best_fit(0), "Tree not empty after every block was taken out");
+    assert_free_list_size(NUM_FREE_LISTS - 2, 0);
+    free(blocks);
+}
+
+//sf_malloc of a large block takes the smallest free one it fits in, from the tree
+Test(sf_memsuite_student, tree_best_fit_malloc, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+    size_t sizes[] = { 2500, 3000, 2300, 4000 };
+    void *large[4];
+    void *separators[4];
+    for(int i = 0; i < 4; i++)
+    {
+        large[i] = sf_malloc(sizes[i]);
+        separators[i] = sf_malloc(1);
+    }
+    for(int i = 0; i < 4; i++)
+    {
+        sf_free(large[i]);
+    }
+    assert_free_list_size(NUM_FREE_LISTS - 2, 4);
+    assert_heap_consistent(0);
+
+    //Block of 2944 bytes: the 3008 byte block fits best, leaving 64 bytes
+    void *x = sf_malloc(2900);
+    cr_assert_eq(x, large[1], "Large block not the best fit");
+    assert_free_list_size(NUM_FREE_LISTS - 2, 3);
+    assert_free_block_count(64, 1);
+    assert_heap_consistent(1);
+
+    for(int i = 0; i < 4; i++)
+    {
+        sf_free(separators[i]);
+    }
+    sf_free(x);
+    assert_heap_consistent(2);
+    assert_free_block_count(0, 1);
+}
+
+static size_t heap_size()
+{
+    return (char *)sf_mem_end() - (char *)sf_mem_start();
+}
+
+//The mixed workload with deferred coalescing, then turning it off frees the deferred blocks
+Test(sf_memsuite_student, deferred_coalescing_mixed_workload, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+    sf_set_deferred_coalescing(8);
+    run_mixed_workload(20000, 4000);
+
+    sf_set_deferred_coalescing(0);
+    assert_heap_consistent(20000);
+    assert_free_block_count(0, 1);
+}
+
+//A deferred block stays allocated and goes to the next request of its size
+Test(sf_memsuite_student, deferred_coalescing_reuse, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+    sf_set_deferred_coalescing(100);
+    void *x = sf_malloc(100);
+    void *y = sf_malloc(100);
+    sf_free(x);
+    sf_free(y);
+
+    assert_heap_consistent(0);
+    assert_free_block_count(0, 1);
+    cr_assert_eq(sf_malloc(100), y, "Last deferred block not used again");
+    cr_assert_eq(sf_malloc(100), x, "Deferred block not used again");
+    assert_heap_consistent(1);
+}
+
+//With blocks waiting, a request that only fits once they are coalesced does not grow the heap
+Test(sf_memsuite_student, deferred_coalescing_before_growing, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+    sf_set_deferred_coalescing(100);
+    void *blocks[12];
+    for(int i = 0; i < 12; i++)
+    {
+        blocks[i] = sf_malloc(1000);
+    }
+    size_t size = heap_size();
+    for(int i = 0; i < 12; i++)
+    {
+        sf_free(blocks[i]);
+    }
+    assert_heap_consistent(0);
+
+    //Bigger than the wilderness block, which is under a page
+    void *x = sf_malloc(8000);
+    cr_assert_eq(x, blocks[0], "Block not made of the coalesced deferred blocks");
+    cr_assert_eq(heap_size(), size, "Heap grew from %zu to %zu bytes", size, heap_size());
+    assert_heap_consistent(1);
+    assert_free_block_count(0, 1);
+}
+
+Test(sf_memsuite_student, deferred_coalescing_double_free, .init = sf_mem_init, .fini = sf_mem_fini, .signal = SIGABRT, .timeout = TEST_TIMEOUT) {
+    sf_set_deferred_coalescing(100);
+    void *x = sf_malloc(100);
+    sf_free(x);
+    sf_free(x);
+}
+
+//The heap grows by at least as much as it already has
+Test(sf_memsuite_student, geometric_growth, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+    sf_set_geometric_growth(1);
+    sf_malloc(15000);
+    size_t size = heap_size();
+
+    //Just more than the wilderness block has
+    sf_block *wild_block = sf_free_list_heads[NUM_FREE_LISTS - 1].body.links.next;
+    cr_assert_neq(wild_block, &sf_free_list_heads[NUM_FREE_LISTS - 1], "No wilderness block");
+    sf_malloc(wild_block->header & BLOCK_SIZE_MASK);
+    cr_assert(heap_size() >= 2 * size, "Heap grew from %zu to only %zu bytes", size, heap_size());
+    assert_heap_consistent(0);
+
+    run_mixed_workload(20000, 4000);
+    assert_free_block_count(0, 1);
+}
+
+static void fill(char *p, size_t size)
+{
+    for(size_t i = 0; i < size; i++)
+    {
+        p[i] = (char)(i * 7 + 1);
+    }
+}
+
+static void assert_filled(char *p, size_t size)
+{
+    for(size_t i = 0; i < size; i++)
+    {
+        cr_assert_eq(p[i], (char)(i * 7 + 1), "Byte %zu of the payload changed", i);
+    }
+}
+
+//In-place sf_realloc takes the free block after it and gives back what it does not need
+Test(sf_memsuite_student, realloc_in_place_next_block, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+    sf_set_realloc_in_place(1);
+    char *x = sf_malloc(100);
+    void *y = sf_malloc(500);
+    sf_malloc(10);
+    fill(x, 100);
+    sf_free(y);
+
+    //Blocks of 128 and 512 bytes become one of 320 and a free one of 320
+    char *z = sf_realloc(x, 300);
+    cr_assert_eq(z, x, "Block moved, although the next one was free");
+    assert_filled(z, 100);
+    cr_assert_eq(((sf_block *)(z - 16))->header & BLOCK_SIZE_MASK, 320, "Block of the wrong size");
+    assert_free_block_count(320, 1);
+    assert_free_block_count(0, 2);
+    assert_heap_consistent(0);
+}
+
+//A block before the wilderness block grows into it
+Test(sf_memsuite_student, realloc_in_place_wilderness, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+    sf_set_realloc_in_place(1);
+    char *x = sf_malloc(100);
+    fill(x, 100);
+
+    char *z = sf_realloc(x, 2000);
+    cr_assert_eq(z, x, "Block moved, although the wilderness block was after it");
+    assert_filled(z, 100);
+    cr_assert_eq(heap_size(), PAGE_SZ, "Heap grew, although the wilderness block was big enough");
+    assert_free_block_count(0, 1);
+    assert_free_list_size(NUM_FREE_LISTS - 1, 1);
+    assert_free_block_count(3968 - 2048, 1);
+    assert_heap_consistent(0);
+}
+
+//A block at the end of the heap grows with it
+Test(sf_memsuite_student, realloc_in_place_grow_heap, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+    sf_set_realloc_in_place(1);
+    char *x = sf_malloc(3000);
+    fill(x, 3000);
+
+    char *z = sf_realloc(x, 6000);
+    cr_assert_eq(z, x, "Block moved, although it was at the end of the heap");
+    assert_filled(z, 3000);
+    cr_assert_eq(heap_size(), 2 * PAGE_SZ, "Heap is %zu bytes, expected two pages", heap_size());
+    assert_free_block_count(0, 1);
+    assert_free_list_size(NUM_FREE_LISTS - 1, 1);
+    assert_heap_consistent(0);
+}
+
+//With an allocated block after it, the block is copied to a new one after all
+Test(sf_memsuite_student, realloc_in_place_fallback, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+    sf_set_realloc_in_place(1);
+    char *x = sf_malloc(100);
+    sf_malloc(100);
+    fill(x, 100);
+
+    char *z = sf_realloc(x, 500);
+    cr_assert_neq(z, x, "Block grew, although the next one was allocated");
+    assert_filled(z, 100);
+    assert_free_block_count(128, 1);
+    assert_free_block_count(0, 2);
+    assert_heap_consistent(0);
+}
+
+//The mixed workload with in-place sf_realloc
+Test(sf_memsuite_student, realloc_in_place_mixed_workload, .init = sf_mem_init, .fini = sf_mem_fini, .timeout = TEST_TIMEOUT) {
+    sf_set_realloc_in_place(1);
+    run_mixed_workload(20000, 4000);
+    assert_free_block_count(0, 1);
+}
+
+//The Fibonacci list index counted the way sf_malloc used to, one Fibonacci number at a time
+static int fib_index_by_loop(unsigned long size_class)
+{
+    unsigned long fib1 = 1;
+    unsigned long fib2 = 1;
+    int size_class_index = 0;
+
+    while(size_class > fib2 && size_class_index < (NUM_FREE_LISTS - 2))
+    {
+        size_class_index++;
+        unsigned long temp = fib2;
+        fib2 = fib2 + fib1;
+        fib1 = temp;
+    }
+    return size_class_index;
+}
+
+//The lookup table gives the same list as the loop on either side of every Fibonacci bound
+Test(sf_memsuite_student, fib_index_matches_loop, .timeout = TEST_TIMEOUT) {
+    for(unsigned long size_class = 0; size_class <= 200; size_class++)
+    {
+        cr_assert_eq(find_fib_index(size_class), fib_index_by_loop(size_class),
+                     "Size class %lu in list %d, expected %d", size_class,
+                     find_fib_index(size_class), fib_index_by_loop(size_class));
+    }
+    cr_assert_eq(find_fib_index(ULONG_MAX / 64), NUM_FREE_LISTS - 2, "Largest size class not in list %d", NUM_FREE_LISTS - 2);
+}
+
+//The header is added and the size rounded up to 64, until that would overflow
+Test(sf_memsuite_student, blocksize_boundaries, .timeout = TEST_TIMEOUT) {
+    cr_assert_eq(find_blocksize(0), 64, "Block size for 0 is %lu", find_blocksize(0));
+    cr_assert_eq(find_blocksize(56), 64, "Block size for 56 is %lu", find_blocksize(56));
+    cr_assert_eq(find_blocksize(57), 128, "Block size for 57 is %lu", find_blocksize(57));
+    cr_assert_eq(find_blocksize(120), 128, "Block size for 120 is %lu", find_blocksize(120));
+    cr_assert_eq(find_blocksize(ULONG_MAX - 71), ULONG_MAX - 63, "Largest block size is %lu", find_blocksize(ULONG_MAX - 71));
+    cr_assert_eq(find_blocksize(ULONG_MAX - 70), 0, "Block size for ULONG_MAX - 70 did not overflow");
+    cr_assert_eq(find_blocksize(ULONG_MAX - 7), 0, "Block size for ULONG_MAX - 7 did not overflow");
+    cr_assert_eq(find_blocksize(ULONG_MAX), 0, "Block size for ULONG_MAX did not overflow");
+}